@@ -0,0 +1,91 @@
+// alloc_stats.h
+//
+// Allocation and copy accounting for debug builds.
+//
+// Built with BLOB_ACCOUNTING, |Data| uses CountingAllocator, so every blob
+// buffer the process allocates is counted, and the places that copy blob
+// bytes go through CopyData() and CopyBytes() so that the bytes moved are
+// counted too. Without it the allocator is std::allocator and the wrappers
+// are plain copies.
+//
+// Counters are process wide: work done on the scheduler's threads during a
+// call is charged to that call.
+
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+
+struct AllocStats {
+  uint64_t allocs;
+  uint64_t alloc_bytes;
+  uint64_t copy_bytes;
+};
+
+namespace alloc_stats {
+
+inline std::atomic<uint64_t> allocs{0};
+inline std::atomic<uint64_t> alloc_bytes{0};
+inline std::atomic<uint64_t> copy_bytes{0};
+
+inline void count_alloc(size_t bytes) {
+  allocs.fetch_add(1, std::memory_order_relaxed);
+  alloc_bytes.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+#ifdef BLOB_ACCOUNTING
+inline void count_copy(size_t bytes) {
+  copy_bytes.fetch_add(bytes, std::memory_order_relaxed);
+}
+#else
+inline void count_copy(size_t) {}
+#endif
+
+}  // namespace alloc_stats
+
+template <typename T>
+struct CountingAllocator {
+  using value_type = T;
+
+  CountingAllocator() = default;
+  template <typename U>
+  CountingAllocator(const CountingAllocator<U>&) {}
+
+  T* allocate(size_t n) {
+    alloc_stats::count_alloc(n * sizeof(T));
+    return std::allocator<T>().allocate(n);
+  }
+
+  void deallocate(T* p, size_t n) {
+    std::allocator<T>().deallocate(p, n);
+  }
+
+  template <typename U>
+  bool operator==(const CountingAllocator<U>&) const { return true; }
+  template <typename U>
+  bool operator!=(const CountingAllocator<U>&) const { return false; }
+};
+
+inline AllocStats ReadAllocStats() {
+  return AllocStats {
+    alloc_stats::allocs.load(std::memory_order_relaxed),
+    alloc_stats::alloc_bytes.load(std::memory_order_relaxed),
+    alloc_stats::copy_bytes.load(std::memory_order_relaxed),
+  };
+}
+
+inline void CopyBytes(void* dst, const void* src, size_t n) {
+  alloc_stats::count_copy(n);
+  memcpy(dst, src, n);
+}
+
+// Returns a copy of |src|; use instead of copy-constructing blob buffers.
+template <typename D>
+D CopyData(const D& src) {
+  alloc_stats::count_copy(src.size());
+  return src;
+}
@@ -16,39 +16,36 @@
 #include "filesys.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
 #include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <type_traits>
 #include <unordered_map>
+#include <vector>
 
+#include "alloc_stats.h"
 #include "blob.h"
+#include "block_map.h"
+#include "dir_block.h"
+#include "fs_index.h"
+#include "fs_layout.h"
+#include "fs_reshard.h"
+#include "fs_stats.h"
+#include "fs_tiers.h"
+#include "fs_volume.h"
+#include "name_index.h"
+#include "numa_store.h"
+#include "op_stats.h"
 #include "ref_counted.h"
-
-// FNV-1a hash for 32 bits.
-class fnv32 {
- public:
-  static constexpr uint32_t FNV_INIT  = 0x811c9dc5UL;
-  static constexpr uint32_t FNV_32_PRIME = 0x01000193UL;
-
-  uint32_t operator()(const std::string &buf, uint32_t init = FNV_INIT) {
-    return operator()(buf.c_str(), buf.length(), init);
-  }
-
-  uint32_t operator()(const char* buf, size_t len, uint32_t init = FNV_INIT) {
-    auto bp = reinterpret_cast<const unsigned char *>(buf);
-    const unsigned char *be = bp + len;                                     
-
-    uint32_t hval = init;
-
-    while (bp < be) {
-      hval ^= static_cast<uint32_t>(*bp++);
-      hval *= FNV_32_PRIME;
-    }
-
-    return hval;
-  }
-};
+#include "tier_store.h"
 
 namespace g {
 
@@ -76,9 +73,12 @@ namespace g {
 // Disk layout:
 // Blob #0 is special, contains META_DISK.
 // Blob 1 to 2^10 are directory heads (DIR_HEADS)
-// Blob DIR_HEADS to 2^34 -1 is free for data and metadata.
+// Blob 2^10 + 1 to 2^11 are the heads' chain indexes.
+// Blob 2^11 + 1 to 2^34 -1 is free for metadata.
+// Data blobs are numbered apart, from 2^61 + 1 on (DATA_SPACE), and can be on
+// a store of their own. See fs_volume.h.
 //
-// meta block contains the next_free_blob_id.
+// meta block contains the next_free_blob_id and the next data blob id.
 //
 //
 //  Structure traversal.
@@ -98,6 +98,9 @@ namespace g {
 //  1. Direct hashing points to the blob id (from 1 to DIR_HEADS - 1) that might
 //     contain the {name, control-id} pair. This is a sequential search of all
 //     chained directories.
+//     Each head has a |ChainIndex| listing the blocks chained after it, so
+//     once the head misses the rest of the chain is fetched in parallel
+//     rather than one |next| at a time.
 //  2. Once found, the control block points to the data id of the blob that contains
 //     the range of interest. Given the maximun file size there are only 128 control
 //     blocks needed to define a file.
@@ -120,6 +123,51 @@ namespace g {
 //  small complexifications. If the Blob layer is ACID then it is possible
 //  to add transactions without a lot of changes.
 //
+// Reads mostly don't write. A block that was never written reads as a blank
+// one, so probing an empty directory head costs one Get and no Put, and
+// fread() of a range no fwrite() reached returns zeros if the file has data
+// further on (a hole) and 0 bytes otherwise. Only fwrite() allocates data
+// blobs. Two lookups do Put directory blocks: during a reshard, one that
+// finds its name in the old table moves the entry across, and one that
+// makes an entry hot moves it to the head of its chain; see below.
+//
+// Resharding. The bucket count isn't fixed forever: fdir_reshard() lays out
+// a bigger table of heads and chain indexes past next_free and records both
+// tables in META_DISK. From then on names hash into the new table; a lookup that
+// misses there tries the old one and moves the entry it finds across. A
+// background sweeper moves the rest, one old bucket at a time, and drops
+// the old table from META_DISK when it is done. The old heads and chained
+// blocks are left behind; there is no way to free blobs.
+//
+// Hot entries. A name created late sits at the tail of its bucket's chain
+// however often it is opened. Lookups count hits per file, in memory only,
+// and an entry that keeps being found past the head is moved into it,
+// swapped with its coldest entries once it is full, a few entries of a
+// bucket at a time. Skewed
+// workloads then mostly stop at the head.
+//
+// Packed blocks. Directory blocks keep their entries sorted by name and
+// front-coded: each stores only what its name doesn't share with the one
+// before, and every 16th starts over so a lookup can binary search those
+// restart points and decode one group. Names that share long prefixes fit
+// far more per block, so chains get shorter. Older volumes' raw blocks
+// are read as they are and packed the first time they change.
+//
+// Name index. The map<name, blob_id> ruled out above is affordable after
+// all on a volume that is mostly read and whose names pack well: see
+// fs_index.h. It is only built when asked for.
+//
+// Tiers. A volume can have a second, cheaper store for the data of files
+// nobody opens: data blob ids carry the tier they are on, and a migrator
+// moves files between tiers as their heat, kept in their first control
+// block, rises and decays. See fs_tiers.h.
+//
+// Partitions. Metadata can be spread over several stores, each with an
+// even range of the buckets, their blocks and the control blocks of the
+// files created in them. Blocks are allocated in the partition of the
+// block they are chained to, and the partition is part of their id; the
+// heads and chain indexes are found from the table. See fs_volume.h.
+//
 // EASY TODOS
 // - None of the API entrypoints do basic validation
 // - Probably needs to mantain file size in the first control block
@@ -127,92 +175,97 @@ namespace g {
 // - Reads and writes only handle "one blob" case.
 // - Modular arithmetic needs to be verified for writes and reads
 // - fremove() not implemented.
+//
+// The block structures themselves are in fs_layout.h.
 
+META_DISK* g_meta = nullptr;
 
-constexpr uint32_t META_RESERVED = 1u;
-constexpr uint32_t DIR_HEADS = (1u << 10);
+constexpr size_t CACHE_BLOBS = 256;
 
-constexpr char magic[16] = "vdisk2021-00001";
+// Cache of the data store stack.
+constexpr size_t DATA_CACHE_BLOBS = 256;
 
-struct META_DISK {
-  char magic[16];
-  uint64_t version;
-  uint64_t next_free;
-};
+// Set by fset_volume_stores().
+VolumeStores g_volume;
+// Under |g_data|.
+TierStore* g_tiered = nullptr;
 
-META_DISK* g_meta = nullptr;
+// Store stacks, built by finitialize(), one per metadata partition and one
+// for data. Blob requests are served by the cache of the caller's NUMA
+// node; its misses go through that node's scheduler rather than straight
+// to the store.
+std::vector<NumaStore*> g_parts;
+NumaStore* g_data = nullptr;
+// Partition 0's, which has META_DISK.
+NumaStore* g_store = nullptr;
 
-uint64_t get_next_free_id() { return g_meta->next_free++; }
+BlobStore* data_store() { return g_data; }
 
-uint32_t name_to_dir_id(const std::string& name) {
-  return (fnv32()(name)% DIR_HEADS) + META_RESERVED;
-}
+// The API is single threaded, but the reshard sweeper isn't the API's
+// caller. Each entry point that touches blocks holds this, and so does the
+// sweeper while it moves one bucket.
+std::mutex g_fs_mutex;
 
-enum class BlocTypes : uint32_t {
-  None,
-  Control,
-  Dir,
-  Data
-};
+std::thread g_sweeper;
+std::atomic<bool> g_sweeper_stop{false};
 
-enum class Flags : uint32_t {
-  None,
-  New
-};
+// New metadata blob id in |partition|.
+uint64_t get_next_free_id(uint64_t partition = 0) {
+  return partition << PARTITION_SHIFT | g_meta->next_free++;
+}
 
-struct BlockHeader {
-  BlocTypes type;
-  Flags flags;
-  uint64_t prev;
-  uint64_t next;
-};
+uint64_t get_next_data_id() { return DATA_SPACE | g_meta->next_data++; }
 
-struct ControlBlock : public BlockHeader {
-  typedef uint64_t Record;
-  static constexpr auto btype = BlocTypes::Control;
-  uint64_t directory;
-  uint64_t start;
-  Record blobs[0];
+bool resharding() { return g_meta->old_dir.heads != 0; }
 
-  // Find data block starting at |pos|.
-  uint64_t find(size_t pos, size_t blob_sz) const {
-    auto count = (blob_sz - sizeof(*this)) / sizeof(Record);
-    auto ix = pos / MaxBlobSize;
-    if (ix >= count) {
-      return 0;
-    }
-    return blobs[ix];
+// Partition of metadata blob |id|. Directory tables are found from the
+// volume's geometry; any other blob says.
+uint64_t partition_of(uint64_t id) {
+  auto parts = g_parts.size();
+  if (parts == 1 || !g_meta) {
+    return 0;
   }
-};
-
-static_assert(sizeof(ControlBlock) == (5 * 8u));
-static constexpr size_t bytes_per_ctrl_block =
-  MaxBlobSize * ((MaxBlobSize - sizeof(ControlBlock))/ sizeof(ControlBlock::Record));
+  if (auto tagged = id >> PARTITION_SHIFT) {
+    return tagged;
+  }
+  uint64_t bucket;
+  if (g_meta->dir.bucket_of(id, &bucket)) {
+    return bucket_partition(bucket, g_meta->dir.heads, parts);
+  }
+  if (resharding() && g_meta->old_dir.bucket_of(id, &bucket)) {
+    return bucket_partition(bucket, g_meta->old_dir.heads, parts);
+  }
+  return 0;
+}
 
-struct FileEntry {
-  char name[MAX_PATH];
-  uint64_t control_blob;
-};
+NumaStore* meta_store(uint64_t id) { return g_parts[partition_of(id)]; }
 
-struct DirBlock : public BlockHeader {
-  typedef FileEntry Record;
-  static constexpr auto btype = BlocTypes::Dir;
-  Record entries[0];
-
-  // Find control block for file |name|.
-  uint64_t find(const std::string& name, size_t blob_sz) const {
-    auto count = (blob_sz - sizeof(*this)) / sizeof(Record);
-    for (size_t ix = 0; ix != count; ++ix) {
-      if (name.compare(entries[ix].name) == 0) {
-        return entries[ix].control_blob;
-      }
-    }
-    return 0;
+// Stands in for a blob the store failed to read, so that FSNode always has
+// one. Every Put fails; readers check FSNode::failed() rather than take its
+// empty bytes for a block that was never written.
+class FailedBlob final : public Blob {
+ public:
+  const Data& Get() const override {
+    static const Data data;
+    return data;
   }
-
+  int Put(const Data&) override { return ErrInternal; }
+  int Release() override { return 0; }
 };
 
-static_assert(sizeof(DirBlock) == (3 * 8u));
+Blob* failed_blob() {
+  static FailedBlob blob;
+  return &blob;
+}
+
+void write_meta() {
+  Data data(sizeof(META_DISK));
+  memcpy(&data[0], g_meta, sizeof(META_DISK));
+  if (auto blob = g_store->GetBlob(0u)) {
+    blob->Put(data);
+    blob->Release();
+  }
+}
 
 template <typename T>
 const T* Blob2Block(Blob* blob) {
@@ -223,13 +276,12 @@ const T* Blob2Block(Blob* blob) {
 }
 
 template <typename THeader>
-bool WriteHeader(Blob* blob, const THeader& hdr) {
-  assert(blob->Get().size() >= sizeof(BlockHeader));
-  Data data = blob->Get();
+bool WriteHeader(Blob* blob, Data data, const THeader& hdr) {
+  assert(data.size() >= sizeof(BlockHeader));
   auto old_hdr = reinterpret_cast<THeader*>(&data[0]);
   assert(old_hdr->type == hdr.type);
   *old_hdr = hdr;
-  return blob->Put(data);
+  return blob->Put(data) == 0;
 }
 
 template <typename T>
@@ -237,7 +289,6 @@ class FSNode : public RefCounted<FSNode<T>> {
  public:
   FSNode(uint64_t id) : id_(0u), blob_(nullptr) {
     set_blob(id);
-    maybe_init();
   }
 
   ~FSNode() {
@@ -245,36 +296,70 @@ class FSNode : public RefCounted<FSNode<T>> {
   }
 
   bool set_next(uint64_t id) {
-    BlockHeader hdr = *Blob2Block<T>(blob_);
+    BlockHeader hdr = *get_ro();
     hdr.next = id;
-    return WriteHeader(blob_, hdr);
+    return WriteHeader(blob_, bytes(), hdr);
   }
 
   bool set_previous(uint64_t id) {
-    BlockHeader hdr = *Blob2Block<T>(blob_);
+    BlockHeader hdr = *get_ro();
     hdr.prev = id;
-    return WriteHeader(blob_, hdr);
+    return WriteHeader(blob_, bytes(), hdr);
   }
 
   template <typename Func>
   bool update_header(Func fn) {
-    auto new_header = fn(Blob2Block<T>(blob_));
-    return WriteHeader<T>(blob_, new_header);
+    auto new_header = fn(get_ro());
+    return WriteHeader<T>(blob_, bytes(), new_header);
   }
 
-  const T* get_ro() {
+  // A blob that was never written reads as a block with a blank header and
+  // no records. Nothing is Put until the block is modified.
+  const T* get_ro() const {
+    if (blob_->Get().empty()) {
+      return &blank();
+    }
     return Blob2Block<T>(blob_);
   }
 
   bool append_record(const typename T::Record& rec) {
-    if (size() > (MaxBlobSize - sizeof(rec))) {
+    return append_records(&rec, 1);
+  }
+
+  bool append_records(const typename T::Record* recs, size_t count) {
+    auto sz = count * sizeof(*recs);
+    if (sz > MaxBlobSize || size() > (MaxBlobSize - sz)) {
       return false;
     }
 
-    Data bytes = blob_->Get();
-    auto old_sz = bytes.size();
-    bytes.resize(old_sz + sizeof(rec));
-    memcpy(&bytes[old_sz], &rec, sizeof(rec));
+    Data data = bytes();
+    auto old_sz = data.size();
+    data.resize(old_sz + sz);
+    CopyBytes(&data[old_sz], recs, sz);
+    return (blob_->Put(data) == 0);
+  }
+
+  size_t records() const {
+    return (size() - sizeof(T)) / sizeof(typename T::Record);
+  }
+
+  // Replaces the whole block.
+  bool replace(const Data& data) {
+    return (blob_->Put(data) == 0);
+  }
+
+  bool set_record(size_t ix, const typename T::Record& rec) {
+    Data data = bytes();
+    CopyBytes(&data[sizeof(T) + ix * sizeof(rec)], &rec, sizeof(rec));
+    return (blob_->Put(data) == 0);
+  }
+
+  // Drops the records and the rest of the chain.
+  bool truncate() {
+    T hdr = *get_ro();
+    hdr.next = 0;
+    Data bytes(sizeof(hdr));
+    CopyBytes(&bytes[0], &hdr, sizeof(hdr));
     return (blob_->Put(bytes) == 0);
   }
 
@@ -294,215 +379,1129 @@ class FSNode : public RefCounted<FSNode<T>> {
     return true;
   }
 
-  size_t size() const { return blob_->Get().size(); }
+  size_t size() const { return std::max(blob_->Get().size(), sizeof(T)); }
   uint64_t id() const { return id_; }
+  // Whether the store failed to read the block.
+  bool failed() const { return blob_ == failed_blob(); }
 
  private:
   void set_blob(uint64_t id) {
     if (blob_) {
       blob_->Release();
     }
-    blob_ = GetBlobStore()->GetBlob(id);
+    blob_ = meta_store(id)->GetBlob(id);
+    if (!blob_) {
+      blob_ = failed_blob();
+    }
     id_ = id;
   }
 
-  void maybe_init() {
-    if (blob_->Get().size() == 0) {
-      T header = {};
-      header.type = T::btype;
-      Data data;
-      data.resize(sizeof(header));
-      memcpy(&data[0], &header, sizeof(header));
-      blob_->Put(data);
+  static const T& blank() {
+    static const T header = [] {
+      T hdr = {};
+      hdr.type = T::btype;
+      return hdr;
+    }();
+    return header;
+  }
+
+  // The block's bytes, to be modified and Put back.
+  Data bytes() const {
+    if (blob_->Get().empty()) {
+      Data data(sizeof(T));
+      memcpy(&data[0], &blank(), sizeof(T));
+      return data;
     }
+    return CopyData(blob_->Get());
   }
 
   uint64_t id_;
   Blob* blob_;
 };
 
+// Chains a new block after |prev|. A directory block is also added to the
+// chain index |index_id|, if its table has them.
 template <typename T>
-RefPtr<FSNode<T>> ChainBlock(RefPtr<FSNode<T>> prev) {
-  auto new_block = AdoptRef(new FSNode<T>(get_next_free_id()));
+RefPtr<FSNode<T>> ChainBlock(const RefPtr<FSNode<T>>& prev,
+                             uint64_t index_id = 0) {
+  auto new_block =
+      AdoptRef(new FSNode<T>(get_next_free_id(partition_of(prev->id()))));
   new_block->set_previous(prev->id());
   prev->set_next(new_block->id());
+  if (index_id) {
+    // When the index is full the rest of the chain just isn't prefetched.
+    AdoptRef(new FSNode<ChainIndex>(index_id))->append_record(new_block->id());
+  }
   return new_block;
 }
 
+// Blocks of a bucket chain kept in flight ahead of a lookup walking it.
+// SchedStore holds at most 32 prefetched blobs until they are claimed.
+constexpr size_t CHAIN_PREFETCH = 16;
+
+void prefetch_block(uint64_t id) {
+  auto part = meta_store(id);
+  if (!part->Cached(id)) {
+    part->Prefetch(id, IoClass::FgRead);
+  }
+}
+
+// Returned by find_in_chain() when the store failed to read a block.
+constexpr uint64_t READ_FAILED = ~0ull;
+
+// Looks for |name| in the bucket chain headed by |dir|, with chain index
+// |index_id| (or 0). Returns its control block id, leaving |dir| at the
+// block holding it, or returns 0 and leaves |dir| at the tail, or
+// READ_FAILED.
+uint64_t find_in_chain(RefPtr<FSNode<DirBlock>>& dir, uint64_t index_id,
+                       const std::string& name) {
+  std::vector<uint64_t> chain;
+  size_t block = 0;
+  size_t fetched = 0;
+  do {
+    if (dir->failed()) {
+      return READ_FAILED;
+    }
+    auto cb_id = dir_find(dir->get_ro(), dir->size(), name);
+    if (cb_id) {
+      return cb_id;
+    }
+    if (block == 0 && index_id && dir->get_ro()->next) {
+      // The head missed. Its next block is needed either way, so fetch it
+      // while reading the index.
+      prefetch_block(dir->get_ro()->next);
+      auto idx = AdoptRef(new FSNode<ChainIndex>(index_id));
+      auto hdr = idx->get_ro();
+      chain.assign(hdr->blocks, hdr->blocks + idx->records());
+      fetched = 1;
+    }
+    for (; fetched < std::min(chain.size(), block + CHAIN_PREFETCH);
+         ++fetched) {
+      prefetch_block(chain[fetched]);
+    }
+    ++block;
+  } while (dir->next());
+  return 0;
+}
+
 enum CbAction {
   FileMustExist,
   FileCreate,
 };
 
-
-RefPtr<FSNode<ControlBlock>> GetControlBlob(RefPtr<FSNode<DirBlock>> dir,
-                                            const std::string& name,
-                                            CbAction action) {
+// Points every control block of a file at the DirBlock holding its entry.
+void set_directory(uint64_t cb_id, uint64_t dir_id) {
+  auto cb = AdoptRef(new FSNode<ControlBlock>(cb_id));
   do {
-    auto cb_id = dir->get_ro()->find(name, dir->size());
-    if (cb_id) {
-      return AdoptRef(new FSNode<ControlBlock>(cb_id));;
+    cb->update_header([dir_id](const ControlBlock* hdr) {
+      ControlBlock new_hdr = *hdr;
+      new_hdr.directory = dir_id;
+      return new_hdr;
+    });
+  } while (cb->next());
+}
+
+// Entries of |dir|, sorted by name.
+std::vector<DirEntry> entries_of(const RefPtr<FSNode<DirBlock>>& dir) {
+  return dir_entries(dir->get_ro(), dir->size());
+}
+
+// Rewrites |dir| to hold |entries|, which are sorted. Returns false if
+// they don't fit.
+bool store_entries(const RefPtr<FSNode<DirBlock>>& dir,
+                   const std::vector<DirEntry>& entries) {
+  if (dir_packed_size(entries) > MaxBlobSize) {
+    return false;
+  }
+  return dir->replace(dir_pack(*dir->get_ro(), entries));
+}
+
+// Adds |entries| to |dir|, the tail of a bucket chain with chain index
+// |index_id|, chaining new blocks as the last one fills, and leaves |dir|
+// at the new tail. With |repoint| the control blocks of the entries are
+// pointed at the blocks they land in. Returns false, having added the
+// entries before it, if one doesn't fit even in an empty block or the store
+// fails.
+bool append_entries(RefPtr<FSNode<DirBlock>>& dir, uint64_t index_id,
+                    const std::vector<DirEntry>& entries, bool repoint) {
+  auto block = entries_of(dir);
+  size_t ix = 0;
+  while (ix != entries.size()) {
+    // The block with the next |count| entries added.
+    auto with = [&](size_t count) {
+      auto merged = block;
+      merged.insert(merged.end(), entries.begin() + ix,
+                    entries.begin() + ix + count);
+      std::sort(merged.begin(), merged.end(),
+                [](const DirEntry& a, const DirEntry& b) {
+                  return a.name < b.name;
+                });
+      return merged;
+    };
+    // As many as fit.
+    size_t lo = 0;
+    size_t hi = entries.size() - ix;
+    if (dir_packed_size(with(hi)) <= MaxBlobSize) {
+      lo = hi;
+    }
+    while (lo + 1 < hi) {
+      auto mid = lo + (hi - lo) / 2;
+      if (dir_packed_size(with(mid)) <= MaxBlobSize) {
+        lo = mid;
+      } else {
+        hi = mid;
+      }
+    }
+    if (lo == 0) {
+      if (block.empty()) {
+        return false;
+      }
+      dir = ChainBlock(dir, index_id);
+      block.clear();
+      continue;
+    }
+    block = with(lo);
+    if (!store_entries(dir, block)) {
+      return false;
+    }
+    for (auto end = ix + lo; ix != end; ++ix) {
+      if (repoint) {
+        set_directory(entries[ix].control_blob, dir->id());
+      }
     }
+  }
+  return true;
+}
+
+// Appends |entries| to the bucket chain headed by |head_id| in the current
+// table, and repoints their control blocks.
+void add_entries(uint64_t head_id, const std::vector<DirEntry>& entries) {
+  auto dir = AdoptRef(new FSNode<DirBlock>(head_id));
+  while (dir->next()) {
+  }
+  append_entries(dir, g_meta->dir.index_id(head_id), entries, true);
+}
 
+// While resharding: looks |name| up in the old table and, if it is there,
+// moves its entry to the new one. Returns its control block id, 0 or
+// READ_FAILED.
+uint64_t take_from_old_dir(const std::string& name) {
+  if (!resharding() || g_meta->old_dir.bucket(name) < g_meta->swept) {
+    return 0;
+  }
+  auto head_id = g_meta->old_dir.head_id(name);
+  auto dir = AdoptRef(new FSNode<DirBlock>(head_id));
+  auto cb_id = find_in_chain(dir, g_meta->old_dir.index_id(head_id), name);
+  if (cb_id && cb_id != READ_FAILED) {
+    add_entries(g_meta->dir.head_id(name), {{name, cb_id}});
+    auto entries = entries_of(dir);
+    entries.erase(std::remove_if(entries.begin(), entries.end(),
+        [&name](const DirEntry& e) { return e.name == name; }),
+        entries.end());
+    store_entries(dir, entries);
+  }
+  return cb_id;
+}
+
+// Moves every entry of the next unswept old bucket to the new table.
+void sweep_one_locked() {
+  auto head_id = g_meta->old_dir.base + g_meta->swept;
+  std::map<uint64_t, std::vector<DirEntry>> moves;
+  auto dir = AdoptRef(new FSNode<DirBlock>(head_id));
+  do {
+    for (auto& entry : entries_of(dir)) {
+      moves[g_meta->dir.head_id(entry.name)].push_back(std::move(entry));
+    }
   } while (dir->next());
 
+  for (auto& move : moves) {
+    add_entries(move.first, move.second);
+  }
+  if (!moves.empty()) {
+    AdoptRef(new FSNode<DirBlock>(head_id))->truncate();
+    if (auto index_id = g_meta->old_dir.index_id(head_id)) {
+      auto index = AdoptRef(new FSNode<ChainIndex>(index_id));
+      if (index->records()) {
+        index->truncate();
+      }
+    }
+  }
+
+  if (++g_meta->swept == g_meta->old_dir.heads) {
+    g_meta->old_dir = DirGeometry {};
+    g_meta->swept = 0;
+    write_meta();
+  }
+}
+
+void sweeper() {
+  while (!g_sweeper_stop.load(std::memory_order_relaxed)) {
+    {
+      std::lock_guard<std::mutex> lock(g_fs_mutex);
+      if (!resharding()) {
+        return;
+      }
+      sweep_one_locked();
+    }
+    // Let the API in between buckets.
+    std::this_thread::yield();
+  }
+}
+
+void start_sweeper() {
+  if (g_sweeper.joinable()) {
+    g_sweeper.join();
+  }
+  g_sweeper = std::thread(sweeper);
+}
+
+void stop_sweeper() {
+  if (g_sweeper.joinable()) {
+    g_sweeper_stop = true;
+    g_sweeper.join();
+    g_sweeper_stop = false;
+  }
+}
+
+// Lookups a file must take past its bucket's head before its entry is
+// moved into the head.
+constexpr uint32_t PROMOTE_HITS = 8;
+// Hot entries of one bucket are moved together, so its head is rewritten
+// once. One that keeps waiting for the rest is moved anyway.
+constexpr size_t PROMOTE_BATCH = 4;
+// Hit counts are halved every this many lookups.
+constexpr uint64_t AGE_LOOKUPS = 1u << 16;
+
+struct Heat {
+  // Recent lookups by control block id, which doesn't change as the entry
+  // moves.
+  std::unordered_map<uint64_t, uint32_t> hits;
+  // Hot control blocks found past the head, by head id.
+  std::unordered_map<uint64_t, std::vector<uint64_t>> pending;
+  // Hits a control block whose promotion failed, because it isn't hotter
+  // than the head's coldest entries, needs before it is tried again.
+  std::unordered_map<uint64_t, uint32_t> backoff;
+  uint64_t lookups = 0;
+};
+
+Heat g_heat;
+
+uint32_t heat(uint64_t cb_id) {
+  auto it = g_heat.hits.find(cb_id);
+  return it == g_heat.hits.end() ? 0 : it->second;
+}
+
+// Removes the entry of |cb_id| from |entries| and returns it.
+DirEntry take_entry(std::vector<DirEntry>* entries, uint64_t cb_id) {
+  auto it = std::find_if(entries->begin(), entries->end(),
+      [cb_id](const DirEntry& e) { return e.control_blob == cb_id; });
+  auto entry = std::move(*it);
+  entries->erase(it);
+  return entry;
+}
+
+// Moves the pending hot entries of the bucket headed by |head_id| into its
+// head, swapping each with the coldest entries there if the head is full,
+// and repoints the control blocks of everything that moved. Those that
+// don't fit back off until their hits double.
+void promote(uint64_t head_id) {
+  auto hot = std::move(g_heat.pending[head_id]);
+  g_heat.pending.erase(head_id);
+
+  auto head = AdoptRef(new FSNode<DirBlock>(head_id));
+  auto head_entries = entries_of(head);
+  // Head entries, coldest first.
+  std::vector<std::pair<uint32_t, uint64_t>> cold;
+  for (auto& entry : head_entries) {
+    cold.emplace_back(heat(entry.control_blob), entry.control_blob);
+  }
+  std::sort(cold.begin(), cold.end());
+
+  size_t used = 0;
+  std::vector<uint64_t> to_head;
+  auto dir = AdoptRef(new FSNode<DirBlock>(head_id));
+  while (to_head.size() != hot.size() && dir->next()) {
+    auto entries = entries_of(dir);
+    std::vector<uint64_t> here;
+    for (auto& entry : entries) {
+      if (std::find(hot.begin(), hot.end(), entry.control_blob) !=
+          hot.end()) {
+        here.push_back(entry.control_blob);
+      }
+    }
+    std::vector<uint64_t> to_dir;
+    bool changed = false;
+    for (auto cb_id : here) {
+      auto new_head = head_entries;
+      auto new_dir = entries;
+      dir_insert(&new_head, take_entry(&new_dir, cb_id));
+      // Names differ in length, so making room can take several victims.
+      auto taken = used;
+      while (dir_packed_size(new_head) > MaxBlobSize &&
+             taken != cold.size() && heat(cb_id) > cold[taken].first) {
+        dir_insert(&new_dir, take_entry(&new_head, cold[taken++].second));
+      }
+      if (dir_packed_size(new_head) > MaxBlobSize ||
+          dir_packed_size(new_dir) > MaxBlobSize) {
+        continue;
+      }
+      for (; used != taken; ++used) {
+        to_dir.push_back(cold[used].second);
+      }
+      head_entries = std::move(new_head);
+      entries = std::move(new_dir);
+      to_head.push_back(cb_id);
+      changed = true;
+    }
+    if (!changed) {
+      continue;
+    }
+    store_entries(dir, entries);
+    for (auto cb_id : to_dir) {
+      set_directory(cb_id, dir->id());
+    }
+  }
+
+  for (auto cb_id : hot) {
+    if (std::find(to_head.begin(), to_head.end(), cb_id) == to_head.end()) {
+      g_heat.backoff[cb_id] = 2 * heat(cb_id);
+    }
+  }
+  if (to_head.empty()) {
+    return;
+  }
+  store_entries(head, head_entries);
+  for (auto cb_id : to_head) {
+    set_directory(cb_id, head_id);
+  }
+}
+
+// Counts a lookup that found |cb_id| in the bucket headed by |head_id|, in a
+// block past the head if |deep|, and promotes the bucket's hot entries when
+// enough of them are waiting.
+void note_hit(uint64_t head_id, uint64_t cb_id, bool deep) {
+  if (++g_heat.lookups % AGE_LOOKUPS == 0) {
+    for (auto it = g_heat.hits.begin(); it != g_heat.hits.end();) {
+      it->second /= 2;
+      it = it->second ? std::next(it) : g_heat.hits.erase(it);
+    }
+    for (auto it = g_heat.backoff.begin(); it != g_heat.backoff.end();) {
+      it->second /= 2;
+      it = it->second > PROMOTE_HITS ? std::next(it) :
+          g_heat.backoff.erase(it);
+    }
+  }
+  auto hits = ++g_heat.hits[cb_id];
+  if (!deep || hits < PROMOTE_HITS) {
+    return;
+  }
+  auto backoff = g_heat.backoff.find(cb_id);
+  if (backoff != g_heat.backoff.end()) {
+    if (hits < backoff->second) {
+      return;
+    }
+    g_heat.backoff.erase(backoff);
+  }
+  auto& pending = g_heat.pending[head_id];
+  if (std::find(pending.begin(), pending.end(), cb_id) == pending.end()) {
+    pending.push_back(cb_id);
+  }
+  if (pending.size() >= PROMOTE_BATCH || hits >= 2 * PROMOTE_HITS) {
+    promote(head_id);
+  }
+}
+
+// The name index (fs_index.h).
+struct Names {
+  // Set once built.
+  std::unique_ptr<NameIndex> index;
+  // Names created since the build began, which |index| may lack.
+  std::unordered_map<std::string, uint64_t> created;
+  // Whether creates are recorded in |created|: while building and after.
+  bool tracking = false;
+};
+
+Names g_names;
+
+std::thread g_indexer;
+std::atomic<bool> g_indexer_stop{false};
+
+void note_created(const std::string& name, uint64_t cb_id) {
+  if (g_names.tracking) {
+    g_names.created.emplace(name, cb_id);
+  }
+}
+
+// Looks |name| up in the index, setting |cb_id| to its control block or 0.
+// Returns false if there is no index yet.
+bool find_indexed(const std::string& name, uint64_t* cb_id) {
+  if (!g_names.index) {
+    return false;
+  }
+  *cb_id = g_names.index->Find(name);
+  if (!*cb_id) {
+    auto it = g_names.created.find(name);
+    *cb_id = it == g_names.created.end() ? 0 : it->second;
+  }
+  return true;
+}
+
+// Buckets whose heads are fetched ahead of the one build_index() reads.
+constexpr uint64_t INDEX_PREFETCH = 16;
+
+// The buckets of a table of |heads|, taking one of each partition's in
+// turn, so that the heads fetched ahead are spread over the partitions and
+// fetched in parallel.
+std::vector<uint64_t> interleaved_buckets(uint64_t heads) {
+  uint64_t parts = g_parts.size();
+  // Partition p has buckets [first[p], first[p + 1]).
+  std::vector<uint64_t> first(parts + 1);
+  for (uint64_t p = 0; p <= parts; ++p) {
+    first[p] = (p * heads + parts - 1) / parts;
+  }
+  std::vector<uint64_t> order;
+  order.reserve(heads);
+  for (uint64_t round = 0; order.size() != heads; ++round) {
+    for (uint64_t p = 0; p != parts; ++p) {
+      if (first[p] + round < first[p + 1]) {
+        order.push_back(first[p] + round);
+      }
+    }
+  }
+  return order;
+}
+
+// Reads every bucket of the current table into a new index. Each chain is
+// read whole while holding the lock, so no entry is missed as it moves
+// within its bucket. Gives up if the table is resharded meanwhile, as
+// entries would move out of the buckets not read yet.
+void build_index() {
+  DirGeometry dir;
+  {
+    std::lock_guard<std::mutex> lock(g_fs_mutex);
+    dir = g_meta->dir;
+  }
+  auto order = interleaved_buckets(dir.heads);
+  std::vector<DirEntry> entries;
+  for (uint64_t ix = 0; ix != order.size(); ++ix) {
+    {
+      std::lock_guard<std::mutex> lock(g_fs_mutex);
+      if (g_indexer_stop || resharding() || g_meta->dir.base != dir.base) {
+        g_names = Names {};
+        return;
+      }
+      for (auto k = ix ? ix + INDEX_PREFETCH : 1;
+           k <= ix + INDEX_PREFETCH && k < order.size(); ++k) {
+        prefetch_block(dir.base + order[k]);
+      }
+      auto block = AdoptRef(new FSNode<DirBlock>(dir.base + order[ix]));
+      do {
+        auto more = entries_of(block);
+        entries.insert(entries.end(), std::make_move_iterator(more.begin()),
+                       std::make_move_iterator(more.end()));
+      } while (block->next());
+    }
+    // Let the API in between buckets.
+    std::this_thread::yield();
+  }
+  auto index = std::make_unique<NameIndex>(std::move(entries));
+  std::lock_guard<std::mutex> lock(g_fs_mutex);
+  if (!g_names.tracking) {
+    return;
+  }
+  // Names created in buckets not read yet are in both.
+  for (auto it = g_names.created.begin(); it != g_names.created.end();) {
+    it = index->Find(it->first) ? g_names.created.erase(it) : std::next(it);
+  }
+  g_names.index = std::move(index);
+}
+
+void stop_indexer() {
+  if (g_indexer.joinable()) {
+    g_indexer_stop = true;
+    g_indexer.join();
+    g_indexer_stop = false;
+  }
+}
+
+// Tiering (fs_tiers.h).
+struct Tiers {
+  // Opens since the last pass, by first control block id.
+  std::unordered_map<uint64_t, uint32_t> opens;
+  // Streams open now, by first control block id.
+  std::unordered_map<uint64_t, uint32_t> open;
+  TierStats stats = {};
+};
+
+Tiers g_tiers;
+
+// One pass at a time, whether run by the migrator or by ftier_pass().
+std::mutex g_pass_mutex;
+
+std::thread g_migrator;
+std::atomic<bool> g_migrator_stop{false};
+std::mutex g_migrator_mutex;
+std::condition_variable g_migrator_wake;
+
+void note_open(uint64_t cb_id) {
+  if (g_volume.cold) {
+    ++g_tiers.opens[cb_id];
+    ++g_tiers.open[cb_id];
+  }
+}
+
+void note_close(uint64_t cb_id) {
+  auto it = g_tiers.open.find(cb_id);
+  if (it != g_tiers.open.end() && --it->second == 0) {
+    g_tiers.open.erase(it);
+  }
+}
+
+// A data blob of a file changing tiers: the control block and record that
+// point at it, and the id of its copy on the other tier.
+struct TierCopy {
+  uint64_t cb_id;
+  size_t rec;
+  uint64_t from;
+  uint64_t to;
+};
+
+// Points the records of control block |cb| that |copies| lists at the
+// copies, and gives it header |hdr| unless null, in a single Put.
+void repoint_blobs(const RefPtr<FSNode<ControlBlock>>& cb,
+                   const ControlBlock* hdr,
+                   const std::vector<TierCopy>& copies) {
+  Data data(cb->size());
+  memcpy(&data[0], cb->get_ro(), data.size());
+  if (hdr) {
+    memcpy(&data[0], hdr, sizeof(*hdr));
+  }
+  auto recs =
+      reinterpret_cast<ControlBlock::Record*>(&data[sizeof(ControlBlock)]);
+  for (auto& copy : copies) {
+    if (copy.cb_id == cb->id()) {
+      recs[copy.rec] = copy.to;
+    }
+  }
+  cb->replace(data);
+}
+
+void blank_blob(uint64_t id) {
+  if (auto blob = data_store()->GetBlob(id)) {
+    blob->Put(Data());
+    blob->Release();
+  }
+}
+
+// Folds the opens of the file whose first control block is |cb_id| into
+// its heat, and moves its data if that makes it change tiers. |lock| holds
+// g_fs_mutex, except while the data is copied; a file opened meanwhile may
+// have been written, so it stays where it was and the copies are blanked.
+void tier_file(uint64_t cb_id, std::unique_lock<std::mutex>* lock) {
+  uint32_t opens = 0;
+  auto it = g_tiers.opens.find(cb_id);
+  if (it != g_tiers.opens.end()) {
+    opens = it->second;
+    g_tiers.opens.erase(it);
+  }
+  uint32_t heat;
+  bool cold;
+  {
+    auto first = AdoptRef(new FSNode<ControlBlock>(cb_id));
+    auto hdr = *first->get_ro();
+    heat = static_cast<uint32_t>(
+        std::min<uint64_t>(hdr.heat / 2 + uint64_t(opens), UINT32_MAX));
+    cold = hdr.flags == Flags::Cold;
+    bool move = !g_tiers.open.count(cb_id) &&
+                (cold ? heat >= TIER_HOT_HEAT : heat == 0);
+    if (!move) {
+      if (heat != hdr.heat) {
+        first->update_header([heat](const ControlBlock* old) {
+          ControlBlock new_hdr = *old;
+          new_hdr.heat = heat;
+          return new_hdr;
+        });
+      }
+      return;
+    }
+  }
+
+  uint64_t tier = cold ? 0 : COLD_TIER;
+  std::vector<TierCopy> copies;
+  {
+    auto cb = AdoptRef(new FSNode<ControlBlock>(cb_id));
+    do {
+      auto recs = cb->get_ro()->blobs;
+      for (size_t ix = 0; ix != cb->records(); ++ix) {
+        if (recs[ix] != 0 && (recs[ix] & COLD_TIER) != tier) {
+          copies.push_back(
+              {cb->id(), ix, recs[ix], get_next_data_id() | tier});
+        }
+      }
+    } while (cb->next());
+  }
+
+  lock->unlock();
+  bool copied = true;
+  for (auto& copy : copies) {
+    auto from = data_store()->GetBlob(copy.from);
+    auto to = data_store()->GetBlob(copy.to);
+    copied = copied && from && to && to->Put(from->Get()) == 0;
+    if (from) {
+      from->Release();
+    }
+    if (to) {
+      to->Release();
+    }
+  }
+  lock->lock();
+
+  // A file that failed to copy stays too, and is tried again next pass.
+  auto first = AdoptRef(new FSNode<ControlBlock>(cb_id));
+  if (!copied || g_tiers.opens.count(cb_id) || g_tiers.open.count(cb_id)) {
+    for (auto& copy : copies) {
+      blank_blob(copy.to);
+    }
+    first->update_header([heat](const ControlBlock* old) {
+      ControlBlock new_hdr = *old;
+      new_hdr.heat = heat;
+      return new_hdr;
+    });
+    return;
+  }
+  // The first block goes last, so it is only marked once the whole file
+  // has moved.
+  auto cb = AdoptRef(new FSNode<ControlBlock>(cb_id));
+  while (cb->next()) {
+    repoint_blobs(cb, nullptr, copies);
+  }
+  auto hdr = *first->get_ro();
+  hdr.heat = heat;
+  hdr.flags = cold ? Flags::None : Flags::Cold;
+  repoint_blobs(first, &hdr, copies);
+  for (auto& copy : copies) {
+    blank_blob(copy.from);
+  }
+  g_tiers.stats.blobs_moved += copies.size();
+  ++(cold ? g_tiers.stats.promoted : g_tiers.stats.demoted);
+}
+
+// Runs tier_file() on every file, a bucket at a time.
+bool tier_pass() {
+  std::lock_guard<std::mutex> pass(g_pass_mutex);
+  DirGeometry dir;
+  {
+    std::lock_guard<std::mutex> lock(g_fs_mutex);
+    if (!g_volume.cold || resharding()) {
+      return false;
+    }
+    dir = g_meta->dir;
+  }
+  auto stopped = [&dir] {
+    return g_migrator_stop || resharding() || g_meta->dir.base != dir.base;
+  };
+  for (uint64_t b = 0; b != dir.heads; ++b) {
+    std::vector<uint64_t> files;
+    {
+      std::lock_guard<std::mutex> lock(g_fs_mutex);
+      if (stopped()) {
+        return false;
+      }
+      auto block = AdoptRef(new FSNode<DirBlock>(dir.base + b));
+      do {
+        for (auto& entry : entries_of(block)) {
+          files.push_back(entry.control_blob);
+        }
+      } while (block->next());
+    }
+    // One file per hold, so the API gets in between files.
+    for (auto cb_id : files) {
+      std::unique_lock<std::mutex> lock(g_fs_mutex);
+      if (stopped()) {
+        return false;
+      }
+      tier_file(cb_id, &lock);
+    }
+  }
+  std::lock_guard<std::mutex> lock(g_fs_mutex);
+  ++g_tiers.stats.passes;
+  return true;
+}
+
+void migrator(std::chrono::milliseconds period) {
+  std::unique_lock<std::mutex> lock(g_migrator_mutex);
+  while (!g_migrator_wake.wait_for(lock, period,
+                                   [] { return g_migrator_stop.load(); })) {
+    lock.unlock();
+    tier_pass();
+    lock.lock();
+  }
+}
+
+void stop_migrator() {
+  if (g_migrator.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(g_migrator_mutex);
+      g_migrator_stop = true;
+    }
+    g_migrator_wake.notify_all();
+    g_migrator.join();
+    g_migrator_stop = false;
+  }
+}
+
+RefPtr<FSNode<ControlBlock>> GetControlBlob(RefPtr<FSNode<DirBlock>> dir,
+                                            const std::string& name,
+                                            CbAction action) {
+  auto head_id = dir->id();
+  auto index_id = g_meta->dir.index_id(head_id);
+  auto cb_id = find_in_chain(dir, index_id, name);
+  if (cb_id == 0) {
+    // Not moved to this table yet?
+    cb_id = take_from_old_dir(name);
+  } else if (cb_id != READ_FAILED) {
+    note_hit(head_id, cb_id, dir->id() != head_id);
+  }
+  if (cb_id == READ_FAILED) {
+    return 0;
+  }
+  if (cb_id) {
+    auto cb = AdoptRef(new FSNode<ControlBlock>(cb_id));
+    return cb->failed() ? 0 : cb;
+  }
+
   // File entry not found.
   if (action == FileMustExist) {
     return 0;
   }
 
-  // Create new control block and entry
-  auto ctrl_block = AdoptRef(new FSNode<ControlBlock>(get_next_free_id()));
+  // Create new control block and entry, in the bucket's partition. The
+  // entry may land in a new block chained after |dir|.
+  auto ctrl_block = AdoptRef(new FSNode<ControlBlock>(
+      get_next_free_id(partition_of(head_id))));
+  if (!append_entries(dir, index_id, {{name, ctrl_block->id()}}, false)) {
+    return 0;
+  }
 
   ctrl_block->update_header([dir_id =  dir->id()](const ControlBlock* hdr){
     ControlBlock new_hdr = *hdr;
     new_hdr.directory = dir_id;
     return new_hdr;
   });
+  note_created(name, ctrl_block->id());
+  return ctrl_block;
+}
 
-  FileEntry entry {};
-  entry.control_blob = ctrl_block->id();
-  name.copy(entry.name, sizeof(entry.name));
+// What the handles open on one file share, so that each sees the data
+// blobs the others allocate.
+struct OpenFile {
+  uint32_t handles = 0;
+  // Ids of the file's control blocks by |start|, as far as they have been
+  // walked. The first is the one its directory entry points at.
+  std::vector<uint64_t> ctrl;
+  // Data blob ids of the control blocks read so far, so that reads and
+  // writes neither hold nor re-read them.
+  BlockMap map;
+  std::vector<bool> mapped;
+};
 
-  // Try append to current directory
-  if (dir->append_record(entry)) {
-    return ctrl_block;
-  }
+// By the id of the file's first control block.
+std::unordered_map<uint64_t, OpenFile> g_open_files;
 
-  // Full dir blob. Chain a new dir entry.
-  auto new_dir = ChainBlock(dir);
+struct FILE {
+  size_t position = 0;
+  OpenFile* file = nullptr;
+};
 
-  // Append to new dir entry.
-  if (new_dir->append_record(entry)) {
-    return ctrl_block;
+// A new handle on the file whose first control block is |cb_id|.
+FILE* open_handle(uint64_t cb_id) {
+  note_open(cb_id);
+  auto& file = g_open_files[cb_id];
+  if (file.handles++ == 0) {
+    file.ctrl.push_back(cb_id);
   }
-
-  return 0;
+  return new FILE {0, &file};
 }
 
-// Note that this function mutates |cb|.
-Blob* GetDataBlob(RefPtr<FSNode<ControlBlock>>& cb, size_t position) {
-  uint64_t start_ctrl_block = position / bytes_per_ctrl_block;
-  size_t offset = position % bytes_per_ctrl_block;
-
-  while (true) {
-    auto delta = start_ctrl_block - cb->get_ro()->start;
-
-    if (delta == 0) {
-      auto data_blob_id = cb->get_ro()->find(offset, cb->size());
-      if (data_blob_id == 0) {
-        data_blob_id =  get_next_free_id();
-        cb->append_record(data_blob_id);
+constexpr uint64_t blobs_per_ctrl_block = bytes_per_ctrl_block / MaxBlobSize;
+
+// Finds control block |start| of |stream|'s file, chaining new ones up to
+// it if |create|, and copies its data blob ids into the block map. Returns
+// null if there is no such block, and the block the walk stopped at if the
+// store failed to read it, which failed() tells.
+RefPtr<FSNode<ControlBlock>> MapCtrlBlock(FILE* stream, uint64_t start,
+                                          bool create) {
+  auto known = std::min<uint64_t>(start, stream->file->ctrl.size() - 1);
+  auto cb = AdoptRef(new FSNode<ControlBlock>(stream->file->ctrl[known]));
+  while (!cb->failed() && cb->get_ro()->start != start) {
+    if (!cb->next()) {
+      if (!create) {
+        return nullptr;
       }
+      // New control block for this data range. This is needed because
+      // fseek is lazy.
+      auto next_start = cb->get_ro()->start + 1;
+      auto directory = cb->get_ro()->directory;
+
+      cb = ChainBlock(cb);
+      cb->update_header([&next_start, &directory](const ControlBlock* hdr) {
+        ControlBlock new_header = *hdr;
+        new_header.start = next_start;
+        new_header.directory = directory;
+        return new_header;
+      });
+    }
+    if (stream->file->ctrl.size() == cb->get_ro()->start) {
+      stream->file->ctrl.push_back(cb->id());
+    }
+  }
+  if (cb->failed()) {
+    return cb;
+  }
 
-      return GetBlobStore()->GetBlob(data_blob_id);
+  if (stream->file->mapped.size() <= start) {
+    stream->file->mapped.resize(start + 1);
+  }
+  if (!stream->file->mapped[start]) {
+    stream->file->map.Set(start * blobs_per_ctrl_block, cb->get_ro()->blobs,
+                    cb->records());
+    stream->file->mapped[start] = true;
+  }
+  return cb;
+}
 
-    } else if (delta < 0) {
-      if (!cb->prev()) {
-        // Strange error! (until we support sparse files)
-        return nullptr;
-      }
-    } else {
-      if (!cb->next()) {
-        // New control block for this data range. This is needed because
-        // fseek is lazy.
-        auto next_start = cb->get_ro()->start + 1;
-        auto directory = cb->get_ro()->directory;
-
-        cb = ChainBlock(cb);
-        cb->update_header([&next_start, &directory](const ControlBlock* hdr) {
-          ControlBlock new_header = *hdr;
-          new_header.start = next_start;
-          new_header.directory = directory;
-          return new_header;
-        });
+// Sets |*blob| to the data blob holding |position|. If there is none yet,
+// allocates one when |create| is set and sets nullptr otherwise, so reads
+// never write. Returns ErrInternal, and sets nullptr, if the store failed to
+// read a control block or the blob.
+int GetDataBlob(FILE* stream, size_t position, bool create, Blob** blob) {
+  *blob = nullptr;
+  StatScope scope(Op::GetDataBlob);
+  uint64_t start = position / bytes_per_ctrl_block;
+  uint64_t ix = position / MaxBlobSize;
+
+  auto data_blob_id = stream->file->map.Get(ix);
+  bool mapped = start < stream->file->mapped.size() && stream->file->mapped[start];
+  if (data_blob_id == 0 && (create || !mapped)) {
+    auto cb = MapCtrlBlock(stream, start, create);
+    if (cb && cb->failed()) {
+      return ErrInternal;
+    }
+    data_blob_id = stream->file->map.Get(ix);
+    if (cb && data_blob_id == 0 && create) {
+      data_blob_id = get_next_data_id();
+      auto rec = ix - start * blobs_per_ctrl_block;
+      if (rec < cb->records()) {
+        // Fills a hole.
+        cb->set_record(rec, data_blob_id);
+      } else {
+        // Blobs a seek skipped over are holes, recorded as 0.
+        std::vector<ControlBlock::Record> recs(rec - cb->records() + 1);
+        recs.back() = data_blob_id;
+        cb->append_records(recs.data(), recs.size());
       }
+      stream->file->map.Set(ix, data_blob_id);
+    }
+  }
+
+  if (data_blob_id) {
+    *blob = data_store()->GetBlob(data_blob_id);
+    if (!*blob) {
+      return ErrInternal;
     }
   }
+  return 0;
+}
+
+void fset_volume_stores(const VolumeStores& stores) {
+  g_volume = stores;
 }
 
 void finitialize() {
+  auto meta_store = g_volume.meta ? g_volume.meta : GetBlobStore();
+  auto bulk_store = g_volume.data ? g_volume.data : GetBlobStore();
+  g_tiered = new TierStore(meta_store, bulk_store,
+                           g_volume.cold ? g_volume.cold : bulk_store);
+  g_parts.push_back(new NumaStore(meta_store, CACHE_BLOBS));
+  for (auto part : g_volume.partitions) {
+    g_parts.push_back(new NumaStore(part, CACHE_BLOBS));
+  }
+  g_store = g_parts[0];
+  g_data = new NumaStore(g_tiered, DATA_CACHE_BLOBS);
+
   META_DISK* meta = nullptr;
 
-  auto blob = GetBlobStore()->GetBlob(0u);
-  if (blob->Get().size() < sizeof(META_DISK)) {
+  auto blob = g_store->GetBlob(0u);
+  auto& bytes = blob->Get();
+  if (bytes.size() < META_DISK_V1_SIZE) {
     // Init disk.
-    meta = new META_DISK {{}, 1, DIR_HEADS + 1};
+    meta = new META_DISK {{}, META_VERSION, 2 * DIR_HEADS + 1,
+                          {META_RESERVED, DIR_HEADS, DIR_HEADS + 1},
+                          {}, 0, 1};
     memcpy(meta->magic, magic, sizeof(magic));
-    Data bytes(sizeof(META_DISK));
-    memcpy(&bytes[0], meta, sizeof(META_DISK));
-    blob->Put(bytes);
   } else {
-    // Validate disk.
-    auto actual = reinterpret_cast<const META_DISK*>(&blob->Get()[0]);
-    if (strcmp(actual->magic, magic) != 0) {
+    // Validate disk, and upgrade it if it is older.
+    meta = new META_DISK {};
+    if (!read_meta(bytes, meta)) {
       assert(false);
     }
-    assert(actual->version == 1);
-    assert(actual->next_free > DIR_HEADS);
-    meta = new META_DISK {*actual};
+    assert(meta->next_free > DIR_HEADS);
   }
 
   blob->Release();
   g_meta = meta;
+  write_meta();
+
+  // A reshard that was running at the last unmount carries on.
+  if (resharding()) {
+    start_sweeper();
+  }
+  if (getenv("BLOB_NAME_INDEX")) {
+    fname_index();
+  }
 }
 
 void ffinalize() {
-  Data data(sizeof(META_DISK));
-  memcpy(&data[0], g_meta, sizeof(META_DISK));
-  auto blob = GetBlobStore()->GetBlob(0u);
-  blob->Put(data);
-  blob->Release();
+  stop_sweeper();
+  stop_indexer();
+  stop_migrator();
+  std::lock_guard<std::mutex> lock(g_fs_mutex);
+  write_meta();
+  g_heat = Heat {};
+  g_open_files.clear();
+  g_names = Names {};
+  g_tiers = Tiers {};
   delete g_meta;
+  for (auto part : g_parts) {
+    delete part;
+  }
+  g_parts.clear();
+  g_store = nullptr;
+  delete g_data;
+  delete g_tiered;
+  g_tiered = nullptr;
 }
 
-struct FILE {
-  size_t position;
-  RefPtr<FSNode<ControlBlock>> cb;
-};
-
-
 FILE* fopen(const char* filename, const char* mode) {
+  StatScope scope(Op::Open);
+  std::lock_guard<std::mutex> lock(g_fs_mutex);
   CbAction action = ((mode[0] == 'w') || (mode[1] == 'w')) ?
     FileCreate : FileMustExist;
 
   std::string name(filename);
-  auto dir_id = name_to_dir_id(name);
+  if (name.size() > MAX_PATH) {
+    return nullptr;
+  }
+  // Names the index knows, and with it names that don't exist, need no
+  // directory block. Creates still append to the bucket.
+  uint64_t cb_id;
+  if (find_indexed(name, &cb_id) && (cb_id || action == FileMustExist)) {
+    if (!cb_id) {
+      return nullptr;
+    }
+    return open_handle(cb_id);
+  }
+  auto dir_id = g_meta->dir.head_id(name);
   auto dir = AdoptRef(new FSNode<DirBlock>(dir_id));
   auto ctrl_block = GetControlBlob(std::move(dir), name, action);
   if (!ctrl_block) {
     return nullptr;
   }
 
-  return new FILE { 0, std::move(ctrl_block) };
+  return open_handle(ctrl_block->id());
 }
 
 long fclose(FILE* stream) {
+  std::lock_guard<std::mutex> lock(g_fs_mutex);
+  auto cb_id = stream->file->ctrl[0];
+  note_close(cb_id);
+  if (--stream->file->handles == 0) {
+    g_open_files.erase(cb_id);
+  }
   delete stream;
   return 0;
 }
 
+// Sets |*after| to whether the file has data past the blob holding
+// |position|. Returns ErrInternal if the store failed to read a control
+// block.
+int data_after(FILE* stream, size_t position, bool* after) {
+  *after = true;
+  if (stream->file->map.size() > position / MaxBlobSize + 1) {
+    return 0;
+  }
+  // Not in the ranges mapped so far; is there a control block further on?
+  auto cb = MapCtrlBlock(stream, position / bytes_per_ctrl_block, false);
+  if (cb && cb->failed()) {
+    return ErrInternal;
+  }
+  *after = cb && cb->get_ro()->next != 0;
+  return 0;
+}
+
 long fread(FILE* stream, void *buffer, long count) {
+  StatScope scope(Op::Read);
+  std::lock_guard<std::mutex> lock(g_fs_mutex);
   // TODO: handle multi-blob.
-  auto blob = GetDataBlob(stream->cb, stream->position);
+  Blob* blob;
+  if (GetDataBlob(stream, stream->position, false, &blob) != 0) {
+    // The store failed, which mustn't read as a hole or the end.
+    return -2;
+  }
   size_t offset = stream->position % MaxBlobSize;
-  auto to_read = std::min(count, static_cast<long>(blob->Get().size() - offset));
-  memcpy(buffer, &blob->Get()[offset], to_read);
-  blob->Release();
+  size_t size = blob ? blob->Get().size() : 0;
+  long to_read = 0;
+  bool after = false;
+  if (offset >= size && data_after(stream, stream->position, &after) != 0) {
+    if (blob) {
+      blob->Release();
+    }
+    return -2;
+  }
+  if (offset < size) {
+    to_read = std::min(count, static_cast<long>(size - offset));
+    CopyBytes(buffer, &blob->Get()[offset], to_read);
+  } else if (after) {
+    // A hole, which reads as zeros up to the next blob.
+    to_read = std::min(count, static_cast<long>(MaxBlobSize - offset));
+    memset(buffer, 0, to_read);
+  }
+  // Otherwise at or past the end of the data.
+  if (blob) {
+    blob->Release();
+  }
+  if (to_read == 0) {
+    return 0;
+  }
+
+  // Sequential reader past the middle of this blob: fetch the next one in
+  // the background. It is claimed by the next GetBlob() or goes stale.
+  if (offset + to_read > MaxBlobSize / 2) {
+    if (auto id = stream->file->map.Get(stream->position / MaxBlobSize + 1)) {
+      g_data->Prefetch(id);
+    }
+  }
+  stream->position += to_read;
   return to_read;
 }
  
 long fwrite(FILE* stream, const void* buffer, long count) {
+  StatScope scope(Op::Write);
+  std::lock_guard<std::mutex> lock(g_fs_mutex);
   // TODO: handle multi-blob.
-  auto blob = GetDataBlob(stream->cb, stream->position);
+  Blob* blob;
+  if (GetDataBlob(stream, stream->position, true, &blob) != 0 || !blob) {
+    // The store failed.
+    return -2;
+  }
   size_t offset = stream->position % MaxBlobSize;
 
-  auto data = blob->Get();
+  auto data = CopyData(blob->Get());
 
   if (data.size() < (offset + count)) {
     data.resize(offset + count);
   }
-  memcpy(&data[offset], buffer, count);
+  CopyBytes(&data[offset], buffer, count);
   auto res = blob->Put(data);
   blob->Release();
   if (res != 0) {
@@ -535,4 +1534,112 @@ long fremove(const char* filename) {
   return -1;
 }
 
+bool fdir_reshard(uint32_t heads, bool background) {
+  {
+    std::lock_guard<std::mutex> lock(g_fs_mutex);
+    if (heads == 0 || resharding()) {
+      return false;
+    }
+    g_meta->old_dir = g_meta->dir;
+    g_meta->dir = DirGeometry {g_meta->next_free, heads,
+                               g_meta->next_free + heads};
+    g_meta->next_free += 2 * heads;
+    g_meta->swept = 0;
+    // Both tables must be on disk before any entry moves.
+    write_meta();
+  }
+  if (background) {
+    start_sweeper();
+    return true;
+  }
+  std::lock_guard<std::mutex> lock(g_fs_mutex);
+  while (resharding()) {
+    sweep_one_locked();
+  }
+  return true;
+}
+
+uint64_t fdir_reshard_pending() {
+  std::lock_guard<std::mutex> lock(g_fs_mutex);
+  return resharding() ? g_meta->old_dir.heads - g_meta->swept : 0;
+}
+
+bool fname_index(bool background) {
+  {
+    std::lock_guard<std::mutex> lock(g_fs_mutex);
+    if (g_names.tracking || resharding()) {
+      return false;
+    }
+    g_names.tracking = true;
+  }
+  if (background) {
+    stop_indexer();
+    g_indexer = std::thread(build_index);
+    return true;
+  }
+  build_index();
+  return fname_index_ready();
+}
+
+bool fname_index_ready() {
+  std::lock_guard<std::mutex> lock(g_fs_mutex);
+  return g_names.index != nullptr;
+}
+
+uint64_t fname_index_names() {
+  std::lock_guard<std::mutex> lock(g_fs_mutex);
+  return g_names.index ? g_names.index->size() + g_names.created.size() : 0;
+}
+
+uint64_t fname_index_bytes() {
+  std::lock_guard<std::mutex> lock(g_fs_mutex);
+  return g_names.index ? g_names.index->bytes() : 0;
+}
+
+bool ftier_pass() {
+  return tier_pass();
+}
+
+bool ftier_start(uint32_t period_ms) {
+  {
+    std::lock_guard<std::mutex> lock(g_fs_mutex);
+    if (!g_volume.cold || g_migrator.joinable()) {
+      return false;
+    }
+  }
+  g_migrator = std::thread(migrator, std::chrono::milliseconds(period_ms));
+  return true;
+}
+
+void ftier_stats(TierStats* stats) {
+  std::lock_guard<std::mutex> lock(g_fs_mutex);
+  *stats = g_tiers.stats;
+}
+
+void fstats(Stats* stats) {
+  *stats = Stats {};
+  read_op_stats(stats->ops);
+  auto stacks = g_parts;
+  stacks.push_back(g_data);
+  for (auto stack : stacks) {
+    auto cache = stack->cache_stats();
+    stats->cache_hits += cache.hits;
+    stats->cache_misses += cache.misses;
+    stats->cache_coalesced += cache.coalesced;
+    stats->cache_evictions += cache.evictions;
+    stats->cache_rejected += cache.rejected;
+  }
+  auto data = g_data->cache_stats();
+  stats->data_cache_hits = data.hits;
+  stats->data_cache_misses = data.misses;
+}
+
+void fstats_reset() {
+  reset_op_stats();
+  for (auto part : g_parts) {
+    part->reset_cache_stats();
+  }
+  g_data->reset_cache_stats();
+}
+
 }  // namespace g
@@ -0,0 +1,667 @@
+// bench.cc
+//
+// Benchmark driver for the filesys.h implementation. Runs a few fixed
+// phases against a fresh volume and prints, per phase, the latency of each
+// call and, per instrumented operation, the counters from fs_stats.h:
+//
+//   create   fopen("w") + fwrite() in |chunk| pieces + fclose(), per file.
+//   read     fopen("r") + fseek()/fread() in |chunk| pieces + fclose().
+//   miss     fopen("r") of names that don't exist.
+//   hot      With -hot N, N times: a whole read of a file bigger than the
+//            blob cache, then kHotOpens fopen("r") + fread() of a chunk of
+//            a set of kHotFiles small files. Prints the store Gets each
+//            hot open costs, i.e. how much of the hot set the scans evict;
+//            the phase's metadata and data cache counts show which.
+//   index    With -index 1, fname_index() on the volume remounted, so from
+//            cold caches.
+//
+// With -stripe N, file data is striped (stripe_store.h) over N slices of
+// the store, and halfway through the create phase one more slice is added,
+// so the rest of the creates race the rebalancer moving blobs to it. Prints
+// the share of the data blobs there at the add that moved, about 1/(N+1)
+// if placement is even, and how long after the add the last one did.
+//
+// usage: bench [-files N] [-size BYTES] [-chunk BYTES] [-perf N] [-json PATH]
+//              [-store SOCKET] [-file PATH [-direct 1] [-sync 1]] [-hot N]
+//              [-index 1] [-partitions N] [-latency US] [-stripe N]
+//              [-commit T]
+//
+// Build with -DBLOB_ACCOUNTING to get the allocation and copy columns. The
+// blob traffic table is always there; cost_predict models it.
+//
+// -json also writes the results, every latency sample included, with host
+// and build metadata to PATH; bench_compare diffs two such files.
+//
+// -store keeps the volume in a store_daemon listening at SOCKET instead of
+// in this process, to see what an out-of-process store costs. It talks to
+// it through shared memory if the daemon takes it, and else on the socket.
+// -file keeps it in a fresh file instead, read and written with O_DIRECT
+// if -direct is 1, and with every Put made durable, by group commit, if
+// -sync is 1.
+//
+// With -sync 1, -commit T also has T threads Put kCommitPuts small blobs
+// each straight to the file, and prints the Puts per second and how many
+// Puts each sync covered.
+//
+// -partitions splits the metadata over N partitions (fs_volume.h), all on
+// the same store. -latency makes every metadata Get wait US microseconds
+// first, standing in for a remote store, so that the partitions' requests
+// have something to overlap.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/utsname.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "filesys.h"
+#include "fs_stats.h"
+#include "file_store.h"
+#include "fs_index.h"
+#include "fs_volume.h"
+#include "rpc_store.h"
+#include "stripe_store.h"
+
+namespace {
+
+// Slots are only written once used, so the file stays sparse.
+constexpr uint64_t kFileCapacity = 64ull << 30;
+
+// The hot phase. Scanned files are bigger than the 256 blob cache, and
+// take 600 MiB together.
+constexpr long kHotFiles = 40;
+constexpr long kHotOpens = 40;
+constexpr long kScanFiles = 8;
+constexpr long kScanBlobs = 300;
+
+// -commit. Its ids are above any the filesystem uses.
+constexpr long kCommitPuts = 200;
+constexpr size_t kCommitBlob = 200;
+constexpr uint64_t kCommitIds = 1ull << 63;
+
+// Data ids have DATA_SPACE set and use the bits below this one, and
+// metadata ids don't, so slices never share an id with anything else.
+constexpr int kSliceShift = 48;
+
+struct Options {
+  long files = 2000;
+  long size = 64 * 1024;
+  long chunk = 4096;
+  uint32_t perf = 1;
+  std::string json;
+  std::string store;
+  std::string file;
+  bool direct = false;
+  bool sync = false;
+  long hot = 0;
+  bool index = false;
+  long partitions = 1;
+  long latency = 0;
+  long stripe = 0;
+  long commit = 0;
+};
+
+// A metadata partition of -partitions and -latency, on |inner|.
+class PartitionStore final : public BlobStore {
+ public:
+  PartitionStore(BlobStore* inner, std::chrono::microseconds latency)
+      : inner_(inner), latency_(latency) {}
+
+  Blob* GetBlob(uint64_t id) override {
+    if (latency_.count()) {
+      std::this_thread::sleep_for(latency_);
+    }
+    return inner_->GetBlob(id);
+  }
+
+  uint64_t GetFreeSpace() override { return inner_->GetFreeSpace(); }
+
+ private:
+  BlobStore* const inner_;
+  const std::chrono::microseconds latency_;
+};
+
+// A backend of -stripe: the blobs of |inner| with |slice| in their ids.
+// Slices share the space |inner| has left.
+class SliceStore final : public BlobStore {
+ public:
+  SliceStore(BlobStore* inner, uint64_t slice)
+      : inner_(inner), tag_(slice << kSliceShift) {}
+
+  Blob* GetBlob(uint64_t id) override { return inner_->GetBlob(id | tag_); }
+
+  uint64_t GetFreeSpace() override { return inner_->GetFreeSpace(); }
+
+ private:
+  BlobStore* const inner_;
+  const uint64_t tag_;
+};
+
+struct Phase {
+  std::string name;
+  // Latency of each unit of work in the phase, in microseconds.
+  std::vector<double> samples;
+  g::Stats stats;
+};
+
+using Clock = std::chrono::steady_clock;
+
+std::string file_name(long i) {
+  return "bench/file-" + std::to_string(i) + ".dat";
+}
+
+std::string hot_name(long i) {
+  return (i < kHotFiles ? "bench/hot-" : "bench/scan-") + std::to_string(i);
+}
+
+double percentile(std::vector<double> v, double pct) {
+  if (v.empty()) {
+    return 0;
+  }
+  std::sort(v.begin(), v.end());
+  return v[std::min(v.size() - 1, static_cast<size_t>(pct * v.size()))];
+}
+
+template <typename Fn>
+Phase run_phase(const char* name, long count, Fn fn) {
+  Phase phase;
+  phase.name = name;
+  phase.samples.reserve(count);
+  g::fstats_reset();
+  for (long i = 0; i != count; ++i) {
+    auto t0 = Clock::now();
+    if (!fn(i)) {
+      fprintf(stderr, "%s: failed at %ld\n", name, i);
+      exit(1);
+    }
+    auto us = std::chrono::duration<double, std::micro>(Clock::now() - t0);
+    phase.samples.push_back(us.count());
+  }
+  g::fstats(&phase.stats);
+  return phase;
+}
+
+void print_phase(const Phase& phase) {
+  double total = 0;
+  for (auto s : phase.samples) {
+    total += s;
+  }
+  printf("\n%-8s %8zu ops  %10.1f ms  p50 %8.1f us  p99 %8.1f us\n",
+         phase.name.c_str(), phase.samples.size(), total / 1000,
+         percentile(phase.samples, 0.50), percentile(phase.samples, 0.99));
+  printf("  %-14s %9s %9s %11s %11s %9s %11s %9s\n", "op", "calls",
+         "ns/call", "instr/call", "allocs/call", "KiB/call", "copyKiB/call",
+         "brmiss");
+  for (size_t i = 0; i != g::kOps; ++i) {
+    auto& op = phase.stats.ops[i];
+    if (!op.calls) {
+      continue;
+    }
+    double sampled = op.sampled ? op.sampled : 1;
+    printf("  %-14s %9lu %9.0f %11.0f %11.2f %9.1f %11.1f %9.1f\n",
+           g::op_name(static_cast<g::Op>(i)), op.calls, op.nanos / sampled,
+           op.instructions / sampled,
+           static_cast<double>(op.allocs) / op.calls,
+           op.alloc_bytes / 1024.0 / op.calls,
+           op.copy_bytes / 1024.0 / op.calls, op.branch_misses / sampled);
+  }
+  printf("  %-14s %9s %9s %9s %9s %11s %11s %11s %11s\n", "blob traffic",
+         "gets", "get KiB", "puts", "put KiB", "store gets", "store gKiB",
+         "store puts", "store pKiB");
+  for (size_t i = 0; i != g::kOps; ++i) {
+    auto& op = phase.stats.ops[i];
+    if (!op.calls) {
+      continue;
+    }
+    double calls = op.calls;
+    printf("  %-14s %9.2f %9.1f %9.2f %9.1f %11.2f %11.1f %11.2f %11.1f\n",
+           g::op_name(static_cast<g::Op>(i)), op.gets / calls,
+           op.get_bytes / 1024.0 / calls, op.puts / calls,
+           op.put_bytes / 1024.0 / calls, op.store_gets / calls,
+           op.store_get_bytes / 1024.0 / calls, op.store_puts / calls,
+           op.store_put_bytes / 1024.0 / calls);
+  }
+  auto& st = phase.stats;
+  printf("  blob cache: %lu hits, %lu misses, %lu coalesced, %lu evictions "
+         "(%lu not admitted)\n", st.cache_hits, st.cache_misses,
+         st.cache_coalesced, st.cache_evictions, st.cache_rejected);
+  printf("  metadata cache: %lu hits, %lu misses; data cache: %lu hits, "
+         "%lu misses\n", st.cache_hits - st.data_cache_hits,
+         st.cache_misses - st.data_cache_misses, st.data_cache_hits,
+         st.data_cache_misses);
+}
+
+std::string json_escape(const std::string& s) {
+  std::string out;
+  for (char c : s) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char buf[8];
+      snprintf(buf, sizeof(buf), "\\u%04x", c);
+      out += buf;
+    } else {
+      out += c;
+    }
+  }
+  return out;
+}
+
+std::string cpu_model() {
+  std::ifstream in("/proc/cpuinfo");
+  std::string line;
+  while (std::getline(in, line)) {
+    if (line.compare(0, 10, "model name") == 0) {
+      auto colon = line.find(':');
+      if (colon != std::string::npos) {
+        return line.substr(line.find_first_not_of(' ', colon + 1));
+      }
+    }
+  }
+  return "unknown";
+}
+
+bool write_json(const std::string& path, const Options& opts,
+                const std::vector<Phase>& phases) {
+  auto f = fopen(path.c_str(), "w");
+  if (!f) {
+    return false;
+  }
+  utsname uts = {};
+  uname(&uts);
+  char when[32];
+  auto now = time(nullptr);
+  strftime(when, sizeof(when), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+#ifdef __OPTIMIZE__
+  constexpr bool optimized = true;
+#else
+  constexpr bool optimized = false;
+#endif
+#ifdef BLOB_ACCOUNTING
+  constexpr bool accounting = true;
+#else
+  constexpr bool accounting = false;
+#endif
+
+  fprintf(f, "{\n  \"meta\": {\n");
+  fprintf(f, "    \"time\": \"%s\",\n", when);
+  fprintf(f, "    \"host\": \"%s\",\n", json_escape(uts.nodename).c_str());
+  fprintf(f, "    \"kernel\": \"%s %s %s\",\n", uts.sysname, uts.release,
+          uts.machine);
+  fprintf(f, "    \"cpu\": \"%s\",\n", json_escape(cpu_model()).c_str());
+  fprintf(f, "    \"cpus\": %ld,\n", sysconf(_SC_NPROCESSORS_ONLN));
+  fprintf(f, "    \"compiler\": \"%s\",\n", json_escape(__VERSION__).c_str());
+  fprintf(f, "    \"optimized\": %s,\n", optimized ? "true" : "false");
+  fprintf(f, "    \"accounting\": %s,\n", accounting ? "true" : "false");
+  fprintf(f, "    \"files\": %ld, \"size\": %ld, \"chunk\": %ld\n",
+          opts.files, opts.size, opts.chunk);
+  fprintf(f, "  },\n  \"phases\": [\n");
+  for (size_t p = 0; p != phases.size(); ++p) {
+    auto& phase = phases[p];
+    auto& st = phase.stats;
+    fprintf(f, "    {\n      \"name\": \"%s\",\n", phase.name.c_str());
+    fprintf(f, "      \"cache\": {\"hits\": %lu, \"misses\": %lu, "
+               "\"coalesced\": %lu, \"evictions\": %lu, "
+               "\"rejected\": %lu, \"data_hits\": %lu, "
+               "\"data_misses\": %lu},\n",
+            st.cache_hits, st.cache_misses, st.cache_coalesced,
+            st.cache_evictions, st.cache_rejected, st.data_cache_hits,
+            st.data_cache_misses);
+    fprintf(f, "      \"ops\": {");
+    const char* sep = "";
+    for (size_t i = 0; i != g::kOps; ++i) {
+      auto& op = st.ops[i];
+      if (!op.calls) {
+        continue;
+      }
+      fprintf(f, "%s\n        \"%s\": {\"calls\": %lu, \"allocs\": %lu, "
+                 "\"alloc_bytes\": %lu, \"copy_bytes\": %lu, "
+                 "\"sampled\": %lu, \"nanos\": %lu, \"instructions\": %lu, "
+                 "\"cache_misses\": %lu, \"branch_misses\": %lu, "
+                 "\"gets\": %lu, \"get_bytes\": %lu, \"puts\": %lu, "
+                 "\"put_bytes\": %lu, \"store_gets\": %lu, "
+                 "\"store_get_bytes\": %lu, \"store_puts\": %lu, "
+                 "\"store_put_bytes\": %lu}",
+              sep, g::op_name(static_cast<g::Op>(i)), op.calls, op.allocs,
+              op.alloc_bytes, op.copy_bytes, op.sampled, op.nanos,
+              op.instructions, op.cache_misses, op.branch_misses, op.gets,
+              op.get_bytes, op.puts, op.put_bytes, op.store_gets,
+              op.store_get_bytes, op.store_puts, op.store_put_bytes);
+      sep = ",";
+    }
+    fprintf(f, "\n      },\n      \"samples_us\": [");
+    for (size_t i = 0; i != phase.samples.size(); ++i) {
+      fprintf(f, "%s%.3f", i ? (i % 16 ? ", " : ",\n        ") : "\n        ",
+              phase.samples[i]);
+    }
+    fprintf(f, "\n      ]\n    }%s\n", p + 1 == phases.size() ? "" : ",");
+  }
+  fprintf(f, "  ]\n}\n");
+  return fclose(f) == 0;
+}
+
+// -commit: |threads| threads Put kCommitPuts blobs each to |file|. Returns
+// false if a Put failed.
+bool commit_puts(FileStore* file, long threads) {
+  std::atomic<bool> failed{false};
+  std::vector<std::thread> putters;
+  for (long t = 0; t != threads; ++t) {
+    putters.emplace_back([file, t, &failed] {
+      Data data(kCommitBlob, static_cast<uint8_t>(t));
+      for (long i = 0; i != kCommitPuts; ++i) {
+        auto blob = file->GetBlob(kCommitIds | (t * kCommitPuts + i));
+        if (!blob || blob->Put(data) != 0) {
+          failed = true;
+        }
+        if (blob) {
+          blob->Release();
+        }
+      }
+    });
+  }
+  for (auto& putter : putters) {
+    putter.join();
+  }
+  return !failed;
+}
+
+bool parse_args(int argc, char** argv, Options* opts) {
+  for (int i = 1; i < argc; ++i) {
+    if (i + 1 == argc) {
+      return false;
+    }
+    long value = atol(argv[i + 1]);
+    if (!strcmp(argv[i], "-json")) {
+      opts->json = argv[i + 1];
+    } else if (!strcmp(argv[i], "-store")) {
+      opts->store = argv[i + 1];
+    } else if (!strcmp(argv[i], "-file")) {
+      opts->file = argv[i + 1];
+    } else if (!strcmp(argv[i], "-direct")) {
+      opts->direct = value != 0;
+    } else if (!strcmp(argv[i], "-sync")) {
+      opts->sync = value != 0;
+    } else if (!strcmp(argv[i], "-files")) {
+      opts->files = value;
+    } else if (!strcmp(argv[i], "-size")) {
+      opts->size = value;
+    } else if (!strcmp(argv[i], "-chunk")) {
+      opts->chunk = value;
+    } else if (!strcmp(argv[i], "-hot")) {
+      opts->hot = value;
+    } else if (!strcmp(argv[i], "-index")) {
+      opts->index = value != 0;
+    } else if (!strcmp(argv[i], "-partitions")) {
+      opts->partitions = value;
+    } else if (!strcmp(argv[i], "-latency")) {
+      opts->latency = value;
+    } else if (!strcmp(argv[i], "-stripe")) {
+      opts->stripe = value;
+    } else if (!strcmp(argv[i], "-commit")) {
+      opts->commit = value;
+    } else if (!strcmp(argv[i], "-perf")) {
+      opts->perf = static_cast<uint32_t>(value);
+    } else {
+      return false;
+    }
+    ++i;
+  }
+  // Reads and writes don't span blobs yet.
+  return opts->chunk > 0 && (256 * 1024) % opts->chunk == 0 &&
+         opts->partitions > 0 && opts->latency >= 0 && opts->stripe >= 0 &&
+         opts->stripe < (1 << (61 - kSliceShift)) - 1 && opts->commit >= 0 &&
+         (!opts->commit || (opts->sync && !opts->file.empty()));
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  Options opts;
+  if (!parse_args(argc, argv, &opts)) {
+    fprintf(stderr, "usage: bench [-files N] [-size BYTES] [-chunk BYTES] "
+                    "[-perf N] [-json PATH] [-store SOCKET]\n"
+                    "             [-file PATH [-direct 1] [-sync 1]] "
+                    "[-hot N]\n"
+                    "             [-index 1] [-partitions N] [-latency US] "
+                    "[-stripe N]\n"
+                    "             [-commit T]\n"
+                    "  chunk must divide 256 KiB.\n");
+    return 2;
+  }
+  // Keep the toy blob store from dumping every Put.
+  setenv("BLOB_QUIET", "1", 1);
+  BlobStore* store = GetBlobStore();
+  std::unique_ptr<RpcStore> remote;
+  if (!opts.store.empty()) {
+    remote = std::make_unique<RpcStore>(opts.store);
+    if (!remote->ok()) {
+      fprintf(stderr, "can't connect to %s\n", opts.store.c_str());
+      return 1;
+    }
+    store = remote.get();
+  }
+  std::unique_ptr<FileStore> file;
+  if (!opts.file.empty()) {
+    unlink(opts.file.c_str());
+    file = std::make_unique<FileStore>(
+        opts.file, kFileCapacity,
+        opts.direct ? FileIo::Direct : FileIo::Buffered,
+        opts.sync ? FileSync::Group : FileSync::None);
+    if (!file->ok()) {
+      fprintf(stderr, "can't open %s\n", opts.file.c_str());
+      return 1;
+    }
+    store = file.get();
+  }
+  std::vector<std::unique_ptr<PartitionStore>> partitions;
+  g::VolumeStores stores;
+  stores.meta = store;
+  stores.data = store;
+  if (opts.partitions > 1 || opts.latency) {
+    for (long p = 0; p != opts.partitions; ++p) {
+      partitions.push_back(std::make_unique<PartitionStore>(
+          store, std::chrono::microseconds(opts.latency)));
+      if (p == 0) {
+        stores.meta = partitions.back().get();
+      } else {
+        stores.partitions.push_back(partitions.back().get());
+      }
+    }
+  }
+  std::vector<std::unique_ptr<SliceStore>> slices;
+  std::unique_ptr<StripeStore> stripe;
+  if (opts.stripe) {
+    std::vector<BlobStore*> backends;
+    for (long s = 0; s <= opts.stripe; ++s) {
+      slices.push_back(std::make_unique<SliceStore>(store, s + 1));
+      backends.push_back(slices.back().get());
+    }
+    // The last one is added during the create phase.
+    backends.pop_back();
+    stripe = std::make_unique<StripeStore>(backends);
+    stores.data = stripe.get();
+  }
+  g::fset_volume_stores(stores);
+  g::finitialize();
+  g::fop_stats(true);
+  if (opts.perf && !g::fperf_counters(opts.perf)) {
+    fprintf(stderr, "perf counters unavailable, sampling wall time only\n");
+  }
+
+  std::vector<char> buffer(opts.chunk, 'x');
+  std::vector<Phase> phases;
+
+  Clock::time_point added;
+  StripeStats at_add = {};
+  phases.push_back(run_phase("create", opts.files, [&](long i) {
+    if (stripe && i == opts.files / 2) {
+      added = Clock::now();
+      stripe->AddBackend(slices.back().get());
+      at_add = stripe->stats();
+    }
+    auto file = g::fopen(file_name(i).c_str(), "w");
+    if (!file) {
+      return false;
+    }
+    for (long pos = 0; pos < opts.size; pos += opts.chunk) {
+      if (g::fwrite(file, buffer.data(), opts.chunk) != opts.chunk) {
+        return false;
+      }
+    }
+    return g::fclose(file) == 0;
+  }));
+  std::chrono::duration<double, std::milli> rebalance_ms(0);
+  if (stripe) {
+    stripe->WaitRebalanced();
+    rebalance_ms = Clock::now() - added;
+  }
+
+  phases.push_back(run_phase("read", opts.files, [&](long i) {
+    auto file = g::fopen(file_name(i).c_str(), "r");
+    if (!file) {
+      return false;
+    }
+    for (long pos = 0; pos < opts.size; pos += opts.chunk) {
+      g::fseek(file, pos, 0);
+      if (g::fread(file, buffer.data(), opts.chunk) != opts.chunk) {
+        return false;
+      }
+    }
+    return g::fclose(file) == 0;
+  }));
+
+  phases.push_back(run_phase("miss", opts.files, [&](long i) {
+    auto name = file_name(i) + ".missing";
+    return g::fopen(name.c_str(), "r") == nullptr;
+  }));
+
+  if (opts.index) {
+    g::ffinalize();
+    g::finitialize();
+    phases.push_back(run_phase("index", 1, [](long) {
+      return g::fname_index(false);
+    }));
+  }
+
+  uint64_t hot_gets = 0;
+  if (opts.hot) {
+    std::vector<char> blob(256 * 1024, 'x');
+    for (long i = 0; i != kHotFiles + kScanFiles; ++i) {
+      auto file = g::fopen(hot_name(i).c_str(), "w");
+      for (long b = 0; b != (i < kHotFiles ? 1 : kScanBlobs); ++b) {
+        g::fwrite(file, blob.data(), i < kHotFiles ? opts.chunk : blob.size());
+      }
+      g::fclose(file);
+    }
+    phases.push_back(run_phase("hot", opts.hot, [&](long i) {
+      auto file = g::fopen(hot_name(kHotFiles + i % kScanFiles).c_str(), "r");
+      if (!file) {
+        return false;
+      }
+      while (g::fread(file, buffer.data(), opts.chunk) > 0) {
+      }
+      g::fclose(file);
+      g::Stats before;
+      g::fstats(&before);
+      for (long k = 0; k != kHotOpens; ++k) {
+        file = g::fopen(hot_name((i * kHotOpens + k) % kHotFiles).c_str(),
+                        "r");
+        if (!file || g::fread(file, buffer.data(), opts.chunk) != opts.chunk) {
+          return false;
+        }
+        g::fclose(file);
+      }
+      g::Stats after;
+      g::fstats(&after);
+      for (auto op : {g::Op::Open, g::Op::Read}) {
+        auto ix = static_cast<size_t>(op);
+        hot_gets += after.ops[ix].store_gets - before.ops[ix].store_gets;
+      }
+      return true;
+    }));
+  }
+
+  FileStats before_commit = {};
+  FileStats after_commit = {};
+  std::chrono::duration<double, std::milli> commit_ms(0);
+  if (opts.commit) {
+    before_commit = file->stats();
+    auto t0 = Clock::now();
+    if (!commit_puts(file.get(), opts.commit)) {
+      fprintf(stderr, "commit: a Put failed\n");
+      return 1;
+    }
+    commit_ms = Clock::now() - t0;
+    after_commit = file->stats();
+  }
+
+  printf("files %ld, size %ld, chunk %ld\n", opts.files, opts.size,
+         opts.chunk);
+  for (auto& phase : phases) {
+    print_phase(phase);
+  }
+  if (opts.index) {
+    printf("\nindex: %lu names in %lu KiB\n", g::fname_index_names(),
+           g::fname_index_bytes() / 1024);
+  }
+  if (stripe) {
+    auto st = stripe->stats();
+    printf("\nstripe: %ld -> %lu backends, moved %lu of %lu data blobs "
+           "(%.1f%%) in %.1f ms, %lu left\n",
+           opts.stripe, st.backends, st.moved, at_add.blobs,
+           at_add.blobs ? 100.0 * st.moved / at_add.blobs : 0.0,
+           rebalance_ms.count(), st.pending);
+  }
+  if (opts.hot) {
+    printf("\nhot set: %.2f store gets per open\n",
+           static_cast<double>(hot_gets) / (opts.hot * kHotOpens));
+  }
+  if (remote) {
+    auto rpc = remote->stats();
+    if (remote->transport() == RpcTransport::SharedMemory) {
+      printf("store %s, shared memory: %lu calls, %lu wakeups\n",
+             opts.store.c_str(), rpc.calls, rpc.wakeups);
+    } else {
+      printf("store %s, socket: %lu calls in %lu sends, %lu receives\n",
+             opts.store.c_str(), rpc.calls, rpc.writes, rpc.reads);
+    }
+  }
+  if (file) {
+    auto fs = file->stats();
+    printf("file %s, %s: %lu reads (%lu bytes), %lu writes (%lu bytes)\n",
+           opts.file.c_str(),
+           file->io() == FileIo::Direct ? "O_DIRECT" : "buffered", fs.reads,
+           fs.read_bytes, fs.writes, fs.written_bytes);
+    if (opts.sync) {
+      printf("  %lu Puts made durable by %lu syncs\n", fs.committed,
+             fs.commits);
+    }
+    if (opts.commit) {
+      auto puts = after_commit.committed - before_commit.committed;
+      auto syncs = after_commit.commits - before_commit.commits;
+      printf("commit: %ld threads, %lu Puts of %zu bytes in %.1f ms, "
+             "%.0f Puts/s, %.1f Puts per sync\n",
+             opts.commit, puts, kCommitBlob, commit_ms.count(),
+             puts / (commit_ms.count() / 1000),
+             syncs ? static_cast<double>(puts) / syncs : 0.0);
+    }
+  }
+  if (!opts.json.empty() && !write_json(opts.json, opts, phases)) {
+    fprintf(stderr, "can't write %s\n", opts.json.c_str());
+    return 1;
+  }
+
+  g::ffinalize();
+  return 0;
+}
@@ -0,0 +1,356 @@
+// bench_compare.cc
+//
+// Compares two `bench -json` result files, a baseline and a candidate.
+//
+// For each phase the latency samples of the two runs are compared with a
+// two-sided Mann-Whitney U test, which makes no assumption about the shape
+// of the distributions (latencies are anything but normal). A phase is a
+// regression when its median got slower by more than |threshold| and the
+// difference is significant at |alpha|. The per-call allocation, copy and
+// logical blob traffic counters are deterministic, so any growth beyond
+// |threshold| is flagged without a test.
+//
+// usage: bench_compare BASE.json NEW.json [-threshold 0.05] [-alpha 0.01]
+//
+// Exits with 1 if anything regressed, so it can gate a script.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+// Just enough JSON for the files bench writes.
+struct Json {
+  enum Type { Null, Bool, Number, String, Array, Object };
+  Type type = Null;
+  double number = 0;
+  std::string str;
+  std::vector<Json> items;
+  std::vector<std::pair<std::string, Json>> members;
+
+  const Json& operator[](const char* key) const {
+    static const Json null;
+    for (auto& m : members) {
+      if (m.first == key) {
+        return m.second;
+      }
+    }
+    return null;
+  }
+};
+
+class Parser {
+ public:
+  explicit Parser(const std::string& text) : p_(text.c_str()) {}
+
+  bool Parse(Json* out) {
+    return Value(out) && (Skip(), *p_ == 0);
+  }
+
+ private:
+  void Skip() {
+    while (*p_ == ' ' || *p_ == '\n' || *p_ == '\r' || *p_ == '\t') {
+      ++p_;
+    }
+  }
+
+  bool Literal(const char* word) {
+    auto len = strlen(word);
+    if (strncmp(p_, word, len) != 0) {
+      return false;
+    }
+    p_ += len;
+    return true;
+  }
+
+  bool Str(std::string* out) {
+    if (*p_++ != '"') {
+      return false;
+    }
+    while (*p_ && *p_ != '"') {
+      if (*p_ == '\\') {
+        ++p_;
+        if (*p_ == 'u') {
+          out->push_back(static_cast<char>(strtol(
+              std::string(p_ + 1, 4).c_str(), nullptr, 16)));
+          p_ += 5;
+          continue;
+        }
+      }
+      out->push_back(*p_++);
+    }
+    return *p_++ == '"';
+  }
+
+  bool Value(Json* out) {
+    Skip();
+    switch (*p_) {
+      case '{': {
+        out->type = Json::Object;
+        ++p_;
+        Skip();
+        if (*p_ == '}') {
+          ++p_;
+          return true;
+        }
+        while (true) {
+          Skip();
+          std::pair<std::string, Json> member;
+          if (!Str(&member.first)) {
+            return false;
+          }
+          Skip();
+          if (*p_++ != ':' || !Value(&member.second)) {
+            return false;
+          }
+          out->members.push_back(std::move(member));
+          Skip();
+          if (*p_ == ',') {
+            ++p_;
+          } else {
+            return *p_++ == '}';
+          }
+        }
+      }
+      case '[': {
+        out->type = Json::Array;
+        ++p_;
+        Skip();
+        if (*p_ == ']') {
+          ++p_;
+          return true;
+        }
+        while (true) {
+          out->items.emplace_back();
+          if (!Value(&out->items.back())) {
+            return false;
+          }
+          Skip();
+          if (*p_ == ',') {
+            ++p_;
+          } else {
+            return *p_++ == ']';
+          }
+        }
+      }
+      case '"':
+        out->type = Json::String;
+        return Str(&out->str);
+      case 't':
+        out->type = Json::Bool;
+        out->number = 1;
+        return Literal("true");
+      case 'f':
+        out->type = Json::Bool;
+        return Literal("false");
+      case 'n':
+        return Literal("null");
+      default: {
+        char* end = nullptr;
+        out->type = Json::Number;
+        out->number = strtod(p_, &end);
+        if (end == p_) {
+          return false;
+        }
+        p_ = end;
+        return true;
+      }
+    }
+  }
+
+  const char* p_;
+};
+
+bool load(const char* path, Json* out) {
+  std::ifstream in(path);
+  if (!in) {
+    fprintf(stderr, "can't read %s\n", path);
+    return false;
+  }
+  std::stringstream text;
+  text << in.rdbuf();
+  if (!Parser(text.str()).Parse(out) || out->type != Json::Object) {
+    fprintf(stderr, "%s is not a bench result\n", path);
+    return false;
+  }
+  return true;
+}
+
+std::vector<double> samples(const Json& phase) {
+  std::vector<double> v;
+  for (auto& s : phase["samples_us"].items) {
+    v.push_back(s.number);
+  }
+  return v;
+}
+
+double median(std::vector<double> v) {
+  if (v.empty()) {
+    return 0;
+  }
+  std::sort(v.begin(), v.end());
+  auto n = v.size();
+  return (n % 2) ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+}
+
+// Two-sided p-value of the Mann-Whitney U test, normal approximation with
+// tie and continuity correction. Fine for the sample counts bench produces.
+double mann_whitney_p(const std::vector<double>& a,
+                      const std::vector<double>& b) {
+  const double n1 = a.size();
+  const double n2 = b.size();
+  if (n1 < 2 || n2 < 2) {
+    return 1;
+  }
+  std::vector<std::pair<double, int>> all;
+  for (auto x : a) {
+    all.emplace_back(x, 0);
+  }
+  for (auto x : b) {
+    all.emplace_back(x, 1);
+  }
+  std::sort(all.begin(), all.end());
+
+  const double n = all.size();
+  double rank_sum_a = 0;
+  double ties = 0;
+  for (size_t i = 0; i != all.size();) {
+    size_t j = i;
+    while (j != all.size() && all[j].first == all[i].first) {
+      ++j;
+    }
+    // Ranks i+1 .. j share their average.
+    double rank = (i + 1 + j) / 2.0;
+    for (size_t k = i; k != j; ++k) {
+      if (all[k].second == 0) {
+        rank_sum_a += rank;
+      }
+    }
+    double t = j - i;
+    ties += t * t * t - t;
+    i = j;
+  }
+
+  double u = rank_sum_a - n1 * (n1 + 1) / 2;
+  double mu = n1 * n2 / 2;
+  double sigma = std::sqrt(n1 * n2 / 12 * ((n + 1) - ties / (n * (n - 1))));
+  if (sigma == 0) {
+    return 1;
+  }
+  double z = (std::fabs(u - mu) - 0.5) / sigma;
+  return std::erfc(std::max(z, 0.0) / std::sqrt(2.0));
+}
+
+double per_call(const Json& op, const char* field) {
+  auto calls = op["calls"].number;
+  return calls ? op[field].number / calls : 0;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  double threshold = 0.05;
+  double alpha = 0.01;
+  std::vector<const char*> files;
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i], "-threshold") && i + 1 < argc) {
+      threshold = atof(argv[++i]);
+    } else if (!strcmp(argv[i], "-alpha") && i + 1 < argc) {
+      alpha = atof(argv[++i]);
+    } else {
+      files.push_back(argv[i]);
+    }
+  }
+  if (files.size() != 2) {
+    fprintf(stderr, "usage: bench_compare BASE.json NEW.json "
+                    "[-threshold 0.05] [-alpha 0.01]\n");
+    return 2;
+  }
+
+  Json base, cand;
+  if (!load(files[0], &base) || !load(files[1], &cand)) {
+    return 2;
+  }
+
+  auto& bm = base["meta"];
+  auto& cm = cand["meta"];
+  for (auto key : {"host", "cpu", "compiler"}) {
+    if (bm[key].str != cm[key].str) {
+      printf("warning: %s differs: '%s' vs '%s'\n", key, bm[key].str.c_str(),
+             cm[key].str.c_str());
+    }
+  }
+  for (auto key : {"optimized", "accounting", "files", "size", "chunk"}) {
+    if (bm[key].number != cm[key].number) {
+      printf("warning: %s differs, results are not comparable\n", key);
+    }
+  }
+
+  // Allocation counters are only collected by BLOB_ACCOUNTING builds.
+  bool counters = bm["accounting"].number && cm["accounting"].number;
+
+  int regressions = 0;
+  printf("%-10s %12s %12s %9s %10s  %s\n", "phase", "base p50 us",
+         "new p50 us", "delta", "p", "verdict");
+  for (auto& bp : base["phases"].items) {
+    const Json* cp = nullptr;
+    for (auto& p : cand["phases"].items) {
+      if (p["name"].str == bp["name"].str) {
+        cp = &p;
+      }
+    }
+    if (!cp) {
+      printf("%-10s missing from %s\n", bp["name"].str.c_str(), files[1]);
+      continue;
+    }
+
+    auto a = samples(bp);
+    auto b = samples(*cp);
+    double ma = median(a);
+    double mb = median(b);
+    double delta = ma ? (mb - ma) / ma : 0;
+    double p = mann_whitney_p(a, b);
+    const char* verdict = "same";
+    if (p < alpha && delta > threshold) {
+      verdict = "REGRESSION";
+      ++regressions;
+    } else if (p < alpha && delta < -threshold) {
+      verdict = "improved";
+    }
+    printf("%-10s %12.1f %12.1f %+8.1f%% %10.2g  %s\n",
+           bp["name"].str.c_str(), ma, mb, delta * 100, p, verdict);
+
+    std::vector<const char*> fields = {"gets", "get_bytes", "puts",
+                                       "put_bytes"};
+    if (counters) {
+      fields.insert(fields.end(), {"allocs", "alloc_bytes", "copy_bytes"});
+    }
+    for (auto& op : bp["ops"].members) {
+      auto& cop = (*cp)["ops"][op.first.c_str()];
+      for (auto field : fields) {
+        // Older files don't have the traffic counters.
+        if (op.second[field].type == Json::Null) {
+          continue;
+        }
+        double before = per_call(op.second, field);
+        double after = per_call(cop, field);
+        if (after > before * (1 + threshold) && after - before > 0.01) {
+          printf("  %-14s %-12s %10.1f -> %10.1f per call  REGRESSION\n",
+                 op.first.c_str(), field, before, after);
+          ++regressions;
+        }
+      }
+    }
+  }
+  return regressions ? 1 : 0;
+}
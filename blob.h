@@ -5,12 +5,18 @@
 // so that you can observe and debug your filesys
 // implementation.
 
+#pragma once
+
 #include <vector>
 #include <stdint.h>
 #include <cstddef>
 
-
+#ifdef BLOB_ACCOUNTING
+#include "alloc_stats.h"
+using Data = std::vector<uint8_t, CountingAllocator<uint8_t>>;
+#else
 using Data = std::vector<uint8_t>;
+#endif
  
 constexpr size_t MaxBlobSize = 256 * 1024;
 constexpr int ErrOutofSpace = -1;
@@ -0,0 +1,248 @@
+// blob_cache.cc
+//
+// See blob_cache.h. Store calls are made with the cache lock released; an
+// entry that is being fetched stays in the map marked |loading| so that
+// concurrent misses find it and wait on |loaded_|.
+
+#include "blob_cache.h"
+
+#include <algorithm>
+
+#include "alloc_stats.h"
+#include "io_counters.h"
+
+class BlobCache::Entry final : public Blob {
+ public:
+  Entry(BlobCache* cache, uint64_t id) : cache_(cache), id_(id) {}
+
+  const Data& Get() const override {
+    return cache_->local_copy_ ? copy_ : blob_->Get();
+  }
+
+  int Put(const Data& data) override {
+    io_counters::logical.count_put(data.size());
+    auto rc = blob_->Put(data);
+    if (rc == 0) {
+      if (cache_->local_copy_) {
+        copy_ = CopyData(data);
+      }
+      if (cache_->on_put_) {
+        cache_->on_put_(id_);
+      }
+    }
+    return rc;
+  }
+
+  int Release() override {
+    cache_->Unref(this);
+    return 0;
+  }
+
+ private:
+  friend class BlobCache;
+
+  BlobCache* const cache_;
+  const uint64_t id_;
+  Blob* blob_ = nullptr;
+  Data copy_;
+  bool loading_ = true;
+  // In the main LRU rather than the window.
+  bool main_ = false;
+  // No longer in |entries_|; goes away with the last reference.
+  bool detached_ = false;
+  uint32_t refs_ = 0;
+  std::list<Entry*>::iterator lru_;
+};
+
+BlobCache::BlobCache(BlobStore* inner, size_t capacity, bool local_copy,
+                     PutHook on_put)
+    : inner_(inner), capacity_(capacity),
+      window_capacity_(std::max<size_t>(1, capacity / 32)),
+      local_copy_(local_copy), on_put_(std::move(on_put)),
+      sketch_(capacity) {}
+
+BlobCache::~BlobCache() {
+  for (auto& e : entries_) {
+    if (e.second->blob_) {
+      e.second->blob_->Release();
+    }
+    delete e.second;
+  }
+}
+
+Blob* BlobCache::GetBlob(uint64_t id) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  auto it = entries_.find(id);
+  if (it != entries_.end()) {
+    Entry* entry = it->second;
+    // Repeated hits in the window are one use, such as a blob read in
+    // small chunks, and aren't counted.
+    if (entry->main_) {
+      sketch_.Increment(id);
+    }
+    if (entry->refs_++ == 0 && !entry->loading_) {
+      ListOf(entry).erase(entry->lru_);
+    }
+    if (entry->loading_) {
+      ++stats_.coalesced;
+      loaded_.wait(lock, [entry] { return !entry->loading_; });
+    } else {
+      ++stats_.hits;
+    }
+    if (!entry->blob_) {
+      // The fetch we waited on failed.
+      std::vector<Blob*> victims;
+      UnrefLocked(entry, &victims);
+      return nullptr;
+    }
+    io_counters::logical.count_get(entry->Get().size());
+    return entry;
+  }
+
+  ++stats_.misses;
+  sketch_.Increment(id);
+  auto entry = new Entry(this, id);
+  entry->refs_ = 1;
+  entries_[id] = entry;
+  lock.unlock();
+
+  auto blob = inner_->GetBlob(id);
+  if (blob && local_copy_) {
+    entry->copy_ = CopyData(blob->Get());
+  }
+
+  std::vector<Blob*> victims;
+  lock.lock();
+  entry->blob_ = blob;
+  entry->loading_ = false;
+  loaded_.notify_all();
+  if (!blob) {
+    UnrefLocked(entry, &victims);
+    return nullptr;
+  }
+  io_counters::logical.count_get(entry->Get().size());
+  return entry;
+}
+
+uint64_t BlobCache::GetFreeSpace() {
+  return inner_->GetFreeSpace();
+}
+
+BlobCacheStats BlobCache::stats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_;
+}
+
+void BlobCache::reset_stats() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  stats_ = {};
+}
+
+bool BlobCache::Contains(uint64_t id) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return entries_.count(id) != 0;
+}
+
+void BlobCache::Invalidate(uint64_t id) {
+  Blob* victim = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(id);
+    if (it == entries_.end()) {
+      return;
+    }
+    auto entry = it->second;
+    entries_.erase(it);
+    if (entry->main_) {
+      --main_size_;
+    }
+    if (entry->refs_) {
+      entry->detached_ = true;
+      return;
+    }
+    ListOf(entry).erase(entry->lru_);
+    victim = entry->blob_;
+    delete entry;
+  }
+  victim->Release();
+}
+
+void BlobCache::Unref(Entry* entry) {
+  std::vector<Blob*> victims;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    UnrefLocked(entry, &victims);
+  }
+  for (auto blob : victims) {
+    blob->Release();
+  }
+}
+
+void BlobCache::UnrefLocked(Entry* entry, std::vector<Blob*>* victims) {
+  if (--entry->refs_ != 0) {
+    return;
+  }
+  if (!entry->blob_ || entry->detached_) {
+    if (!entry->detached_) {
+      entries_.erase(entry->id_);
+    }
+    if (entry->blob_) {
+      victims->push_back(entry->blob_);
+    }
+    delete entry;
+    return;
+  }
+  auto& list = ListOf(entry);
+  entry->lru_ = list.insert(list.end(), entry);
+  Trim(victims);
+}
+
+std::list<BlobCache::Entry*>& BlobCache::ListOf(Entry* entry) {
+  return entry->main_ ? lru_ : window_;
+}
+
+void BlobCache::Admit(Entry* entry) {
+  entry->main_ = true;
+  ++main_size_;
+  entry->lru_ = lru_.insert(lru_.end(), entry);
+}
+
+void BlobCache::Evict(Entry* entry, std::vector<Blob*>* victims) {
+  entries_.erase(entry->id_);
+  if (entry->main_) {
+    --main_size_;
+  }
+  victims->push_back(entry->blob_);
+  delete entry;
+  ++stats_.evictions;
+}
+
+void BlobCache::Trim(std::vector<Blob*>* victims) {
+  // Blobs leaving the window join the main LRU while it has room, and then
+  // only in place of a victim they beat.
+  while (window_.size() > window_capacity_) {
+    auto candidate = window_.front();
+    window_.pop_front();
+    if (main_size_ + window_capacity_ < capacity_) {
+      Admit(candidate);
+      continue;
+    }
+    if (!lru_.empty() && sketch_.Estimate(candidate->id_) >
+                             sketch_.Estimate(lru_.front()->id_)) {
+      auto victim = lru_.front();
+      lru_.pop_front();
+      Evict(victim, victims);
+      Admit(candidate);
+    } else {
+      Evict(candidate, victims);
+      ++stats_.rejected;
+    }
+  }
+  // Blobs being held can still take the cache past |capacity_|.
+  while (entries_.size() > capacity_ && (!window_.empty() || !lru_.empty())) {
+    auto& list = window_.empty() ? lru_ : window_;
+    auto entry = list.front();
+    list.pop_front();
+    Evict(entry, victims);
+  }
+}
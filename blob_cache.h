@@ -0,0 +1,100 @@
+// blob_cache.h
+//
+// Blob cache with single-flight misses.
+//
+// The cache hands out one shared Blob per id. The first GetBlob() that
+// misses fetches from the store below; any GetBlob() for the same id that
+// arrives while that fetch is in flight waits for it instead of issuing its
+// own, and then shares the same buffer. After a flush a hot directory head is
+// therefore fetched once, not once per thread that wants it.
+//
+// Puts write through. Unreferenced blobs are kept in LRU order and the least
+// recently released ones are dropped once the cache holds more than
+// |capacity| blobs.
+//
+// Admission (W-TinyLFU). A blob that was just fetched first goes to a small
+// LRU window, where a fread() in small chunks finds it again. A blob
+// leaving the window joins the main LRU only if it has been asked for more
+// often than the main LRU's next victim, according to a FrequencySketch
+// (freq_sketch.h) of recent fetches and main LRU hits. Otherwise it is
+// dropped itself. A large one-shot read then cycles through the window
+// without flushing directory and control blocks out of the main LRU.
+//
+// With |local_copy| the cache keeps its own copy of each blob's bytes, made
+// by the thread that missed. Under first-touch placement that puts the
+// buffer on the requesting thread's NUMA node rather than wherever the store
+// allocated it.
+
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "blob.h"
+#include "freq_sketch.h"
+
+struct BlobCacheStats {
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t coalesced;   // Misses that waited on another thread's fetch.
+  uint64_t evictions;
+  uint64_t rejected;    // Evictions of blobs that lost admission.
+};
+
+class BlobCache final : public BlobStore {
+ public:
+  // Called after a successful Put of blob |id|.
+  using PutHook = std::function<void(uint64_t id)>;
+
+  BlobCache(BlobStore* inner, size_t capacity, bool local_copy = false,
+            PutHook on_put = nullptr);
+  ~BlobCache();
+
+  BlobCache(const BlobCache&) = delete;
+  BlobCache& operator=(const BlobCache&) = delete;
+
+  Blob* GetBlob(uint64_t id) override;
+  uint64_t GetFreeSpace() override;
+
+  // Drops blob |id|, which was written through another cache. Holders keep
+  // their reference but the next GetBlob() fetches it again.
+  void Invalidate(uint64_t id);
+  // Whether blob |id| is cached or being fetched.
+  bool Contains(uint64_t id) const;
+
+  BlobCacheStats stats() const;
+  void reset_stats();
+
+ private:
+  class Entry;
+
+  void Unref(Entry* entry);
+  void UnrefLocked(Entry* entry, std::vector<Blob*>* victims);
+  // The LRU list |entry| is in while nobody holds it.
+  std::list<Entry*>& ListOf(Entry* entry);
+  void Admit(Entry* entry);
+  void Evict(Entry* entry, std::vector<Blob*>* victims);
+  void Trim(std::vector<Blob*>* victims);
+
+  BlobStore* const inner_;
+  const size_t capacity_;
+  const size_t window_capacity_;
+  const bool local_copy_;
+  const PutHook on_put_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable loaded_;
+  std::unordered_map<uint64_t, Entry*> entries_;
+  // Entries nobody holds, least recently released first: those not
+  // admitted yet, and the main LRU.
+  std::list<Entry*> window_;
+  std::list<Entry*> lru_;
+  // Admitted entries, held or not.
+  size_t main_size_ = 0;
+  FrequencySketch sketch_;
+  BlobCacheStats stats_ = {};
+};
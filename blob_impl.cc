@@ -1,8 +1,10 @@
 #include "blob.h"
+#include <mutex>
 #include <unordered_map>
 
 #include <ctype.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 namespace {
 
@@ -55,6 +57,8 @@ class BlobStoreImpl : public BlobStore {
   void Free(const Data& data, uint64_t id);
   
  private:
+  // The store is called from the I/O scheduler's worker threads.
+  std::mutex mutex_;
   BlobMap bmap_;
   uint64_t free_space_ = 1u << 24;
 };
@@ -70,6 +74,7 @@ BlobStoreImpl::~BlobStoreImpl() {
 }
 
 Blob* BlobStoreImpl::GetBlob(uint64_t id) {
+  std::lock_guard<std::mutex> lock(mutex_);
   auto item = bmap_.find(id);
   if (item != bmap_.end()) {
     return item->second;
@@ -86,7 +91,13 @@ uint64_t BlobStoreImpl::GetFreeSpace() {
 
 int BlobStoreImpl::Store(const Data& data, uint64_t id) {
   // $fixme: store here do it at Release() time?
-  // for now just dump to stdio to help visualize.
+  // for now just dump to stdio to help visualize. BLOB_QUIET=1 turns it
+  // off, e.g. for benchmarks.
+  static const bool quiet = getenv("BLOB_QUIET") != nullptr;
+  if (quiet) {
+    return 0;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
   printf("w>> 0x%x  sz: %zu\n", id, data.size());
   hexdump(&data[0], data.size());
 
@@ -94,6 +105,7 @@ int BlobStoreImpl::Store(const Data& data, uint64_t id) {
 }
 
 void BlobStoreImpl::Free(const Data& data, uint64_t id) {
+  std::lock_guard<std::mutex> lock(mutex_);
   printf("r>> 0x%x\n", id);
   free_space_ -= data.size();
   bmap_.erase(id);
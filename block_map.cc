@@ -0,0 +1,101 @@
+// block_map.cc
+//
+// See block_map.h.
+
+#include "block_map.h"
+
+#include <algorithm>
+
+uint64_t BlockMap::Unpack(const Group& group, uint64_t ix) {
+  if (group.bits == 0) {
+    return 0;
+  }
+  auto bit = ix * group.bits;
+  auto word = bit / 64;
+  auto shift = bit % 64;
+  uint64_t v = group.words[word] >> shift;
+  if (shift + group.bits > 64) {
+    v |= group.words[word + 1] << (64 - shift);
+  }
+  return group.bits == 64 ? v : v & ((uint64_t(1) << group.bits) - 1);
+}
+
+void BlockMap::Pack(const uint64_t* ids, Group* group) {
+  // The base is the smallest id - index; the arithmetic wraps, so ids that
+  // fall as the index grows work too, at a bigger width.
+  bool any = false;
+  uint64_t base = 0;
+  for (uint64_t ix = 0; ix != kGroup; ++ix) {
+    if (ids[ix] && (!any || int64_t(ids[ix] - ix - base) < 0)) {
+      base = ids[ix] - ix;
+      any = true;
+    }
+  }
+  uint64_t max = 0;
+  for (uint64_t ix = 0; ix != kGroup; ++ix) {
+    if (ids[ix]) {
+      max = std::max(max, ids[ix] - ix - base + 1);
+    }
+  }
+  uint32_t bits = 0;
+  while (bits != 64 && (max >> bits)) {
+    ++bits;
+  }
+
+  group->base = base;
+  group->bits = bits;
+  group->words.assign((kGroup * bits + 63) / 64, 0);
+  group->words.shrink_to_fit();
+  for (uint64_t ix = 0; bits && ix != kGroup; ++ix) {
+    uint64_t v = ids[ix] ? ids[ix] - ix - base + 1 : 0;
+    auto bit = ix * bits;
+    auto word = bit / 64;
+    auto shift = bit % 64;
+    group->words[word] |= v << shift;
+    if (shift + bits > 64) {
+      group->words[word + 1] |= v >> (64 - shift);
+    }
+  }
+}
+
+uint64_t BlockMap::Get(uint64_t ix) const {
+  if (ix >= size_) {
+    return 0;
+  }
+  auto& group = groups_[ix / kGroup];
+  auto v = Unpack(group, ix % kGroup);
+  return v ? group.base + ix % kGroup + v - 1 : 0;
+}
+
+void BlockMap::Set(uint64_t first, const uint64_t* ids, uint64_t count) {
+  // Trailing holes don't grow the map.
+  while (count && ids[count - 1] == 0 && first + count > size_) {
+    --count;
+  }
+  if (count && first + count > size_) {
+    size_ = first + count;
+    groups_.resize((size_ + kGroup - 1) / kGroup);
+  }
+  uint64_t end = first + count;
+  for (uint64_t ix = first; ix < end;) {
+    auto& group = groups_[ix / kGroup];
+    uint64_t values[kGroup];
+    for (uint64_t i = 0; i != kGroup; ++i) {
+      auto v = Unpack(group, i);
+      values[i] = v ? group.base + i + v - 1 : 0;
+    }
+    auto group_end = std::min(end, (ix / kGroup + 1) * kGroup);
+    for (; ix != group_end; ++ix) {
+      values[ix % kGroup] = ids[ix - first];
+    }
+    Pack(values, &group);
+  }
+}
+
+size_t BlockMap::bytes() const {
+  size_t total = groups_.capacity() * sizeof(Group);
+  for (auto& group : groups_) {
+    total += group.words.capacity() * sizeof(uint64_t);
+  }
+  return total;
+}
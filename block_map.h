@@ -0,0 +1,52 @@
+// block_map.h
+//
+// Compact in-memory copy of an open file's data blob ids.
+//
+// A control block spends 8 bytes per 256 KiB of file, and keeping the
+// control blocks of many large open files cached costs up to 256 KiB each.
+// Within a file, ids are mostly handed out in the order the data was
+// written, so consecutive blobs tend to have nearly consecutive ids.
+// BlockMap stores the ids in groups of 128: each group keeps a base, and
+// each id is bit-packed as its distance from base + its index in the
+// group, at the width the largest distance needs (frame of reference). A
+// file written in one go costs a few bits per blob. Lookups unpack one
+// value, so access is O(1).
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+class BlockMap {
+ public:
+  // Id of the |ix|th data blob of the file, 0 for a hole or past the end.
+  uint64_t Get(uint64_t ix) const;
+  // Sets the |ix|th id, which may be 0 for a hole.
+  void Set(uint64_t ix, uint64_t id) { Set(ix, &id, 1); }
+  // Sets |count| ids from the |first|th on, repacking each group once.
+  void Set(uint64_t first, const uint64_t* ids, uint64_t count);
+
+  // One past the last id set.
+  uint64_t size() const { return size_; }
+  // Heap bytes used.
+  size_t bytes() const;
+
+ private:
+  static constexpr uint64_t kGroup = 128;
+
+  struct Group {
+    uint64_t base = 0;
+    uint32_t bits = 0;
+    // kGroup values of |bits| bits: 0 for a hole, otherwise
+    // id - base - index + 1.
+    std::vector<uint64_t> words;
+  };
+
+  static uint64_t Unpack(const Group& group, uint64_t ix);
+  static void Pack(const uint64_t* ids, Group* group);
+
+  std::vector<Group> groups_;
+  uint64_t size_ = 0;
+};
@@ -0,0 +1,324 @@
+// cost_model.cc
+//
+// See cost_model.h. Each predictor walks the same steps as the code in
+// answer_1.cc and adds up what every step Gets and Puts.
+
+#include "cost_model.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace g {
+namespace {
+
+// A block that never held an entry is just its header.
+double dir_bytes(const VolumeProfile& v, double entries) {
+  if (entries == 0) {
+    return sizeof(DirBlock);
+  }
+  double restarts = std::ceil(entries / DIR_RESTART);
+  return sizeof(DirBlock) + sizeof(PackedDir) + restarts * v.restart_bytes +
+         (entries - restarts) * v.entry_bytes;
+}
+
+double entries_per_block(const VolumeProfile& v) {
+  double group = v.restart_bytes + (DIR_RESTART - 1) * v.entry_bytes;
+  return std::floor((MaxBlobSize - sizeof(DirBlock) - sizeof(PackedDir)) *
+                    DIR_RESTART / group);
+}
+
+double ctrl_bytes(double blobs) {
+  return sizeof(ControlBlock) + blobs * sizeof(ControlBlock::Record);
+}
+
+// Chain index of a chain of |blocks| blocks.
+double index_bytes(double blocks) {
+  return sizeof(ChainIndex) + (blocks - 1) * sizeof(ChainIndex::Record);
+}
+
+// Blocks in a bucket chain holding |n| entries. An empty bucket still has
+// its head.
+double chain_blocks(const VolumeProfile& v, double n) {
+  return n ? std::ceil(n / entries_per_block(v)) : 1;
+}
+
+// Entries in block |k| of a chain holding |n| entries.
+double block_entries(const VolumeProfile& v, double n, double k) {
+  return std::min(entries_per_block(v), n - k * entries_per_block(v));
+}
+
+// Calls |fn(n, p)| for the bucket loads that carry any weight when the
+// mean load is |lambda|: Poisson for an ideal hash, negative binomial with
+// variance |dispersion| * |lambda| otherwise.
+template <typename Fn>
+void for_each_load(double lambda, double dispersion, Fn fn) {
+  if (lambda == 0) {
+    fn(0.0, 1.0);
+    return;
+  }
+  double spread = 12 * std::sqrt(std::max(1.0, dispersion) * lambda) + 30;
+  double lo = std::max(0.0, std::floor(lambda - spread));
+  double hi = std::ceil(lambda + spread);
+  // Shape of the negative binomial with that mean and variance.
+  double r = lambda / (dispersion - 1);
+  for (double n = lo; n <= hi; ++n) {
+    double log_p;
+    if (dispersion > 1) {
+      log_p = std::lgamma(n + r) - std::lgamma(r) - std::lgamma(n + 1) +
+              r * std::log(r / (r + lambda)) +
+              n * std::log(lambda / (r + lambda));
+    } else {
+      log_p = n * std::log(lambda) - lambda - std::lgamma(n + 1);
+    }
+    fn(n, std::exp(log_p));
+  }
+}
+
+// Fills in the store level from the logical one.
+void to_store(double hit, double prefetches, double prefetch_bytes,
+              Cost* c) {
+  // Cold Gets have no bytes. A prefetch is wasted when the blob it fetches
+  // was cached anyway, and stands in for the miss otherwise.
+  double first = c->gets - c->cold_gets - c->warm_gets;
+  double first_bytes = c->get_bytes - c->warm_get_bytes;
+  c->store_gets = c->cold_gets + first * (1 - hit) + prefetches * hit;
+  c->store_get_bytes = first_bytes * (1 - hit) + prefetch_bytes * hit;
+  c->store_puts = c->puts;
+  c->store_put_bytes = c->put_bytes;
+}
+
+void open_hit(const VolumeProfile& v, Cost* c) {
+  // The bucket of a random existing name is size-biased: sum over every
+  // entry of every bucket, then divide by the mean load.
+  double lambda = static_cast<double>(v.files) / v.heads;
+  for_each_load(lambda, v.dispersion, [&](double n, double p) {
+    double bytes = 0;
+    for (double k = 0; k != chain_blocks(v, n); ++k) {
+      double m = block_entries(v, n, k);
+      bytes += dir_bytes(v, m);
+      c->gets += p * m * (k + 1);
+      c->get_bytes += p * m * bytes;
+      if (k) {
+        // Past the head: the chain index too.
+        c->gets += p * m;
+        c->get_bytes += p * m * index_bytes(chain_blocks(v, n));
+      }
+    }
+  });
+  if (lambda) {
+    c->gets /= lambda;
+    c->get_bytes /= lambda;
+  }
+  double blobs = std::ceil(static_cast<double>(v.file_size) / MaxBlobSize);
+  c->gets += 1;
+  c->get_bytes += ctrl_bytes(blobs);
+  to_store(v.meta_hit, 0, 0, c);
+}
+
+void open_miss(const VolumeProfile& v, Cost* c) {
+  double lambda = static_cast<double>(v.files) / v.heads;
+  // Empty heads were never written, and stay that way: a miss reads them
+  // as blank blocks. Only the first Get of each can't hit. Share of the
+  // calls that land on a head no earlier call touched:
+  double calls = std::max<uint64_t>(v.calls, 1);
+  double untouched =
+      v.heads * (1 - std::pow(1 - 1.0 / v.heads, calls)) / calls;
+  for_each_load(lambda, v.dispersion, [&](double n, double p) {
+    c->gets += p * chain_blocks(v, n);
+    if (n == 0) {
+      c->cold_gets += p * untouched;
+      return;
+    }
+    for (double k = 0; k != chain_blocks(v, n); ++k) {
+      c->get_bytes += p * dir_bytes(v, block_entries(v, n, k));
+    }
+    if (chain_blocks(v, n) > 1) {
+      c->gets += p;
+      c->get_bytes += p * index_bytes(chain_blocks(v, n));
+    }
+  });
+  to_store(v.meta_hit, 0, 0, c);
+}
+
+void open_create(const VolumeProfile& v, Cost* c) {
+  // The volume grows by one name per call; average over a spread of the
+  // calls rather than all of them.
+  double calls = std::max<uint64_t>(v.calls, 1);
+  double steps = std::min(calls, 64.0);
+  for (double s = 0; s != steps; ++s) {
+    double i = (s + 0.5) * calls / steps;
+    double lambda = (v.files + i) / v.heads;
+    for_each_load(lambda, v.dispersion, [&](double n, double p) {
+      p /= steps;
+      // Scan the whole chain.
+      double blocks = chain_blocks(v, n);
+      c->gets += p * blocks;
+      if (n == 0) {
+        c->cold_gets += p;
+      } else {
+        for (double k = 0; k != blocks; ++k) {
+          c->get_bytes += p * dir_bytes(v, block_entries(v, n, k));
+        }
+        if (blocks > 1) {
+          c->gets += p;
+          c->get_bytes += p * index_bytes(blocks);
+        }
+      }
+      // New control block, written once its directory is set.
+      c->gets += p;
+      c->cold_gets += p;
+      c->puts += p;
+      c->put_bytes += p * ctrl_bytes(0);
+      // Append to the last block, or chain a new one when it is full.
+      double last = n ? block_entries(v, n, blocks - 1) : 0;
+      if (last < entries_per_block(v)) {
+        c->puts += p;
+        c->put_bytes += p * dir_bytes(v, last + 1);
+      } else {
+        // A new block, and its id added to the chain index.
+        c->gets += 2 * p;
+        c->cold_gets += p;
+        c->puts += 4 * p;
+        c->put_bytes += p * (dir_bytes(v, 0) + dir_bytes(v, last) +
+                             dir_bytes(v, 1) + index_bytes(blocks + 1));
+        if (blocks == 1) {
+          c->cold_gets += p;
+        } else {
+          c->get_bytes += p * index_bytes(blocks);
+        }
+      }
+    });
+  }
+  to_store(v.meta_hit, 0, 0, c);
+}
+
+void write_seq(const VolumeProfile& v, Cost* c) {
+  // Assumes |chunk| divides MaxBlobSize, as fwrite() can't span blobs.
+  double calls = 0;
+  for (uint64_t pos = 0; pos < v.file_size; pos += v.chunk) {
+    double len = std::min(v.chunk, v.file_size - pos);
+    double offset = pos % MaxBlobSize;
+    double blob = pos / MaxBlobSize;
+    c->gets += 1;
+    if (offset == 0) {
+      // New data blob: its id goes into the control block first, which is
+      // read again for that. The open or the last new blob just used it.
+      c->cold_gets += 1;
+      c->gets += 1;
+      c->warm_gets += 1;
+      c->warm_get_bytes += ctrl_bytes(blob);
+      c->get_bytes += ctrl_bytes(blob);
+      c->puts += 1;
+      c->put_bytes += ctrl_bytes(blob + 1);
+    } else {
+      c->warm_gets += 1;
+      c->warm_get_bytes += offset;
+      c->get_bytes += offset;
+    }
+    c->puts += 1;
+    c->put_bytes += offset + len;
+    ++calls;
+  }
+  if (calls) {
+    c->gets /= calls;
+    c->get_bytes /= calls;
+    c->cold_gets /= calls;
+    c->warm_gets /= calls;
+    c->warm_get_bytes /= calls;
+    c->puts /= calls;
+    c->put_bytes /= calls;
+  }
+  to_store(v.data_hit, 0, 0, c);
+}
+
+void read_seq(const VolumeProfile& v, Cost* c) {
+  auto blob_size = [&](uint64_t blob) {
+    return std::min<double>(MaxBlobSize, v.file_size - blob * MaxBlobSize);
+  };
+  uint64_t blobs = (v.file_size + MaxBlobSize - 1) / MaxBlobSize;
+  double calls = 0;
+  double prefetches = 0;
+  double prefetch_bytes = 0;
+  uint64_t prefetched = 0;
+  // The first call reads the control block, which the open just used, into
+  // the block map.
+  if (v.file_size) {
+    c->gets += 1;
+    c->warm_gets += 1;
+    c->get_bytes += ctrl_bytes(blobs);
+    c->warm_get_bytes += ctrl_bytes(blobs);
+  }
+  for (uint64_t pos = 0; pos < v.file_size; pos += v.chunk) {
+    uint64_t offset = pos % MaxBlobSize;
+    uint64_t blob = pos / MaxBlobSize;
+    double size = blob_size(blob);
+    double len = std::min<double>(v.chunk, size - offset);
+    c->gets += 1;
+    c->get_bytes += size;
+    if (offset != 0) {
+      c->warm_gets += 1;
+      c->warm_get_bytes += size;
+    }
+    // Further calls for the same blob find it queued or ready.
+    if (offset + len > MaxBlobSize / 2 && blob + 1 < blobs &&
+        prefetched <= blob) {
+      prefetched = blob + 1;
+      prefetches += 1;
+      prefetch_bytes += blob_size(blob + 1);
+    }
+    ++calls;
+  }
+  if (calls) {
+    c->gets /= calls;
+    c->get_bytes /= calls;
+    c->warm_gets /= calls;
+    c->warm_get_bytes /= calls;
+    prefetches /= calls;
+    prefetch_bytes /= calls;
+  }
+  to_store(v.data_hit, prefetches, prefetch_bytes, c);
+}
+
+}  // namespace
+
+const char* cost_op_name(CostOp op) {
+  switch (op) {
+    case CostOp::OpenHit: return "fopen hit";
+    case CostOp::OpenMiss: return "fopen miss";
+    case CostOp::OpenCreate: return "fopen create";
+    case CostOp::Write: return "fwrite";
+    case CostOp::Read: return "fread";
+    case CostOp::Remove: return "fremove";
+  }
+  return "?";
+}
+
+bool predict_cost(CostOp op, const VolumeProfile& volume, Cost* cost) {
+  *cost = Cost {};
+  if (volume.heads == 0) {
+    return false;
+  }
+  switch (op) {
+    case CostOp::OpenHit:
+      open_hit(volume, cost);
+      return true;
+    case CostOp::OpenMiss:
+      open_miss(volume, cost);
+      return true;
+    case CostOp::OpenCreate:
+      open_create(volume, cost);
+      return true;
+    case CostOp::Write:
+      write_seq(volume, cost);
+      return true;
+    case CostOp::Read:
+      read_seq(volume, cost);
+      return true;
+    case CostOp::Remove:
+      // fremove() is a stub.
+      return false;
+  }
+  return false;
+}
+
+}  // namespace g
@@ -0,0 +1,98 @@
+// cost_model.h
+//
+// Analytical model of the blob traffic each filesys.h call costs, derived
+// from the code paths in answer_1.cc as they are today:
+//
+//   - a directory bucket is a chain of packed DirBlocks, a lookup reads the
+//     chain up to the name and a miss reads all of it, plus the chain index
+//     once the chain is longer than its head,
+//   - a block that was never written reads as a blank one and costs no Put
+//     until something is added to it,
+//   - every block update rewrites the whole blob (header writes and
+//     appends alike),
+//   - fwrite is read-modify-write of one data blob, and the first write
+//     into a blob also appends its id to the control block,
+//   - an open file keeps its data blob ids in a block map, so only the
+//     first fread reads the control block,
+//   - a sequential fread past the middle of a blob prefetches the next one.
+//
+// Bucket loads are taken to be Poisson, which is what an ideal hash over
+// DIR_HEADS gives, or negative binomial with the variance of a real one
+// (|dispersion|, the "chi-square / expected" that dir_analyze reports).
+// Counts are expected values per call, at the same two
+// levels as io_counters.h: logical (asked of the blob cache) and store
+// (reaching the backing store). The store level depends on the cache, which
+// the model doesn't simulate: Gets of blobs that were never written always
+// miss, Gets of a blob the previous call just used always hit, and the
+// caller supplies the hit rate of the rest. Puts write through, so both
+// levels see the same Puts.
+//
+// Names are taken to be looked up uniformly, so entries never get hot
+// enough to be moved toward their bucket's head and promotion isn't
+// modelled. Neither is the name index (fs_index.h), with which fopen()
+// reads no directory block.
+//
+// fremove() is not implemented, so there is nothing to model for it yet.
+
+#pragma once
+
+#include <stdint.h>
+
+#include "fs_layout.h"
+
+namespace g {
+
+enum class CostOp {
+  OpenHit,      // fopen() of an existing name.
+  OpenMiss,     // fopen("r") of a name that doesn't exist.
+  OpenCreate,   // fopen("w") of a new name.
+  Write,        // fwrite() of a file written sequentially from 0.
+  Read,         // fread() of a file read sequentially from 0.
+  Remove,
+};
+
+const char* cost_op_name(CostOp op);
+
+struct VolumeProfile {
+  uint64_t files = 0;        // Files in the volume before the calls.
+  uint64_t file_size = 0;    // Bytes in each file.
+  uint64_t chunk = 4096;     // Bytes per fread() / fwrite().
+  uint32_t heads = DIR_HEADS;
+  // Variance over mean of the bucket loads; 1 for an ideal hash.
+  double dispersion = 1;
+  // Bytes a name takes in a packed DirBlock: front-coded against the name
+  // before it, and whole at a restart point (every DIR_RESTART entries,
+  // plus its offset). Depends on how much neighbouring names share.
+  double entry_bytes = 12;
+  double restart_bytes = 48;
+  // Consecutive calls the prediction is averaged over. Matters for
+  // OpenCreate, where each call grows the volume, and OpenMiss, where only
+  // the first miss on an empty head initializes it.
+  uint64_t calls = 1;
+  // Blob cache hit rates for the first Get of a blob in a call sequence,
+  // directory and control blocks and data blobs respectively.
+  double meta_hit = 0;
+  double data_hit = 0;
+};
+
+struct Cost {
+  double gets;
+  double get_bytes;
+  double puts;
+  double put_bytes;
+  // Logical Gets of blobs that were never written; they always miss.
+  double cold_gets;
+  // Logical Gets of the blob the previous call used; they always hit.
+  double warm_gets;
+  double warm_get_bytes;
+  double store_gets;
+  double store_get_bytes;
+  double store_puts;
+  double store_put_bytes;
+};
+
+// Expected cost of one |op| call on a volume described by |volume|. Returns
+// false if the model doesn't cover |op|.
+bool predict_cost(CostOp op, const VolumeProfile& volume, Cost* cost);
+
+}  // namespace g
@@ -0,0 +1,340 @@
+// cost_predict.cc
+//
+// Prints what the cost model (cost_model.h) predicts each call costs in blob
+// Gets, Puts and bytes for a volume of a given shape:
+//
+// usage: cost_predict [-files N] [-size BYTES] [-chunk BYTES] [-heads N]
+//                     [-dispersion D] [-entry BYTES] [-restart BYTES]
+//                     [-hit RATE]
+//                     [-validate [-tolerance 0.25]]
+//
+// -validate instead runs the bench workload on a fresh toy volume (create
+// and write |files| files, read them back, open as many missing names),
+// feeds the model the dispersion and packed entry size of the names it
+// created and each phase's measured blob cache hit rate, and compares
+// the prediction with the amplification counters from fs_stats.h. Exits
+// with 1 if any predicted counter is off by more than |tolerance|.
+//
+// The directory terms are the least exact: a real hash over structured
+// names spreads them less evenly than any load distribution of the right
+// mean and variance, which shows most on small volumes.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "cost_model.h"
+#include "dir_block.h"
+#include "filesys.h"
+#include "fs_stats.h"
+
+namespace {
+
+struct Options {
+  g::VolumeProfile volume;
+  double hit = 0;
+  bool validate = false;
+  double tolerance = 0.25;
+};
+
+struct Metric {
+  const char* name;
+  double scale;
+  double g::Cost::*predicted;
+  uint64_t g::OpStats::*measured;
+};
+
+const Metric kMetrics[] = {
+  {"gets", 1, &g::Cost::gets, &g::OpStats::gets},
+  {"get KiB", 1024, &g::Cost::get_bytes, &g::OpStats::get_bytes},
+  {"puts", 1, &g::Cost::puts, &g::OpStats::puts},
+  {"put KiB", 1024, &g::Cost::put_bytes, &g::OpStats::put_bytes},
+  {"store gets", 1, &g::Cost::store_gets, &g::OpStats::store_gets},
+  {"store get KiB", 1024, &g::Cost::store_get_bytes,
+   &g::OpStats::store_get_bytes},
+  {"store puts", 1, &g::Cost::store_puts, &g::OpStats::store_puts},
+  {"store put KiB", 1024, &g::Cost::store_put_bytes,
+   &g::OpStats::store_put_bytes},
+};
+
+std::string file_name(uint64_t i) {
+  return "bench/file-" + std::to_string(i) + ".dat";
+}
+
+// Variance over mean of the directory bucket loads of the first |files|
+// names, as dir_analyze computes it.
+double name_dispersion(uint64_t files) {
+  std::vector<double> loads(g::DIR_HEADS);
+  for (uint64_t i = 0; i != files; ++i) {
+    loads[g::name_to_dir_id(file_name(i)) - g::META_RESERVED] += 1;
+  }
+  double mean = static_cast<double>(files) / g::DIR_HEADS;
+  double chi2 = 0;
+  for (auto load : loads) {
+    chi2 += (load - mean) * (load - mean);
+  }
+  return mean ? chi2 / mean / (g::DIR_HEADS - 1) : 1;
+}
+
+// Sets the packed entry sizes of |v| from the first |files| names, as the
+// volume will hold them. Control block ids are taken to be handed out in
+// creation order.
+void measure_entries(uint64_t files, g::VolumeProfile* v) {
+  std::vector<std::vector<g::DirEntry>> buckets(g::DIR_HEADS);
+  for (uint64_t i = 0; i != files; ++i) {
+    auto name = file_name(i);
+    auto b = g::name_to_dir_id(name) - g::META_RESERVED;
+    buckets[b].push_back({name, g::META_RESERVED + 2 * g::DIR_HEADS + i});
+  }
+  const double empty = sizeof(g::DirBlock) + sizeof(g::PackedDir);
+  double bytes = 0;
+  double restarts = 0;
+  double restart_bytes = 0;
+  for (auto& entries : buckets) {
+    std::sort(entries.begin(), entries.end(),
+              [](const g::DirEntry& a, const g::DirEntry& b) {
+                return a.name < b.name;
+              });
+    for (size_t ix = 0; ix < entries.size(); ix += g::DIR_RESTART) {
+      restart_bytes += g::dir_packed_size({entries[ix]}) - empty;
+      ++restarts;
+    }
+    if (!entries.empty()) {
+      bytes += g::dir_packed_size(entries) - empty;
+    }
+  }
+  if (restarts) {
+    v->restart_bytes = restart_bytes / restarts;
+  }
+  if (files > restarts) {
+    v->entry_bytes = (bytes - restart_bytes) / (files - restarts);
+  }
+}
+
+void print_prediction(const Options& opts) {
+  auto v = opts.volume;
+  v.meta_hit = v.data_hit = opts.hit;
+  printf("files %lu, size %lu, chunk %lu, heads %u, dispersion %.2f, "
+         "entry %.1f (restart %.1f), hit rate %.2f\n", v.files, v.file_size,
+         v.chunk, v.heads, v.dispersion, v.entry_bytes, v.restart_bytes,
+         opts.hit);
+  printf("%-14s", "per call");
+  for (auto& m : kMetrics) {
+    printf(" %13s", m.name);
+  }
+  printf("\n");
+  for (auto op : {g::CostOp::OpenHit, g::CostOp::OpenMiss,
+                  g::CostOp::OpenCreate, g::CostOp::Write, g::CostOp::Read,
+                  g::CostOp::Remove}) {
+    g::Cost cost;
+    auto at = v;
+    if (op == g::CostOp::OpenCreate) {
+      // Averaged over building the volume.
+      at.files = 0;
+      at.calls = v.files;
+    }
+    if (!g::predict_cost(op, at, &cost)) {
+      printf("%-14s not modelled\n", g::cost_op_name(op));
+      continue;
+    }
+    printf("%-14s", g::cost_op_name(op));
+    for (auto& m : kMetrics) {
+      printf(" %13.2f", cost.*m.predicted / m.scale);
+    }
+    printf("\n");
+  }
+}
+
+// Runs |count| units of work and returns the stats they produced.
+template <typename Fn>
+g::Stats run_phase(const char* name, uint64_t count, Fn fn) {
+  g::fstats_reset();
+  for (uint64_t i = 0; i != count; ++i) {
+    if (!fn(i)) {
+      fprintf(stderr, "%s: failed at %lu\n", name, i);
+      exit(1);
+    }
+  }
+  g::Stats stats;
+  g::fstats(&stats);
+  return stats;
+}
+
+// Compares the model with one phase. |ops| pairs what the model calls an
+// operation with the fs_stats operation that measured it.
+int check_phase(const char* name, const g::Stats& st,
+                const std::vector<std::pair<g::CostOp, g::Op>>& ops,
+                g::VolumeProfile v, double tolerance) {
+  // The cache counts hits and misses over every Get in the phase; take out
+  // the Gets that can't miss or can't hit to get the rate the model wants.
+  double gets = 0;
+  double cold = 0;
+  double warm = 0;
+  for (auto& op : ops) {
+    auto& measured = st.ops[static_cast<size_t>(op.second)];
+    g::Cost cost;
+    v.calls = measured.calls;
+    g::predict_cost(op.first, v, &cost);
+    gets += measured.gets;
+    cold += cost.cold_gets * measured.calls;
+    warm += cost.warm_gets * measured.calls;
+  }
+  double first = gets - cold - warm;
+  double hit = first > 0 ? std::max(0.0, st.cache_hits - warm) / first : 0;
+  hit = std::min(1.0, hit);
+  v.meta_hit = v.data_hit = hit;
+
+  printf("\n%s: blob cache hit rate %.3f\n", name, hit);
+  printf("  %-14s %-14s %12s %12s %8s\n", "op", "per call", "predicted",
+         "measured", "error");
+  int failed = 0;
+  for (auto& op : ops) {
+    auto& measured = st.ops[static_cast<size_t>(op.second)];
+    g::Cost cost;
+    v.calls = measured.calls;
+    g::predict_cost(op.first, v, &cost);
+    for (auto& m : kMetrics) {
+      double want = cost.*m.predicted;
+      double got = measured.calls
+          ? static_cast<double>(measured.*m.measured) / measured.calls : 0;
+      double error = got ? (want - got) / got : (want ? 1 : 0);
+      // Tiny counts are all noise in relative terms.
+      bool bad = std::fabs(error) > tolerance &&
+                 std::fabs(want - got) / m.scale > 0.01;
+      failed += bad;
+      printf("  %-14s %-14s %12.3f %12.3f %+7.1f%%%s\n",
+             g::cost_op_name(op.first), m.name, want / m.scale,
+             got / m.scale, error * 100, bad ? "  MISMATCH" : "");
+    }
+  }
+  return failed;
+}
+
+int validate(const Options& opts) {
+  auto v = opts.volume;
+  if (v.chunk == 0 || MaxBlobSize % v.chunk != 0 ||
+      v.heads != g::DIR_HEADS) {
+    fprintf(stderr, "-validate needs a chunk that divides 256 KiB and the "
+                    "volume's %u heads\n", g::DIR_HEADS);
+    return 2;
+  }
+  // Keep the toy blob store from dumping every Put, and fopen() walking the
+  // directory as the model does.
+  setenv("BLOB_QUIET", "1", 1);
+  unsetenv("BLOB_NAME_INDEX");
+  g::finitialize();
+  g::fop_stats(true);
+  std::vector<char> buffer(v.chunk, 'x');
+  const uint64_t files = v.files;
+  v.dispersion = name_dispersion(files);
+  measure_entries(files, &v);
+  printf("files %lu, size %lu, chunk %lu, name dispersion %.3f, entry %.1f "
+         "(restart %.1f)\n", files, v.file_size, v.chunk, v.dispersion,
+         v.entry_bytes, v.restart_bytes);
+  int failed = 0;
+
+  auto st = run_phase("create", files, [&](uint64_t i) {
+    auto file = g::fopen(file_name(i).c_str(), "w");
+    if (!file) {
+      return false;
+    }
+    for (uint64_t pos = 0; pos < v.file_size; pos += v.chunk) {
+      if (g::fwrite(file, buffer.data(), v.chunk) != long(v.chunk)) {
+        return false;
+      }
+    }
+    return g::fclose(file) == 0;
+  });
+  v.files = 0;
+  failed += check_phase("create", st, {{g::CostOp::OpenCreate, g::Op::Open},
+                                       {g::CostOp::Write, g::Op::Write}},
+                        v, opts.tolerance);
+
+  st = run_phase("read", files, [&](uint64_t i) {
+    auto file = g::fopen(file_name(i).c_str(), "r");
+    if (!file) {
+      return false;
+    }
+    for (uint64_t pos = 0; pos < v.file_size; pos += v.chunk) {
+      g::fseek(file, pos, 0);
+      if (g::fread(file, buffer.data(), v.chunk) != long(v.chunk)) {
+        return false;
+      }
+    }
+    return g::fclose(file) == 0;
+  });
+  v.files = files;
+  failed += check_phase("read", st, {{g::CostOp::OpenHit, g::Op::Open},
+                                     {g::CostOp::Read, g::Op::Read}},
+                        v, opts.tolerance);
+
+  st = run_phase("miss", files, [&](uint64_t i) {
+    auto name = file_name(i) + ".missing";
+    return g::fopen(name.c_str(), "r") == nullptr;
+  });
+  failed += check_phase("miss", st, {{g::CostOp::OpenMiss, g::Op::Open}}, v,
+                        opts.tolerance);
+
+  g::ffinalize();
+  printf("\n%d counters off by more than %.0f%%\n", failed,
+         opts.tolerance * 100);
+  return failed ? 1 : 0;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  Options opts;
+  opts.volume.files = 2000;
+  opts.volume.file_size = 64 * 1024;
+  for (int i = 1; i < argc; ++i) {
+    bool more = i + 1 < argc;
+    if (!strcmp(argv[i], "-validate")) {
+      opts.validate = true;
+    } else if (!strcmp(argv[i], "-files") && more) {
+      opts.volume.files = strtoull(argv[++i], nullptr, 10);
+    } else if (!strcmp(argv[i], "-size") && more) {
+      opts.volume.file_size = strtoull(argv[++i], nullptr, 10);
+    } else if (!strcmp(argv[i], "-chunk") && more) {
+      opts.volume.chunk = strtoull(argv[++i], nullptr, 10);
+    } else if (!strcmp(argv[i], "-heads") && more) {
+      opts.volume.heads = static_cast<uint32_t>(atol(argv[++i]));
+    } else if (!strcmp(argv[i], "-dispersion") && more) {
+      opts.volume.dispersion = atof(argv[++i]);
+    } else if (!strcmp(argv[i], "-entry") && more) {
+      opts.volume.entry_bytes = atof(argv[++i]);
+    } else if (!strcmp(argv[i], "-restart") && more) {
+      opts.volume.restart_bytes = atof(argv[++i]);
+    } else if (!strcmp(argv[i], "-hit") && more) {
+      opts.hit = atof(argv[++i]);
+    } else if (!strcmp(argv[i], "-tolerance") && more) {
+      opts.tolerance = atof(argv[++i]);
+    } else {
+      fprintf(stderr,
+              "usage: cost_predict [-files N] [-size BYTES] [-chunk BYTES] "
+              "[-heads N]\n"
+              "                    [-dispersion D] [-entry BYTES] "
+              "[-restart BYTES]\n"
+              "                    [-hit RATE]\n"
+              "                    [-validate [-tolerance 0.25]]\n");
+      return 2;
+    }
+  }
+  if (opts.volume.heads == 0 || opts.volume.chunk == 0 ||
+      opts.volume.entry_bytes <= 0 || opts.volume.restart_bytes <= 0) {
+    fprintf(stderr, "-heads, -chunk, -entry and -restart must be "
+                    "positive\n");
+    return 2;
+  }
+  if (opts.validate) {
+    return validate(opts);
+  }
+  print_prediction(opts);
+  return 0;
+}
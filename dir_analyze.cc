@@ -0,0 +1,383 @@
+// dir_analyze.cc
+//
+// Directory hash distribution and chain-length analyzer.
+//
+// Names go to bucket hash(name) % heads and each bucket is a chain of
+// packed DirBlocks filled in creation order. This tool reports how a set of
+// names spreads over the buckets and what that costs:
+//
+//   - entries per bucket and DirBlocks per chain (histogram),
+//   - fill factor of the DirBlocks, in bytes, and bytes per entry,
+//   - expected blob reads per lookup hit (position in the chain) and per
+//     miss (whole chain),
+//   - hash quality: chi-square over the buckets relative to its expected
+//     value (1.0 is what a uniform hash gives), and max / mean load.
+//
+// By default the names are placed offline, which makes it cheap to try
+// other hash functions and head counts. With -volume the names are instead
+// created with g::fopen() on a fresh toy volume and the real directory heads
+// are scanned afterwards, which measures what the filesystem actually built.
+// Adding -reshard N reshards that volume to N heads (fs_reshard.h) before the
+// scan.
+//
+// usage: dir_analyze [-names FILE | -seq N [-prefix P]] [-heads N]
+//                    [-hash fnv32|fnv64|fnv64-fmix|crc32c|djb2|all]
+//                    [-volume [-reshard N]]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "blob.h"
+#include "dir_block.h"
+#include "filesys.h"
+#include "fs_layout.h"
+#include "fs_reshard.h"
+
+namespace {
+
+using HashFn = uint64_t (*)(const std::string&);
+
+uint64_t hash_fnv32(const std::string& s) {
+  return fnv32()(s);
+}
+
+uint64_t hash_fnv64(const std::string& s) {
+  uint64_t h = 0xcbf29ce484222325ull;
+  for (unsigned char c : s) {
+    h ^= c;
+    h *= 0x100000001b3ull;
+  }
+  return h;
+}
+
+// FNV-1a 64 followed by the murmur3 finalizer, so that every input bit
+// reaches the low bits the modulo keeps.
+uint64_t hash_fnv64_fmix(const std::string& s) {
+  uint64_t h = hash_fnv64(s);
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdull;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ull;
+  h ^= h >> 33;
+  return h;
+}
+
+uint64_t hash_crc32c(const std::string& s) {
+  uint32_t crc = ~0u;
+  for (unsigned char c : s) {
+    crc ^= c;
+    for (int k = 0; k != 8; ++k) {
+      crc = (crc >> 1) ^ (0x82f63b78u & (0u - (crc & 1)));
+    }
+  }
+  return ~crc;
+}
+
+// Known weak, for reference.
+uint64_t hash_djb2(const std::string& s) {
+  uint32_t h = 5381;
+  for (unsigned char c : s) {
+    h = h * 33 + c;
+  }
+  return h;
+}
+
+const std::map<std::string, HashFn> kHashes = {
+  {"fnv32", hash_fnv32},
+  {"fnv64", hash_fnv64},
+  {"fnv64-fmix", hash_fnv64_fmix},
+  {"crc32c", hash_crc32c},
+  {"djb2", hash_djb2},
+};
+
+// One DirBlock of a bucket's chain.
+struct Block {
+  uint32_t entries = 0;
+  size_t bytes = sizeof(g::DirBlock);
+};
+
+// The DirBlocks of each bucket's chain. An empty bucket is one empty block:
+// the head is always read.
+using Buckets = std::vector<std::vector<Block>>;
+
+// Bytes an entry can add to a packed block at most, short of shifting the
+// restart points after it.
+size_t entry_bound(const g::DirEntry& entry) {
+  return g::dir_packed_size({entry}) - sizeof(g::DirBlock) -
+         sizeof(g::PackedDir);
+}
+
+// Fills the chains the way fopen("w") does. Control block ids are handed
+// out in creation order after the directory's reserved blobs. Packing a
+// whole block per name is what the filesystem does but is slow for a
+// simulation, so a block is only packed again once the names added since
+// could have filled it.
+Buckets place(const std::vector<std::string>& names, HashFn hash,
+              uint32_t heads) {
+  Buckets buckets(heads, std::vector<Block>(1));
+  std::vector<std::vector<g::DirEntry>> tails(heads);
+  uint64_t id = g::META_RESERVED + 2 * heads;
+  for (auto& name : names) {
+    auto b = hash(name) % heads;
+    auto& block = buckets[b].back();
+    auto& tail = tails[b];
+    g::DirEntry entry {name, ++id};
+    g::dir_insert(&tail, entry);
+    if (block.bytes + entry_bound(entry) > MaxBlobSize) {
+      auto bytes = g::dir_packed_size(tail);
+      if (bytes > MaxBlobSize) {
+        tail.assign(1, entry);
+        buckets[b].push_back(Block {});
+        buckets[b].back().entries = 1;
+        buckets[b].back().bytes = g::dir_packed_size(tail);
+        continue;
+      }
+      block.bytes = bytes;
+    } else {
+      block.bytes += entry_bound(entry);
+    }
+    ++block.entries;
+  }
+  // Blocks still holding an estimate.
+  for (uint32_t b = 0; b != heads; ++b) {
+    if (!tails[b].empty()) {
+      buckets[b].back().bytes = g::dir_packed_size(tails[b]);
+    }
+  }
+  return buckets;
+}
+
+// The volume's current directory table, from META_DISK.
+g::DirGeometry volume_dir() {
+  auto blob = GetBlobStore()->GetBlob(0);
+  g::META_DISK meta;
+  bool ok = g::read_meta(blob->Get(), &meta);
+  blob->Release();
+  if (!ok) {
+    return g::DirGeometry {g::META_RESERVED, g::DIR_HEADS, 0};
+  }
+  return meta.dir;
+}
+
+Buckets scan_volume(const g::DirGeometry& dir) {
+  Buckets buckets(dir.heads);
+  auto store = GetBlobStore();
+  for (uint64_t b = 0; b != dir.heads; ++b) {
+    uint64_t id = dir.base + b;
+    while (id) {
+      auto blob = store->GetBlob(id);
+      auto& data = blob->Get();
+      Block block;
+      uint64_t next = 0;
+      if (data.size() >= sizeof(g::DirBlock)) {
+        auto dir = reinterpret_cast<const g::DirBlock*>(&data[0]);
+        block.entries = static_cast<uint32_t>(
+            g::dir_entries(dir, data.size()).size());
+        block.bytes = data.size();
+        next = dir->next;
+      }
+      buckets[b].push_back(block);
+      blob->Release();
+      id = next;
+    }
+  }
+  return buckets;
+}
+
+struct Report {
+  uint64_t names = 0;
+  uint64_t empty = 0;
+  uint64_t max_load = 0;
+  uint64_t blocks = 0;
+  double mean_load = 0;
+  double chi2_ratio = 0;
+  double hit_reads = 0;
+  double miss_reads = 0;
+  double fill = 0;
+  double entry_bytes = 0;
+  std::map<size_t, uint64_t> chain_hist;
+  std::map<int, uint64_t> fill_hist;   // Deciles.
+};
+
+Report analyze(const Buckets& buckets) {
+  Report r;
+  double hit_reads = 0;
+  double miss_reads = 0;
+  double bytes = 0;
+  double entry_bytes = 0;
+  for (auto& chain : buckets) {
+    uint64_t load = 0;
+    for (size_t k = 0; k != chain.size(); ++k) {
+      load += chain[k].entries;
+      // A name in block k costs k + 1 reads to find.
+      hit_reads += static_cast<double>(chain[k].entries) * (k + 1);
+      r.fill_hist[std::min<int>(9, chain[k].bytes * 10 / MaxBlobSize)]++;
+      bytes += chain[k].bytes;
+      if (chain[k].entries) {
+        entry_bytes += chain[k].bytes - sizeof(g::DirBlock) -
+                       sizeof(g::PackedDir);
+      }
+    }
+    r.names += load;
+    r.blocks += chain.size();
+    r.empty += load == 0;
+    r.max_load = std::max(r.max_load, load);
+    r.chain_hist[chain.size()]++;
+    miss_reads += chain.size();
+  }
+
+  double heads = buckets.size();
+  r.mean_load = r.names / heads;
+  double chi2 = 0;
+  for (auto& chain : buckets) {
+    double load = 0;
+    for (auto& block : chain) {
+      load += block.entries;
+    }
+    chi2 += (load - r.mean_load) * (load - r.mean_load);
+  }
+  // E[chi2] = heads - 1 for a uniform hash.
+  r.chi2_ratio = r.mean_load ? chi2 / r.mean_load / (heads - 1) : 0;
+  r.hit_reads = r.names ? hit_reads / r.names : 0;
+  r.miss_reads = miss_reads / heads;
+  r.fill = bytes / (r.blocks * MaxBlobSize);
+  r.entry_bytes = r.names ? entry_bytes / r.names : 0;
+  return r;
+}
+
+void print_report(const char* what, const Report& r, uint32_t heads) {
+  printf("%s: %lu names over %u heads\n", what, r.names, heads);
+  printf("  entries per head: mean %.1f, max %lu (%.2fx mean), %lu empty\n",
+         r.mean_load, r.max_load, r.mean_load ? r.max_load / r.mean_load : 0,
+         r.empty);
+  printf("  chi-square / expected: %.3f\n", r.chi2_ratio);
+  printf("  DirBlocks: %lu, fill %.1f%% (%.1f bytes per entry)\n", r.blocks,
+         r.fill * 100, r.entry_bytes);
+  printf("  blob reads per hit %.3f, per miss %.3f\n", r.hit_reads,
+         r.miss_reads);
+  printf("  chain length (blocks): ");
+  for (auto& h : r.chain_hist) {
+    printf(" %zu:%lu", h.first, h.second);
+  }
+  printf("\n  block fill (deciles):  ");
+  for (auto& h : r.fill_hist) {
+    printf(" %d%%:%lu", h.first * 10, h.second);
+  }
+  printf("\n");
+}
+
+bool load_names(const char* path, std::vector<std::string>* names) {
+  std::ifstream in(path);
+  if (!in) {
+    return false;
+  }
+  std::string line;
+  while (std::getline(in, line)) {
+    if (!line.empty() && line.size() < MAX_PATH) {
+      names->push_back(line);
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::vector<std::string> names;
+  std::string prefix = "tenant-0042/2026-10-18/shard-07/object-";
+  long seq = 0;
+  uint32_t heads = g::DIR_HEADS;
+  std::string hash = "fnv32";
+  bool volume = false;
+  uint32_t reshard = 0;
+
+  for (int i = 1; i < argc; ++i) {
+    bool more = i + 1 < argc;
+    if (!strcmp(argv[i], "-names") && more) {
+      if (!load_names(argv[++i], &names)) {
+        fprintf(stderr, "can't read %s\n", argv[i]);
+        return 2;
+      }
+    } else if (!strcmp(argv[i], "-seq") && more) {
+      seq = atol(argv[++i]);
+    } else if (!strcmp(argv[i], "-prefix") && more) {
+      prefix = argv[++i];
+    } else if (!strcmp(argv[i], "-heads") && more) {
+      heads = static_cast<uint32_t>(atol(argv[++i]));
+    } else if (!strcmp(argv[i], "-hash") && more) {
+      hash = argv[++i];
+    } else if (!strcmp(argv[i], "-volume")) {
+      volume = true;
+    } else if (!strcmp(argv[i], "-reshard") && more) {
+      reshard = static_cast<uint32_t>(atol(argv[++i]));
+    } else {
+      fprintf(stderr,
+              "usage: dir_analyze [-names FILE | -seq N [-prefix P]] "
+              "[-heads N]\n"
+              "                   [-hash fnv32|fnv64|fnv64-fmix|crc32c|djb2|"
+              "all]\n"
+              "                   [-volume [-reshard N]]\n");
+      return 2;
+    }
+  }
+  for (long i = 0; i < seq; ++i) {
+    names.push_back(prefix + std::to_string(i));
+  }
+  if (names.empty() || heads == 0) {
+    fprintf(stderr, "no names; use -names or -seq\n");
+    return 2;
+  }
+
+  if (volume) {
+    // What the filesystem builds is fixed: fnv32 over the volume's table.
+    setenv("BLOB_QUIET", "1", 1);
+    g::finitialize();
+    for (auto& name : names) {
+      auto file = g::fopen(name.c_str(), "w");
+      if (!file) {
+        fprintf(stderr, "can't create %s\n", name.c_str());
+        return 1;
+      }
+      g::fclose(file);
+    }
+    if (reshard && !g::fdir_reshard(reshard, false)) {
+      fprintf(stderr, "can't reshard to %u heads\n", reshard);
+      return 1;
+    }
+    g::ffinalize();
+    auto dir = volume_dir();
+    print_report("volume", analyze(scan_volume(dir)),
+                 static_cast<uint32_t>(dir.heads));
+    return 0;
+  }
+
+  if (hash != "all") {
+    auto it = kHashes.find(hash);
+    if (it == kHashes.end()) {
+      fprintf(stderr, "unknown hash %s\n", hash.c_str());
+      return 2;
+    }
+    print_report(hash.c_str(), analyze(place(names, it->second, heads)),
+                 heads);
+    return 0;
+  }
+
+  printf("%zu names over %u heads\n", names.size(), heads);
+  printf("%-12s %8s %8s %8s %10s %10s %8s\n", "hash", "chi2/E", "max/mean",
+         "empty", "reads/hit", "reads/miss", "fill");
+  for (auto& h : kHashes) {
+    auto r = analyze(place(names, h.second, heads));
+    printf("%-12s %8.3f %8.2f %8lu %10.3f %10.3f %7.1f%%\n", h.first.c_str(),
+           r.chi2_ratio, r.mean_load ? r.max_load / r.mean_load : 0, r.empty,
+           r.hit_reads, r.miss_reads, r.fill * 100);
+  }
+  return 0;
+}
@@ -0,0 +1,219 @@
+// dir_block.cc
+//
+// See dir_block.h for the API and fs_layout.h for the format.
+
+#include "dir_block.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "op_stats.h"
+#include "varint.h"
+
+namespace g {
+namespace {
+
+size_t shared_prefix(const std::string& a, const std::string& b) {
+  auto n = std::min(a.size(), b.size());
+  size_t i = 0;
+  while (i != n && a[i] == b[i]) {
+    ++i;
+  }
+  return i;
+}
+
+// Walks the entries of a packed block.
+class PackedReader {
+ public:
+  PackedReader(const DirBlock* block, size_t size) {
+    auto base = reinterpret_cast<const uint8_t*>(block);
+    end_ = base + size;
+    if (size < sizeof(DirBlock) + sizeof(PackedDir)) {
+      return;
+    }
+    memcpy(&dir_, base + sizeof(DirBlock), sizeof(dir_));
+    restarts_ = base + sizeof(DirBlock) + sizeof(PackedDir);
+    entries_ = restarts_ + dir_.restarts * sizeof(uint32_t);
+    if (entries_ > end_) {
+      dir_ = PackedDir {};
+    }
+  }
+
+  uint32_t count() const { return dir_.count; }
+  uint32_t restarts() const { return dir_.restarts; }
+
+  // Positions the reader at restart |group|.
+  bool seek(uint32_t group) {
+    uint32_t offset;
+    memcpy(&offset, restarts_ + group * sizeof(uint32_t), sizeof(offset));
+    p_ = entries_ + offset;
+    ix_ = group * DIR_RESTART;
+    name_.clear();
+    return p_ < end_;
+  }
+
+  // Decodes the next entry into name() and control_blob().
+  bool next() {
+    uint64_t shared, suffix;
+    if (ix_ == dir_.count || !p_ ||
+        !(p_ = get_varint(p_, end_, &shared)) ||
+        !(p_ = get_varint(p_, end_, &suffix)) ||
+        shared > name_.size() || suffix > size_t(end_ - p_)) {
+      return false;
+    }
+    name_.resize(shared);
+    name_.append(reinterpret_cast<const char*>(p_), suffix);
+    p_ += suffix;
+    if (!(p_ = get_varint(p_, end_, &control_blob_))) {
+      return false;
+    }
+    ++ix_;
+    return true;
+  }
+
+  const std::string& name() const { return name_; }
+  uint64_t control_blob() const { return control_blob_; }
+
+ private:
+  PackedDir dir_ = {};
+  const uint8_t* restarts_ = nullptr;
+  const uint8_t* entries_ = nullptr;
+  const uint8_t* end_ = nullptr;
+  const uint8_t* p_ = nullptr;
+  uint32_t ix_ = 0;
+  std::string name_;
+  uint64_t control_blob_ = 0;
+};
+
+size_t raw_count(size_t size) {
+  return (size - sizeof(DirBlock)) / sizeof(FileEntry);
+}
+
+}  // namespace
+
+uint64_t dir_find(const DirBlock* block, size_t size,
+                  const std::string& name) {
+  StatScope scope(Op::DirFind);
+  if (block->flags != Flags::Packed) {
+    for (size_t ix = 0; ix != raw_count(size); ++ix) {
+      if (name.compare(block->entries[ix].name) == 0) {
+        return block->entries[ix].control_blob;
+      }
+    }
+    return 0;
+  }
+
+  // The last group that starts at or before |name|.
+  PackedReader reader(block, size);
+  uint32_t lo = 0;
+  uint32_t hi = reader.restarts();
+  while (lo != hi) {
+    auto mid = lo + (hi - lo) / 2;
+    if (!reader.seek(mid) || !reader.next()) {
+      return 0;
+    }
+    if (reader.name().compare(name) <= 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  if (lo == 0 || !reader.seek(lo - 1)) {
+    return 0;
+  }
+  for (uint32_t k = 0; k != DIR_RESTART && reader.next(); ++k) {
+    auto cmp = reader.name().compare(name);
+    if (cmp == 0) {
+      return reader.control_blob();
+    }
+    if (cmp > 0) {
+      break;
+    }
+  }
+  return 0;
+}
+
+std::vector<DirEntry> dir_entries(const DirBlock* block, size_t size) {
+  std::vector<DirEntry> entries;
+  if (block->flags != Flags::Packed) {
+    for (size_t ix = 0; ix != raw_count(size); ++ix) {
+      auto& entry = block->entries[ix];
+      if (entry.control_blob) {
+        entries.push_back({std::string(entry.name, strnlen(entry.name,
+                                                           MAX_PATH)),
+                           entry.control_blob});
+      }
+    }
+    std::sort(entries.begin(), entries.end(),
+              [](const DirEntry& a, const DirEntry& b) {
+                return a.name < b.name;
+              });
+    return entries;
+  }
+
+  PackedReader reader(block, size);
+  entries.reserve(reader.count());
+  if (reader.restarts() && reader.seek(0)) {
+    while (reader.next()) {
+      entries.push_back({reader.name(), reader.control_blob()});
+    }
+  }
+  return entries;
+}
+
+size_t dir_packed_size(const std::vector<DirEntry>& entries) {
+  size_t restarts = (entries.size() + DIR_RESTART - 1) / DIR_RESTART;
+  size_t size = sizeof(DirBlock) + sizeof(PackedDir) +
+                restarts * sizeof(uint32_t);
+  for (size_t ix = 0; ix != entries.size(); ++ix) {
+    auto& name = entries[ix].name;
+    size_t shared = ix % DIR_RESTART
+        ? shared_prefix(entries[ix - 1].name, name) : 0;
+    size += varint_size(shared) + varint_size(name.size() - shared) +
+            name.size() - shared + varint_size(entries[ix].control_blob);
+  }
+  return size;
+}
+
+Data dir_pack(const BlockHeader& hdr, const std::vector<DirEntry>& entries) {
+  Data data(dir_packed_size(entries));
+  DirBlock block = {};
+  static_cast<BlockHeader&>(block) = hdr;
+  block.type = DirBlock::btype;
+  block.flags = Flags::Packed;
+  memcpy(&data[0], &block, sizeof(block));
+
+  PackedDir dir = {};
+  dir.count = static_cast<uint32_t>(entries.size());
+  dir.restarts = (dir.count + DIR_RESTART - 1) / DIR_RESTART;
+  memcpy(&data[sizeof(DirBlock)], &dir, sizeof(dir));
+
+  auto restarts = &data[sizeof(DirBlock) + sizeof(PackedDir)];
+  auto start = restarts + dir.restarts * sizeof(uint32_t);
+  auto p = start;
+  for (size_t ix = 0; ix != entries.size(); ++ix) {
+    auto& name = entries[ix].name;
+    size_t shared = 0;
+    if (ix % DIR_RESTART == 0) {
+      uint32_t offset = static_cast<uint32_t>(p - start);
+      memcpy(restarts + ix / DIR_RESTART * sizeof(uint32_t), &offset,
+             sizeof(offset));
+    } else {
+      shared = shared_prefix(entries[ix - 1].name, name);
+    }
+    p = put_varint(p, shared);
+    p = put_varint(p, name.size() - shared);
+    memcpy(p, name.data() + shared, name.size() - shared);
+    p += name.size() - shared;
+    p = put_varint(p, entries[ix].control_blob);
+  }
+  return data;
+}
+
+void dir_insert(std::vector<DirEntry>* entries, DirEntry entry) {
+  auto it = std::lower_bound(entries->begin(), entries->end(), entry,
+      [](const DirEntry& a, const DirEntry& b) { return a.name < b.name; });
+  entries->insert(it, std::move(entry));
+}
+
+}  // namespace g
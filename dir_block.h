@@ -0,0 +1,46 @@
+// dir_block.h
+//
+// Reading and writing directory blocks (fs_layout.h). Lookups and decodes
+// take either format; blocks are always written packed, so a raw block is
+// converted the first time it changes.
+//
+// A packed entry costs its name's suffix past what it shares with the
+// previous name, plus a few bytes, instead of a 520 byte FileEntry. Names
+// that share long prefixes (tenant/date/shard/...) fit tens of times more
+// per block.
+
+#pragma once
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "blob.h"
+#include "fs_layout.h"
+
+namespace g {
+
+struct DirEntry {
+  std::string name;
+  uint64_t control_blob;
+};
+
+// Control block of |name| in directory block |block|, |size| bytes long,
+// or 0.
+uint64_t dir_find(const DirBlock* block, size_t size, const std::string& name);
+
+// Every entry of |block|, sorted by name.
+std::vector<DirEntry> dir_entries(const DirBlock* block, size_t size);
+
+// Bytes of the packed block holding |entries|, which are sorted by name.
+size_t dir_packed_size(const std::vector<DirEntry>& entries);
+
+// Packed block holding |entries|, sorted by name, with the links of |hdr|.
+// Can be bigger than MaxBlobSize; see dir_packed_size().
+Data dir_pack(const BlockHeader& hdr, const std::vector<DirEntry>& entries);
+
+// Inserts |entry| into |entries|, keeping them sorted.
+void dir_insert(std::vector<DirEntry>* entries, DirEntry entry);
+
+}  // namespace g
@@ -0,0 +1,384 @@
+// file_store.cc
+//
+// See file_store.h.
+
+#include "file_store.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+
+namespace {
+
+constexpr uint32_t kSlotMagic = 0x32425346;  // "FSB2"
+
+// At the start of each slot's header block.
+struct SlotHeader {
+  uint32_t magic;
+  uint32_t size;
+  uint64_t id;
+  uint64_t generation;
+  // CRC-32C of the blob's bytes, then of this header with |crc| 0.
+  uint32_t crc;
+  uint32_t unused;
+};
+
+// CRC-32C, a byte at a time.
+struct CrcTable {
+  uint32_t entries[256];
+
+  CrcTable() {
+    for (uint32_t i = 0; i != 256; ++i) {
+      uint32_t crc = i;
+      for (int k = 0; k != 8; ++k) {
+        crc = (crc >> 1) ^ (0x82f63b78u & (0u - (crc & 1)));
+      }
+      entries[i] = crc;
+    }
+  }
+};
+
+uint32_t crc32c(const void* bytes, size_t size, uint32_t crc = 0) {
+  static const CrcTable table;
+  auto p = static_cast<const uint8_t*>(bytes);
+  crc = ~crc;
+  for (size_t i = 0; i != size; ++i) {
+    crc = (crc >> 8) ^ table.entries[(crc ^ p[i]) & 0xff];
+  }
+  return ~crc;
+}
+
+uint32_t slot_crc(SlotHeader hdr, const uint8_t* data) {
+  hdr.crc = 0;
+  return crc32c(&hdr, sizeof(hdr), crc32c(data, hdr.size));
+}
+
+constexpr size_t round_up(size_t size) {
+  return (size + FileStore::kBlockSize - 1) & ~(FileStore::kBlockSize - 1);
+}
+
+static_assert(FileStore::kSlotSize % FileStore::kBlockSize == 0,
+              "slots are block aligned");
+
+}  // namespace
+
+class FileStore::FileBlob final : public Blob {
+ public:
+  FileBlob(FileStore* store, uint64_t id, Data data)
+      : store_(store), id_(id), data_(std::move(data)) {}
+
+  const Data& Get() const override { return data_; }
+
+  int Put(const Data& data) override {
+    auto rc = store_->Write(id_, data);
+    if (rc == 0) {
+      data_ = data;
+    }
+    return rc;
+  }
+
+  int Release() override {
+    delete this;
+    return 0;
+  }
+
+ private:
+  FileStore* const store_;
+  const uint64_t id_;
+  Data data_;
+};
+
+FileStore::FileStore(const std::string& path, uint64_t capacity, FileIo io,
+                     FileSync sync)
+    : io_(io), sync_(sync), max_slots_(capacity / MaxBlobSize) {
+  int flags = O_RDWR | O_CREAT | O_CLOEXEC;
+  if (io_ == FileIo::Direct) {
+    fd_ = open(path.c_str(), flags | O_DIRECT, 0644);
+    if (fd_ < 0 && errno == EINVAL) {
+      io_ = FileIo::Buffered;
+    }
+  }
+  if (io_ == FileIo::Buffered) {
+    fd_ = open(path.c_str(), flags, 0644);
+  }
+  if (fd_ >= 0 && !Load()) {
+    close(fd_);
+    fd_ = -1;
+  }
+}
+
+FileStore::~FileStore() {
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+  for (auto buffer : buffers_) {
+    free(buffer);
+  }
+}
+
+bool FileStore::Load() {
+  struct stat st;
+  if (fstat(fd_, &st) != 0) {
+    return false;
+  }
+  // The last slot is only as long as its blob.
+  uint64_t count = (st.st_size + kSlotSize - 1) / kSlotSize;
+  auto buffer = TakeBuffer();
+  bool loaded = true;
+  for (uint64_t index = 0; index != count; ++index) {
+    auto offset = index * kSlotSize;
+    if (pread(fd_, buffer, kBlockSize, offset) <
+        static_cast<ssize_t>(sizeof(SlotHeader))) {
+      loaded = false;
+      break;
+    }
+    SlotHeader hdr;
+    memcpy(&hdr, buffer, sizeof(hdr));
+    auto it = slots_.find(hdr.id);
+    // Slots never written whole, and older copies, are free.
+    bool newest =
+        hdr.magic == kSlotMagic && hdr.size <= MaxBlobSize &&
+        (it == slots_.end() || it->second.generation < hdr.generation);
+    if (newest) {
+      generation_ = std::max(generation_, hdr.generation);
+      auto n = hdr.size ? pread(fd_, buffer + kBlockSize, round_up(hdr.size),
+                                offset + kBlockSize)
+                        : 0;
+      if (n < hdr.size || slot_crc(hdr, buffer + kBlockSize) != hdr.crc) {
+        ++torn_;
+        newest = false;
+      }
+    }
+    if (!newest) {
+      free_slots_.push_back(index);
+      continue;
+    }
+    if (it != slots_.end()) {
+      free_slots_.push_back(it->second.index);
+    }
+    slots_[hdr.id] = {index, hdr.size, hdr.generation};
+  }
+  ReturnBuffer(buffer);
+  next_slot_ = count;
+  return loaded;
+}
+
+uint8_t* FileStore::TakeBuffer() {
+  std::unique_lock<std::mutex> lock(buffers_mutex_);
+  if (free_buffers_.empty() && buffers_.size() != kBuffers) {
+    void* buffer = nullptr;
+    if (posix_memalign(&buffer, kBlockSize, kSlotSize) == 0) {
+      buffers_.push_back(static_cast<uint8_t*>(buffer));
+      return buffers_.back();
+    }
+  }
+  if (free_buffers_.empty()) {
+    buffer_waits_.fetch_add(1, std::memory_order_relaxed);
+    buffer_returned_.wait(lock, [this] { return !free_buffers_.empty(); });
+  }
+  auto buffer = free_buffers_.back();
+  free_buffers_.pop_back();
+  return buffer;
+}
+
+void FileStore::ReturnBuffer(uint8_t* buffer) {
+  {
+    std::lock_guard<std::mutex> lock(buffers_mutex_);
+    free_buffers_.push_back(buffer);
+  }
+  buffer_returned_.notify_one();
+}
+
+void FileStore::Retire(uint64_t index) {
+  if (reading_.count(index)) {
+    retired_.insert(index);
+  } else {
+    free_slots_.push_back(index);
+  }
+}
+
+int FileStore::Read(uint64_t id, Data* data) {
+  Slot slot;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = slots_.find(id);
+    if (it == slots_.end() || it->second.size == 0) {
+      data->clear();
+      return 0;
+    }
+    slot = it->second;
+    ++reading_[slot.index];
+  }
+  auto offset = slot.index * kSlotSize + kBlockSize;
+  ssize_t n;
+  if (io_ == FileIo::Direct) {
+    auto buffer = TakeBuffer();
+    n = pread(fd_, buffer, round_up(slot.size), offset);
+    if (n >= slot.size) {
+      data->assign(buffer, buffer + slot.size);
+    }
+    ReturnBuffer(buffer);
+  } else {
+    data->resize(slot.size);
+    n = pread(fd_, data->data(), slot.size, offset);
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (--reading_[slot.index] == 0) {
+      reading_.erase(slot.index);
+      if (retired_.erase(slot.index)) {
+        free_slots_.push_back(slot.index);
+      }
+    }
+  }
+  if (n < slot.size) {
+    return ErrInternal;
+  }
+  reads_.fetch_add(1, std::memory_order_relaxed);
+  read_bytes_.fetch_add(n, std::memory_order_relaxed);
+  return 0;
+}
+
+int FileStore::Write(uint64_t id, const Data& data) {
+  if (data.size() > MaxBlobSize) {
+    return ErrBadArgs;
+  }
+  // Always a fresh slot, so the blob's current one stays whole until this
+  // one is.
+  Slot slot = {0, static_cast<uint32_t>(data.size()), 0};
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // Blanking a blob that was never written.
+    if (data.empty() && !slots_.count(id)) {
+      return 0;
+    }
+    if (!free_slots_.empty()) {
+      slot.index = free_slots_.back();
+      free_slots_.pop_back();
+    } else if (next_slot_ < max_slots_) {
+      slot.index = next_slot_++;
+    } else {
+      return ErrOutofSpace;
+    }
+    slot.generation = ++generation_;
+  }
+  if (sync_ == FileSync::Group) {
+    std::lock_guard<std::mutex> lock(commit_mutex_);
+    ++writing_;
+  }
+  SlotHeader hdr = {kSlotMagic, slot.size, id, slot.generation, 0, 0};
+  hdr.crc = slot_crc(hdr, data.data());
+  auto offset = slot.index * kSlotSize;
+  ssize_t n;
+  size_t len;
+  if (io_ == FileIo::Direct) {
+    auto buffer = TakeBuffer();
+    len = kBlockSize + round_up(data.size());
+    memcpy(buffer, &hdr, sizeof(hdr));
+    memset(buffer + sizeof(hdr), 0, kBlockSize - sizeof(hdr));
+    if (!data.empty()) {
+      memcpy(buffer + kBlockSize, data.data(), data.size());
+    }
+    memset(buffer + kBlockSize + data.size(), 0,
+           len - kBlockSize - data.size());
+    n = pwrite(fd_, buffer, len, offset);
+    ReturnBuffer(buffer);
+  } else {
+    uint8_t block[kBlockSize] = {};
+    memcpy(block, &hdr, sizeof(hdr));
+    iovec iov[2] = {{block, kBlockSize},
+                    {const_cast<uint8_t*>(data.data()), data.size()}};
+    len = kBlockSize + data.size();
+    n = pwritev(fd_, iov, 2, offset);
+  }
+  bool wrote = n == static_cast<ssize_t>(len);
+  if (wrote) {
+    writes_.fetch_add(1, std::memory_order_relaxed);
+    written_bytes_.fetch_add(n, std::memory_order_relaxed);
+  }
+  int rc = wrote ? 0 : ErrInternal;
+  if (sync_ == FileSync::Group) {
+    rc = Commit(wrote);
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (rc != 0) {
+    free_slots_.push_back(slot.index);
+    return rc;
+  }
+  auto it = slots_.find(id);
+  if (it == slots_.end()) {
+    slots_.emplace(id, slot);
+  } else if (it->second.generation < slot.generation) {
+    Retire(it->second.index);
+    it->second = slot;
+  } else {
+    // A later Put of the blob finished first.
+    free_slots_.push_back(slot.index);
+  }
+  return 0;
+}
+
+int FileStore::Commit(bool wrote) {
+  std::unique_lock<std::mutex> lock(commit_mutex_);
+  --writing_;
+  if (!wrote) {
+    caught_up_.notify_one();
+    return ErrInternal;
+  }
+  auto ticket = ++written_;
+  caught_up_.notify_one();
+  while (synced_ < ticket && !sync_failed_) {
+    if (syncing_) {
+      committed_.wait(lock);
+      continue;
+    }
+    syncing_ = true;
+    if (writing_) {
+      caught_up_.wait_for(lock, std::chrono::microseconds(kCommitWindowUs),
+                          [this] { return writing_ == 0; });
+    }
+    auto through = written_;
+    lock.unlock();
+    bool synced = fdatasync(fd_) == 0;
+    lock.lock();
+    syncing_ = false;
+    ++commits_;
+    if (synced) {
+      synced_ = through;
+    } else {
+      sync_failed_ = true;
+    }
+    committed_.notify_all();
+  }
+  return synced_ >= ticket ? 0 : ErrInternal;
+}
+
+Blob* FileStore::GetBlob(uint64_t id) {
+  Data data;
+  if (Read(id, &data) != 0) {
+    return nullptr;
+  }
+  return new FileBlob(this, id, std::move(data));
+}
+
+uint64_t FileStore::GetFreeSpace() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return (max_slots_ - std::min(next_slot_, max_slots_) +
+          free_slots_.size()) * MaxBlobSize;
+}
+
+FileStats FileStore::stats() const {
+  std::lock_guard<std::mutex> lock(commit_mutex_);
+  return FileStats{reads_.load(std::memory_order_relaxed),
+                   writes_.load(std::memory_order_relaxed),
+                   read_bytes_.load(std::memory_order_relaxed),
+                   written_bytes_.load(std::memory_order_relaxed),
+                   buffer_waits_.load(std::memory_order_relaxed),
+                   commits_, synced_, torn_};
+}
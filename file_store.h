@@ -0,0 +1,165 @@
+// file_store.h
+//
+// A BlobStore in one file, for running volumes on a real disk.
+//
+// Blobs are kept in slots of kSlotSize bytes: a kBlockSize header block,
+// with the blob's id, size, a generation and a CRC-32C of it all, then room
+// for MaxBlobSize bytes. A Put writes its blob's header and bytes with one
+// write, and GetBlob() reads the bytes into the Blob, which is a local copy.
+//
+// A Put never overwrites the slot its blob is in. It writes a fresh one,
+// reusing a free slot or past the end, and the blob moves there only once
+// the write finished (and is durable, with FileSync::Group); the old slot
+// is freed when no Read is still using it. A Read so sees one version of a
+// blob whole. Opening the file reads every slot and keeps, for each id, the
+// one of the highest generation whose checksum matches, so with
+// FileSync::Group a crash during a Put leaves the previous version. With
+// FileSync::None a crash may lose Puts that returned, and, as their old
+// slots may have been reused since, the versions before them too.
+// Overwrites need a free slot too, so a full store can't take them.
+//
+// FileIo::Direct opens the file with O_DIRECT, so blobs skip the kernel
+// page cache: the filesystem caches what it needs itself (blob_cache.h),
+// and a page cache copy would hold every blob twice and add a memcpy.
+// O_DIRECT needs block aligned buffers, offsets and lengths. Slots and
+// their data are block aligned, a blob's last partial block is read and
+// written whole with the padding ignored, and the I/O goes through a fixed
+// pool of kBuffers aligned buffers, so memory use doesn't grow with load.
+// A file system without O_DIRECT gets FileIo::Buffered instead; see io().
+//
+// FileSync::Group makes a Put durable before it returns, but without an
+// fdatasync() per Put, which would hold the store to the disk's flush rate.
+// Puts that finish writing while a sync is running wait for it and share
+// the next one: whichever of them finds no sync running leads it, first
+// waiting up to kCommitWindowUs for Puts still writing to catch up, so all
+// of them commit together. A lone Put doesn't wait. A failed sync fails its
+// Puts and every durable Put after it, since what the kernel dropped can't
+// be told apart from what it wrote.
+
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "blob.h"
+
+enum class FileIo {
+  Buffered,
+  Direct,
+};
+
+enum class FileSync {
+  None,
+  Group,
+};
+
+struct FileStats {
+  uint64_t reads;
+  uint64_t writes;
+  uint64_t read_bytes;
+  uint64_t written_bytes;
+  // Calls that waited for an aligned buffer.
+  uint64_t buffer_waits;
+  // fdatasync() calls, and the Puts they made durable.
+  uint64_t commits;
+  uint64_t committed;
+  // Newest slots of a blob that failed their checksum when the file was
+  // opened, i.e. Puts a crash cut short.
+  uint64_t torn;
+};
+
+class FileStore final : public BlobStore {
+ public:
+  static constexpr size_t kBlockSize = 4096;
+  static constexpr size_t kSlotSize = kBlockSize + MaxBlobSize;
+  static constexpr size_t kBuffers = 16;
+  static constexpr int kCommitWindowUs = 200;
+
+  // Opens the store in |path|, creating it if needed, to hold at most
+  // |capacity| bytes of blobs. See ok().
+  FileStore(const std::string& path, uint64_t capacity,
+            FileIo io = FileIo::Buffered, FileSync sync = FileSync::None);
+  ~FileStore();
+
+  FileStore(const FileStore&) = delete;
+  FileStore& operator=(const FileStore&) = delete;
+
+  bool ok() const { return fd_ >= 0; }
+  // The mode the file is open in.
+  FileIo io() const { return io_; }
+
+  Blob* GetBlob(uint64_t id) override;
+  // Of slots not given out yet.
+  uint64_t GetFreeSpace() override;
+
+  FileStats stats() const;
+
+ private:
+  class FileBlob;
+
+  struct Slot {
+    uint64_t index;
+    uint32_t size;
+    uint64_t generation;
+  };
+
+  // Finds the newest whole slot of every id in the file.
+  bool Load();
+  // Frees a slot no id points to any more, once no Read uses it. Called
+  // with |mutex_| held.
+  void Retire(uint64_t index);
+  int Read(uint64_t id, Data* data);
+  int Write(uint64_t id, const Data& data);
+  // Waits until a sync covers a write that just finished, or that failed
+  // if not |wrote|.
+  int Commit(bool wrote);
+  // Waits for one of the aligned buffers if they are all in use.
+  uint8_t* TakeBuffer();
+  void ReturnBuffer(uint8_t* buffer);
+
+  int fd_ = -1;
+  FileIo io_;
+  const FileSync sync_;
+  const uint64_t max_slots_;
+
+  std::mutex mutex_;
+  std::unordered_map<uint64_t, Slot> slots_;
+  uint64_t next_slot_ = 0;
+  std::vector<uint64_t> free_slots_;
+  // Reads in progress by slot, and slots to free once they are done.
+  std::unordered_map<uint64_t, uint32_t> reading_;
+  std::unordered_set<uint64_t> retired_;
+  // Of the last Put.
+  uint64_t generation_ = 0;
+  uint64_t torn_ = 0;
+
+  std::mutex buffers_mutex_;
+  std::condition_variable buffer_returned_;
+  std::vector<uint8_t*> buffers_;
+  std::vector<uint8_t*> free_buffers_;
+
+  mutable std::mutex commit_mutex_;
+  std::condition_variable committed_;
+  std::condition_variable caught_up_;
+  // Durable Puts between starting their write and joining a commit.
+  uint32_t writing_ = 0;
+  // Writes finished, and how many of them a sync covered.
+  uint64_t written_ = 0;
+  uint64_t synced_ = 0;
+  bool syncing_ = false;
+  bool sync_failed_ = false;
+  uint64_t commits_ = 0;
+
+  std::atomic<uint64_t> reads_{0};
+  std::atomic<uint64_t> writes_{0};
+  std::atomic<uint64_t> read_bytes_{0};
+  std::atomic<uint64_t> written_bytes_{0};
+  std::atomic<uint64_t> buffer_waits_{0};
+};
@@ -0,0 +1,77 @@
+// freq_sketch.cc
+//
+// See freq_sketch.h.
+
+#include "freq_sketch.h"
+
+#include <algorithm>
+
+namespace {
+
+// splitmix64's finalizer.
+uint64_t mix(uint64_t h) {
+  h ^= h >> 30;
+  h *= 0xbf58476d1ce4e5b9ull;
+  h ^= h >> 27;
+  h *= 0x94d049bb133111ebull;
+  h ^= h >> 31;
+  return h;
+}
+
+const uint64_t kSeeds[] = {
+  0x9e3779b97f4a7c15ull, 0xc2b2ae3d27d4eb4full,
+  0x165667b19e3779f9ull, 0x27d4eb2f165667c5ull,
+};
+
+}  // namespace
+
+FrequencySketch::FrequencySketch(size_t ids) {
+  // A word of 16 counters per id and row, rounded up to a power of two.
+  size_t words = 64;
+  while (words < ids) {
+    words *= 2;
+  }
+  table_.assign(words, 0);
+  mask_ = words - 1;
+  sample_ = 10 * std::max<size_t>(ids, 1);
+}
+
+void FrequencySketch::Locate(uint64_t id, int row, size_t* word,
+                             int* shift) const {
+  auto h = mix(id + kSeeds[row]);
+  *word = h & mask_;
+  *shift = static_cast<int>((h >> 60) * 4);
+}
+
+void FrequencySketch::Increment(uint64_t id) {
+  for (int row = 0; row != kRows; ++row) {
+    size_t word;
+    int shift;
+    Locate(id, row, &word, &shift);
+    if (((table_[word] >> shift) & 0xf) != 0xf) {
+      table_[word] += uint64_t(1) << shift;
+    }
+  }
+  if (++additions_ == sample_) {
+    Age();
+  }
+}
+
+uint32_t FrequencySketch::Estimate(uint64_t id) const {
+  uint32_t count = 0xf;
+  for (int row = 0; row != kRows; ++row) {
+    size_t word;
+    int shift;
+    Locate(id, row, &word, &shift);
+    count = std::min(count, static_cast<uint32_t>((table_[word] >> shift) &
+                                                  0xf));
+  }
+  return count;
+}
+
+void FrequencySketch::Age() {
+  for (auto& word : table_) {
+    word = (word >> 1) & 0x7777777777777777ull;
+  }
+  additions_ /= 2;
+}
@@ -0,0 +1,42 @@
+// freq_sketch.h
+//
+// Approximate access counts of blob ids, for cache admission (TinyLFU).
+//
+// A count-min sketch of 4-bit counters, packed 16 to a word. An id has
+// four counters, picked by four hashes, and increments each of them. Its
+// estimate is the smallest of the four, which over-counts only when all
+// four collide with busier ids. Counters saturate at 15, which is all
+// admission needs: whether a blob has been asked for more often than
+// another. Once the sketch has counted 10 accesses per id it was sized
+// for, every counter is halved, so old popularity fades and a blob that
+// stopped being used can be displaced.
+//
+// Not thread safe; BlobCache calls it under its lock.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+class FrequencySketch {
+ public:
+  // Sized for about |ids| distinct ids in use at once.
+  explicit FrequencySketch(size_t ids);
+
+  void Increment(uint64_t id);
+  uint32_t Estimate(uint64_t id) const;
+
+ private:
+  static constexpr int kRows = 4;
+
+  // Word and nibble of |id|'s |row|th counter.
+  void Locate(uint64_t id, int row, size_t* word, int* shift) const;
+  void Age();
+
+  std::vector<uint64_t> table_;
+  uint64_t mask_;
+  uint64_t additions_ = 0;
+  uint64_t sample_;
+};
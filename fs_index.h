@@ -0,0 +1,37 @@
+// fs_index.h
+//
+// In-memory name index for the filesys.h implementation. Not part of the
+// interview API.
+//
+// On a volume that is mostly read, every fopen() of an existing name walks
+// its bucket chain. fname_index() instead reads every directory block once,
+// a bucket at a time and in the background, into a NameIndex
+// (name_index.h). Once that is built fopen() looks names up there and
+// touches no directory block, except to add a name. Names created since
+// the build began are kept in a side table, so the index is never stale:
+// files are never removed and control block ids never change, even when
+// entries move.
+//
+// Setting BLOB_NAME_INDEX in the environment starts the build at
+// finitialize(). It stops at ffinalize(); the index isn't persisted.
+
+#pragma once
+
+#include <stdint.h>
+
+namespace g {
+
+// Starts building the index. Returns false if one is built or being built,
+// or if the directory is being resharded. A reshard started while it is
+// being built abandons it. With |background| false it is built before it
+// returns.
+bool fname_index(bool background = true);
+
+// Whether fopen() is using the index.
+bool fname_index_ready();
+
+// Names in the index and heap bytes it uses, 0 until it is ready.
+uint64_t fname_index_names();
+uint64_t fname_index_bytes();
+
+}  // namespace g
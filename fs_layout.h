@@ -0,0 +1,265 @@
+// fs_layout.h
+//
+// On-disk format of the filesystem in answer_1.cc: the META_DISK blob, the
+// block headers and the directory and control blocks. Shared with the tools
+// that read volumes directly. See answer_1.cc for the design.
+
+#pragma once
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <string>
+
+#include "blob.h"
+#include "filesys.h"
+
+// FNV-1a hash for 32 bits.
+class fnv32 {
+ public:
+  static constexpr uint32_t FNV_INIT  = 0x811c9dc5UL;
+  static constexpr uint32_t FNV_32_PRIME = 0x01000193UL;
+
+  uint32_t operator()(const std::string &buf, uint32_t init = FNV_INIT) {
+    return operator()(buf.c_str(), buf.length(), init);
+  }
+
+  uint32_t operator()(const char* buf, size_t len, uint32_t init = FNV_INIT) {
+    auto bp = reinterpret_cast<const unsigned char *>(buf);
+    const unsigned char *be = bp + len;                                     
+
+    uint32_t hval = init;
+
+    while (bp < be) {
+      hval ^= static_cast<uint32_t>(*bp++);
+      hval *= FNV_32_PRIME;
+    }
+
+    return hval;
+  }
+};
+
+namespace g {
+
+constexpr uint32_t META_RESERVED = 1u;
+constexpr uint32_t DIR_HEADS = (1u << 10);
+
+constexpr char magic[16] = "vdisk2021-00001";
+
+inline uint32_t name_to_dir_id(const std::string& name) {
+  return (fnv32()(name)% DIR_HEADS) + META_RESERVED;
+}
+
+// A directory hash table: bucket b is the chain headed by blob |base| + b,
+// and its chain index is blob |index| + b.
+struct DirGeometry {
+  uint64_t base;
+  uint64_t heads;   // 0 for no table.
+  uint64_t index;   // 0 for tables made without chain indexes.
+
+  uint64_t bucket(const std::string& name) const {
+    return fnv32()(name) % heads;
+  }
+
+  uint64_t head_id(const std::string& name) const {
+    return base + bucket(name);
+  }
+
+  // Chain index of the bucket headed by |head_id|, or 0.
+  uint64_t index_id(uint64_t head_id) const {
+    return index ? index + (head_id - base) : 0;
+  }
+
+  // Whether |id| is one of the table's heads or chain indexes, and if so
+  // of which bucket.
+  bool bucket_of(uint64_t id, uint64_t* bucket) const {
+    if (id - base < heads) {
+      *bucket = id - base;
+      return true;
+    }
+    if (index && id - index < heads) {
+      *bucket = id - index;
+      return true;
+    }
+    return false;
+  }
+};
+
+// Metadata blob ids of a volume split in partitions (fs_volume.h) have
+// their partition from this bit up, except for the directory tables',
+// which are in the partition of their bucket. Partition 0's don't.
+constexpr int PARTITION_SHIFT = 40;
+
+// Partition of bucket |bucket| of a table of |heads|, out of |parts|.
+// Each gets an even range of buckets, and so of name hashes.
+inline uint64_t bucket_partition(uint64_t bucket, uint64_t heads,
+                                 uint64_t parts) {
+  return bucket * parts / heads;
+}
+
+constexpr uint64_t META_VERSION = 5;
+
+struct META_DISK {
+  char magic[16];
+  uint64_t version;
+  uint64_t next_free;
+  // Version 2 on. Version 1 volumes have DIR_HEADS heads at META_RESERVED,
+  // i.e. name_to_dir_id(). Version 2 tables have no chain indexes. Before
+  // version 4 every DirBlock holds raw FileEntry records.
+  DirGeometry dir;
+  // While the directory is being resharded into |dir|, the table it is
+  // moving out of. Its buckets below |swept| are known to be empty.
+  // old_dir.heads is 0 the rest of the time.
+  DirGeometry old_dir;
+  uint64_t swept;
+  // Version 5 on. Data blobs are allocated apart from metadata, from here.
+  uint64_t next_data;
+};
+
+constexpr size_t META_DISK_V1_SIZE = offsetof(META_DISK, dir);
+
+struct META_DISK_V2 {
+  char magic[16];
+  uint64_t version;
+  uint64_t next_free;
+  uint64_t dir[2];
+  uint64_t old_dir[2];
+  uint64_t swept;
+};
+
+// Reads blob 0's |bytes| into |meta|, upgraded to META_VERSION. Returns
+// false if they aren't a volume's.
+inline bool read_meta(const Data& bytes, META_DISK* meta) {
+  *meta = META_DISK {};
+  if (bytes.size() < META_DISK_V1_SIZE) {
+    return false;
+  }
+  memcpy(meta, &bytes[0], std::min(bytes.size(), sizeof(META_DISK)));
+  if (strcmp(meta->magic, magic) != 0) {
+    return false;
+  }
+  if (meta->version == 1) {
+    meta->dir = DirGeometry {META_RESERVED, DIR_HEADS, 0};
+  } else if (meta->version == 2) {
+    META_DISK_V2 v2 = {};
+    memcpy(&v2, &bytes[0], std::min(bytes.size(), sizeof(v2)));
+    meta->dir = DirGeometry {v2.dir[0], v2.dir[1], 0};
+    meta->old_dir = DirGeometry {v2.old_dir[0], v2.old_dir[1], 0};
+    meta->swept = v2.swept;
+  } else if (meta->version < 3 || meta->version > META_VERSION) {
+    return false;
+  }
+  if (meta->version < 5) {
+    meta->next_data = 1;
+  }
+  meta->version = META_VERSION;
+  return true;
+}
+
+enum class BlocTypes : uint32_t {
+  None,
+  Control,
+  Dir,
+  Data,
+  Index
+};
+
+enum class Flags : uint32_t {
+  None,
+  New,
+  Packed,
+  Cold
+};
+
+// Data blob ids have this bit and come from META_DISK::next_data, so they
+// never collide with metadata ids even when both are on one store. Data
+// written before version 5 came from next_free and doesn't have it.
+constexpr uint64_t DATA_SPACE = 1ull << 61;
+
+// Data blob ids with this bit set too are on the volume's cold tier (see
+// fs_tiers.h). The rest of the id is still one next_data handed out, so
+// ids stay unique across tiers.
+constexpr uint64_t COLD_TIER = 1ull << 62;
+
+struct BlockHeader {
+  BlocTypes type;
+  Flags flags;
+  uint64_t prev;
+  uint64_t next;
+};
+
+// A file's first control block has Flags::Cold once its data was moved to
+// the cold tier, and keeps the file's |heat|, a count of recent opens that
+// halves at every migrator pass. |start| and |heat| used to be one 64-bit
+// |start|, with no version bump: the layout is little-endian and a chain
+// never reaches 2^32 control blocks, so on older volumes |start| reads the
+// same and |heat| reads 0.
+struct ControlBlock : public BlockHeader {
+  typedef uint64_t Record;
+  static constexpr auto btype = BlocTypes::Control;
+  uint64_t directory;
+  uint32_t start;
+  uint32_t heat;
+  Record blobs[0];
+
+  // Find data block starting at |pos|.
+  uint64_t find(size_t pos, size_t blob_sz) const {
+    auto count = (blob_sz - sizeof(*this)) / sizeof(Record);
+    auto ix = pos / MaxBlobSize;
+    if (ix >= count) {
+      return 0;
+    }
+    return blobs[ix];
+  }
+};
+
+static_assert(sizeof(ControlBlock) == (5 * 8u));
+static constexpr size_t bytes_per_ctrl_block =
+  MaxBlobSize * ((MaxBlobSize - sizeof(ControlBlock))/ sizeof(ControlBlock::Record));
+
+struct FileEntry {
+  char name[MAX_PATH];
+  uint64_t control_blob;
+};
+
+// A directory block is read and written through dir_block.h. Blocks with
+// Flags::None hold FileEntry records in creation order, and blank records
+// where entries were moved out. Blocks with Flags::Packed hold a PackedDir.
+struct DirBlock : public BlockHeader {
+  typedef FileEntry Record;
+  static constexpr auto btype = BlocTypes::Dir;
+  Record entries[0];
+};
+
+static_assert(sizeof(DirBlock) == (3 * 8u));
+
+// The names of a packed directory block, sorted and front-coded. After
+// this header come |restarts| uint32_t offsets, from the end of the
+// offsets, of every DIR_RESTART-th entry, and then the entries:
+//
+//   varint shared    bytes of the name equal to the previous one's,
+//   varint suffix    bytes that follow,
+//   suffix bytes
+//   varint control_blob
+//
+// An entry at a restart offset shares nothing, so a lookup can binary
+// search the restarts and decode a single group.
+struct PackedDir {
+  uint32_t count;
+  uint32_t restarts;
+};
+
+constexpr uint32_t DIR_RESTART = 16;
+
+// Ids of the blocks chained after a bucket's head, in chain order, so that
+// a lookup can fetch them all without following |next| one Get at a time.
+// Only a hint: the chain itself is the truth.
+struct ChainIndex : public BlockHeader {
+  typedef uint64_t Record;
+  static constexpr auto btype = BlocTypes::Index;
+  Record blocks[0];
+};
+
+}  // namespace g
@@ -0,0 +1,486 @@
+// fs_preload.cc
+//
+// LD_PRELOAD shim that runs unmodified programs on top of filesys.h.
+//
+// POSIX calls on paths under BLOB_FS_PREFIX (default "/blobfs/") go to the
+// g:: API, the file name being the rest of the path; everything else passes
+// through to libc. Files opened through the shim get a real descriptor on
+// /dev/null as a placeholder, so their numbers can't collide with the
+// program's other descriptors, and a table maps it to the g::FILE.
+//
+//   LD_PRELOAD=out/libfs_preload.so BLOB_FS_PREFIX=/blobfs/ some-program
+//
+// Covered: open, open64, openat, openat64 (absolute paths), creat, close,
+// dup, dup2, dup3, read, write, pread, pwrite, lseek (and their 64-bit
+// names), fsync, fdatasync and unlink. The volume lives as long as the
+// process, like everything on the toy store.
+//
+// Not covered, and left to libc on the placeholder: fstat, mmap, fcntl
+// (F_DUPFD included) and ftruncate. stdio's fopen() opens with an internal
+// call the shim can't see. There is no file size in the API, so O_APPEND
+// and SEEK_END fail with ENOTSUP and EINVAL. Nor can the API truncate: its
+// fopen(name, "w") keeps the old bytes, so O_TRUNC on an existing file
+// fails with EINVAL instead of leaving them there. g::fseek() takes any
+// position, so lseek(), pread() and pwrite() check for negative ones and
+// fail with EINVAL, as the kernel does.
+
+#undef _FORTIFY_SOURCE
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "blob.h"
+#include "filesys.h"
+
+namespace {
+
+using OpenFn = int (*)(const char*, int, ...);
+using OpenatFn = int (*)(int, const char*, int, ...);
+using CloseFn = int (*)(int);
+using ReadFn = ssize_t (*)(int, void*, size_t);
+using WriteFn = ssize_t (*)(int, const void*, size_t);
+using PreadFn = ssize_t (*)(int, void*, size_t, off_t);
+using PwriteFn = ssize_t (*)(int, const void*, size_t, off_t);
+using LseekFn = off_t (*)(int, off_t, int);
+using SyncFn = int (*)(int);
+using UnlinkFn = int (*)(const char*);
+using DupFn = int (*)(int);
+using Dup2Fn = int (*)(int, int);
+using Dup3Fn = int (*)(int, int, int);
+
+template <typename Fn>
+Fn next_fn(const char* name) {
+  return reinterpret_cast<Fn>(dlsym(RTLD_NEXT, name));
+}
+
+// The libc functions the shim stands in front of.
+struct Libc {
+  OpenFn open = next_fn<OpenFn>("open");
+  OpenatFn openat = next_fn<OpenatFn>("openat");
+  CloseFn close = next_fn<CloseFn>("close");
+  ReadFn read = next_fn<ReadFn>("read");
+  WriteFn write = next_fn<WriteFn>("write");
+  PreadFn pread = next_fn<PreadFn>("pread");
+  PwriteFn pwrite = next_fn<PwriteFn>("pwrite");
+  LseekFn lseek = next_fn<LseekFn>("lseek");
+  SyncFn fsync = next_fn<SyncFn>("fsync");
+  SyncFn fdatasync = next_fn<SyncFn>("fdatasync");
+  UnlinkFn unlink = next_fn<UnlinkFn>("unlink");
+  DupFn dup = next_fn<DupFn>("dup");
+  Dup2Fn dup2 = next_fn<Dup2Fn>("dup2");
+  Dup3Fn dup3 = next_fn<Dup3Fn>("dup3");
+};
+
+const Libc& libc() {
+  static const Libc fns;
+  return fns;
+}
+
+const std::string& prefix() {
+  static const std::string p = [] {
+    auto env = getenv("BLOB_FS_PREFIX");
+    return std::string(env && *env ? env : "/blobfs/");
+  }();
+  return p;
+}
+
+// Name in the volume for |path|, or nullptr if the shim doesn't own it.
+const char* volume_name(const char* path) {
+  auto& p = prefix();
+  if (!path || strncmp(path, p.c_str(), p.size()) != 0 || !path[p.size()]) {
+    return nullptr;
+  }
+  return path + p.size();
+}
+
+// One per open(); descriptors dup()ed from it share it, cursor included.
+struct OpenFile {
+  OpenFile(g::FILE* file, int flags) : file(file), flags(flags) {}
+  ~OpenFile() { g::fclose(file); }
+
+  OpenFile(const OpenFile&) = delete;
+  OpenFile& operator=(const OpenFile&) = delete;
+
+  g::FILE* const file;
+  const int flags;
+};
+
+// The g:: API is single threaded; every call into it holds |mutex|, and so
+// does every use of |files|.
+//
+// The threads behind the API (I/O workers, say) make libc calls of their
+// own while a caller holds |mutex| and waits for them. Those must pass
+// through without touching it, which is what |owned_fds| is for: it says
+// lock-free whether a descriptor is the shim's.
+std::mutex mutex;
+bool initialized = false;
+std::unordered_map<int, std::shared_ptr<OpenFile>> files;
+
+constexpr int kMaxFds = 1 << 16;
+std::atomic<bool> owned_fds[kMaxFds];
+
+bool owned(int fd) {
+  return fd >= 0 && fd < kMaxFds &&
+         owned_fds[fd].load(std::memory_order_acquire);
+}
+
+void finalize() {
+  std::lock_guard<std::mutex> lock(mutex);
+  files.clear();
+  g::ffinalize();
+}
+
+void init_locked() {
+  if (!initialized) {
+    // The toy store's dumps would end up in the program's output.
+    setenv("BLOB_QUIET", "1", 0);
+    g::finitialize();
+    // Registered after anything finitialize() set up, so it runs before
+    // those are destroyed.
+    atexit(finalize);
+    initialized = true;
+  }
+}
+
+OpenFile* find_locked(int fd) {
+  auto it = files.find(fd);
+  return it == files.end() ? nullptr : it->second.get();
+}
+
+// Whether open() was passed a mode, as libc decides it.
+bool needs_mode(int flags) {
+  return (flags & O_CREAT) || (flags & O_TMPFILE) == O_TMPFILE;
+}
+
+int fail(int error) {
+  errno = error;
+  return -1;
+}
+
+int shim_open(const char* name, int flags) {
+  if (flags & O_APPEND) {
+    return fail(ENOTSUP);
+  }
+  std::lock_guard<std::mutex> lock(mutex);
+  init_locked();
+  // "r" needs the file to exist, "w" creates it.
+  auto file = g::fopen(name, "r");
+  if (file && (flags & O_CREAT) && (flags & O_EXCL)) {
+    g::fclose(file);
+    return fail(EEXIST);
+  }
+  bool truncate = (flags & O_TRUNC) && (flags & O_ACCMODE) != O_RDONLY;
+  if (file && truncate) {
+    g::fclose(file);
+    return fail(EINVAL);
+  }
+  if (!file && (flags & O_CREAT)) {
+    file = g::fopen(name, "w");
+  }
+  if (!file) {
+    return fail(ENOENT);
+  }
+  int fd = libc().open("/dev/null", O_RDONLY | O_CLOEXEC);
+  if (fd < 0 || fd >= kMaxFds) {
+    if (fd >= 0) {
+      libc().close(fd);
+    }
+    g::fclose(file);
+    return fail(EMFILE);
+  }
+  files[fd] = std::make_shared<OpenFile>(file, flags);
+  owned_fds[fd].store(true, std::memory_order_release);
+  return fd;
+}
+
+// g::fread() and g::fwrite() handle one blob per call; split at the blob
+// boundaries and loop.
+ssize_t read_locked(OpenFile* f, char* buffer, size_t count) {
+  if ((f->flags & O_ACCMODE) == O_WRONLY) {
+    return fail(EBADF);
+  }
+  size_t done = 0;
+  while (done != count) {
+    long pos = g::ftell(f->file);
+    long n = std::min<long>(count - done, MaxBlobSize - pos % MaxBlobSize);
+    n = g::fread(f->file, buffer + done, n);
+    if (n < 0) {
+      return done ? done : fail(EIO);
+    }
+    done += n;
+    if (n == 0 || (pos + n) % MaxBlobSize != 0) {
+      break;
+    }
+  }
+  return done;
+}
+
+ssize_t write_locked(OpenFile* f, const char* buffer, size_t count) {
+  if ((f->flags & O_ACCMODE) == O_RDONLY) {
+    return fail(EBADF);
+  }
+  size_t done = 0;
+  while (done != count) {
+    long pos = g::ftell(f->file);
+    long n = std::min<long>(count - done, MaxBlobSize - pos % MaxBlobSize);
+    n = g::fwrite(f->file, buffer + done, n);
+    if (n <= 0) {
+      return done ? done : fail(EIO);
+    }
+    done += n;
+  }
+  return done;
+}
+
+// Makes |new_fd|, which the kernel just made a duplicate of |fd|, share
+// |fd|'s file. Whatever |new_fd| was before is closed.
+int dup_locked(int fd, int new_fd) {
+  if (new_fd < 0 || new_fd == fd) {
+    return new_fd;
+  }
+  files.erase(new_fd);
+  owned_fds[new_fd].store(false, std::memory_order_release);
+  auto it = files.find(fd);
+  if (it == files.end()) {
+    return new_fd;
+  }
+  if (new_fd >= kMaxFds) {
+    libc().close(new_fd);
+    return fail(EMFILE);
+  }
+  files[new_fd] = it->second;
+  owned_fds[new_fd].store(true, std::memory_order_release);
+  return new_fd;
+}
+
+off_t lseek_locked(OpenFile* f, off_t offset, int whence) {
+  off_t position;
+  if (whence == SEEK_SET) {
+    position = offset;
+  } else if (whence == SEEK_CUR) {
+    // g::fseek() takes any position, so the shim checks.
+    if (__builtin_add_overflow(g::ftell(f->file), offset, &position)) {
+      return fail(EOVERFLOW);
+    }
+  } else {
+    return fail(EINVAL);
+  }
+  if (position < 0 || g::fseek(f->file, position, 0) < 0) {
+    return fail(EINVAL);
+  }
+  return g::ftell(f->file);
+}
+
+}  // namespace
+
+extern "C" {
+
+int open(const char* path, int flags, ...) {
+  mode_t mode = 0;
+  if (needs_mode(flags)) {
+    va_list args;
+    va_start(args, flags);
+    mode = va_arg(args, mode_t);
+    va_end(args);
+  }
+  if (auto name = volume_name(path)) {
+    return shim_open(name, flags);
+  }
+  return libc().open(path, flags, mode);
+}
+
+int open64(const char* path, int flags, ...) {
+  mode_t mode = 0;
+  if (needs_mode(flags)) {
+    va_list args;
+    va_start(args, flags);
+    mode = va_arg(args, mode_t);
+    va_end(args);
+  }
+  return open(path, flags, mode);
+}
+
+int openat(int dirfd, const char* path, int flags, ...) {
+  mode_t mode = 0;
+  if (needs_mode(flags)) {
+    va_list args;
+    va_start(args, flags);
+    mode = va_arg(args, mode_t);
+    va_end(args);
+  }
+  // The prefix is absolute, so |dirfd| never matters for the shim's paths.
+  if (auto name = volume_name(path)) {
+    return shim_open(name, flags);
+  }
+  return libc().openat(dirfd, path, flags, mode);
+}
+
+int openat64(int dirfd, const char* path, int flags, ...) {
+  mode_t mode = 0;
+  if (needs_mode(flags)) {
+    va_list args;
+    va_start(args, flags);
+    mode = va_arg(args, mode_t);
+    va_end(args);
+  }
+  return openat(dirfd, path, flags, mode);
+}
+
+int creat(const char* path, mode_t mode) {
+  return open(path, O_CREAT | O_WRONLY | O_TRUNC, mode);
+}
+
+int close(int fd) {
+  if (owned(fd)) {
+    std::lock_guard<std::mutex> lock(mutex);
+    files.erase(fd);
+    owned_fds[fd].store(false, std::memory_order_release);
+  }
+  return libc().close(fd);
+}
+
+int dup(int fd) {
+  if (owned(fd)) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return dup_locked(fd, libc().dup(fd));
+  }
+  return libc().dup(fd);
+}
+
+int dup2(int fd, int new_fd) {
+  if (owned(fd) || owned(new_fd)) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return dup_locked(fd, libc().dup2(fd, new_fd));
+  }
+  return libc().dup2(fd, new_fd);
+}
+
+int dup3(int fd, int new_fd, int flags) {
+  if (owned(fd) || owned(new_fd)) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return dup_locked(fd, libc().dup3(fd, new_fd, flags));
+  }
+  return libc().dup3(fd, new_fd, flags);
+}
+
+ssize_t read(int fd, void* buffer, size_t count) {
+  if (owned(fd)) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (auto f = find_locked(fd)) {
+      return read_locked(f, static_cast<char*>(buffer), count);
+    }
+  }
+  return libc().read(fd, buffer, count);
+}
+
+ssize_t write(int fd, const void* buffer, size_t count) {
+  if (owned(fd)) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (auto f = find_locked(fd)) {
+      return write_locked(f, static_cast<const char*>(buffer), count);
+    }
+  }
+  return libc().write(fd, buffer, count);
+}
+
+ssize_t pread(int fd, void* buffer, size_t count, off_t offset) {
+  if (owned(fd)) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (auto f = find_locked(fd)) {
+      long pos = g::ftell(f->file);
+      if (offset < 0 || g::fseek(f->file, offset, 0) < 0) {
+        return fail(EINVAL);
+      }
+      auto rc = read_locked(f, static_cast<char*>(buffer), count);
+      g::fseek(f->file, pos, 0);
+      return rc;
+    }
+  }
+  return libc().pread(fd, buffer, count, offset);
+}
+
+ssize_t pwrite(int fd, const void* buffer, size_t count, off_t offset) {
+  if (owned(fd)) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (auto f = find_locked(fd)) {
+      long pos = g::ftell(f->file);
+      if (offset < 0 || g::fseek(f->file, offset, 0) < 0) {
+        return fail(EINVAL);
+      }
+      auto rc = write_locked(f, static_cast<const char*>(buffer), count);
+      g::fseek(f->file, pos, 0);
+      return rc;
+    }
+  }
+  return libc().pwrite(fd, buffer, count, offset);
+}
+
+off_t lseek(int fd, off_t offset, int whence) {
+  if (owned(fd)) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (auto f = find_locked(fd)) {
+      return lseek_locked(f, offset, whence);
+    }
+  }
+  return libc().lseek(fd, offset, whence);
+}
+
+// off_t is 64 bits on the LP64 targets this builds for, so the 64-bit
+// names are the same calls.
+ssize_t pread64(int fd, void* buffer, size_t count, off_t offset) {
+  return pread(fd, buffer, count, offset);
+}
+
+ssize_t pwrite64(int fd, const void* buffer, size_t count, off_t offset) {
+  return pwrite(fd, buffer, count, offset);
+}
+
+off_t lseek64(int fd, off_t offset, int whence) {
+  return lseek(fd, offset, whence);
+}
+
+// Puts are synchronous, there is nothing to flush.
+int fsync(int fd) {
+  if (owned(fd)) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (find_locked(fd)) {
+      return 0;
+    }
+  }
+  return libc().fsync(fd);
+}
+
+int fdatasync(int fd) {
+  if (owned(fd)) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (find_locked(fd)) {
+      return 0;
+    }
+  }
+  return libc().fdatasync(fd);
+}
+
+int unlink(const char* path) {
+  if (auto name = volume_name(path)) {
+    std::lock_guard<std::mutex> lock(mutex);
+    init_locked();
+    // g::fremove() is still a stub.
+    return g::fremove(name) < 0 ? fail(ENOSYS) : 0;
+  }
+  return libc().unlink(path);
+}
+
+}  // extern "C"
@@ -0,0 +1,28 @@
+// fs_reshard.h
+//
+// Online resharding of the directory for the filesys.h implementation. Not
+// part of the interview API.
+//
+// Names hash into a fixed table of bucket chains, DIR_HEADS of them on a new
+// volume, and chains grow long as files are added. fdir_reshard() moves the
+// volume to a bigger table while it stays in use: names hash into the new
+// table right away, fopen() falls back to the old one for names that
+// haven't moved and moves them, and a background sweeper moves the rest.
+// Progress is kept in the volume, so a sweep interrupted by ffinalize()
+// resumes at the next finitialize().
+
+#pragma once
+
+#include <stdint.h>
+
+namespace g {
+
+// Starts moving the directory to a table of |heads| buckets. Returns false
+// if |heads| is 0 or a reshard is already running. With |background| false
+// the sweep is done before it returns.
+bool fdir_reshard(uint32_t heads, bool background = true);
+
+// Buckets of the old table not swept yet, 0 if no reshard is running.
+uint64_t fdir_reshard_pending();
+
+}  // namespace g
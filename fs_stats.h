@@ -0,0 +1,80 @@
+// fs_stats.h
+//
+// Statistics for the filesys.h implementation. Not part of the interview
+// API; benchmarks and tools use it to see where the time goes.
+
+#pragma once
+
+#include <stdint.h>
+#include <cstddef>
+
+namespace g {
+
+// Instrumented operations: the API calls plus the hot paths under them.
+enum class Op : uint32_t {
+  Open,
+  Read,
+  Write,
+  DirFind,      // One dir_find(), i.e. searching one directory blob.
+  GetDataBlob,
+};
+
+constexpr size_t kOps = 5;
+
+const char* op_name(Op op);
+
+struct OpStats {
+  uint64_t calls;
+  // Blob buffer allocations and bytes copied, over all calls. Only counted
+  // in builds with BLOB_ACCOUNTING, see alloc_stats.h.
+  uint64_t allocs;
+  uint64_t alloc_bytes;
+  uint64_t copy_bytes;
+  // Blob traffic over all calls, as asked of the cache (logical) and as
+  // issued to the backing store. See io_counters.h.
+  uint64_t gets;
+  uint64_t get_bytes;
+  uint64_t puts;
+  uint64_t put_bytes;
+  uint64_t store_gets;
+  uint64_t store_get_bytes;
+  uint64_t store_puts;
+  uint64_t store_put_bytes;
+  // The fields below only cover the sampled calls.
+  uint64_t sampled;
+  uint64_t nanos;
+  uint64_t instructions;
+  uint64_t cache_misses;
+  uint64_t branch_misses;
+};
+
+struct Stats {
+  OpStats ops[kOps];
+  // Of the metadata and data caches together.
+  uint64_t cache_hits;
+  uint64_t cache_misses;
+  uint64_t cache_coalesced;
+  uint64_t cache_evictions;
+  uint64_t cache_rejected;    // Evictions of blobs refused admission.
+  // Of the data cache alone, also counted above, to tell whether bulk data
+  // traffic costs metadata its cached blocks.
+  uint64_t data_cache_hits;
+  uint64_t data_cache_misses;
+};
+
+// Turns counting Stats::ops on or off. It is off by default, so the API
+// calls don't pay for it unless a benchmark or tool asks.
+void fop_stats(bool enabled);
+
+// Measures one in |sample_every| calls of each operation with a
+// perf_event_open() counter group (instructions, cache misses, branch
+// misses) on the calling thread. 0 turns sampling off. Returns false if the
+// counters can't be opened, e.g. perf_event_paranoid or a container forbids
+// it; wall time is still sampled in that case. Sampling turns fop_stats()
+// on.
+bool fperf_counters(uint32_t sample_every);
+
+void fstats(Stats* stats);
+void fstats_reset();
+
+}  // namespace g
@@ -0,0 +1,48 @@
+// fs_tiers.h
+//
+// Hot and cold data tiers for the filesys.h implementation. Not part of
+// the interview API.
+//
+// With a cold store configured (fs_volume.h), fopen() counts opens per
+// file in memory. A migrator pass folds those into the heat kept in each
+// file's first control block, halving what was there, so heat decays
+// unless the file keeps being opened. Files whose heat drops to 0 have
+// their data blobs copied to the cold store, and files that become hot
+// again get theirs copied back. Each control block is then rewritten with
+// the new ids in a single Put, and the old copies blanked: a crash at any
+// point leaves every file reading its whole data, at worst with copies
+// leaked. Metadata always stays on the metadata store.
+//
+// Data is copied without holding up the API, a file at a time. Files open
+// while a pass reaches them keep their data where it is, as open streams
+// hold their ids, and so do files opened while theirs was being copied. Blobs written to a cold file land on the
+// data store and stay there until the file is demoted again.
+
+#pragma once
+
+#include <stdint.h>
+
+namespace g {
+
+// Opens since the last pass at which a file is promoted back; heat halves
+// each pass, so this many in one period, or more over a few.
+constexpr uint32_t TIER_HOT_HEAT = 4;
+
+struct TierStats {
+  uint64_t passes;
+  uint64_t promoted;     // Files.
+  uint64_t demoted;      // Files.
+  uint64_t blobs_moved;  // Data blobs copied, either way.
+};
+
+// Runs a pass over every file. Returns false if there is no cold store or
+// the directory is being resharded, which moves the entries a pass walks.
+bool ftier_pass();
+
+// Runs a pass every |period_ms| in the background until ffinalize().
+// Returns false if there is no cold store or it is already running.
+bool ftier_start(uint32_t period_ms);
+
+void ftier_stats(TierStats* stats);
+
+}  // namespace g
@@ -0,0 +1,44 @@
+// fs_volume.h
+//
+// Where the filesys.h implementation keeps a volume's blobs. Not part of
+// the interview API.
+//
+// Metadata (META_DISK, directory, index and control blocks) and file data
+// are allocated from separate id ranges and go through separate caches and
+// I/O schedulers, so lookups never wait behind bulk reads and writes, nor
+// lose their cached blocks to them. By default both are on GetBlobStore().
+// fset_volume_stores() puts them on other stores, and must be called
+// before finitialize(); it applies to every volume mounted after it, and a
+// volume has to be mounted with the stores it was written with.
+//
+// Metadata can be split further, in partitions: each takes an even range
+// of the directory's buckets, by name hash, and holds those buckets' blocks
+// and the control blocks of their files, on its own store behind its own
+// cache and scheduler. Requests to different partitions then queue and run
+// apart, and a volume's metadata throughput grows with their number.
+
+#pragma once
+
+#include <vector>
+
+#include "blob.h"
+
+namespace g {
+
+struct VolumeStores {
+  // Low latency store for metadata, and partition 0. Null for
+  // GetBlobStore().
+  BlobStore* meta = nullptr;
+  // Stores of partitions 1 on. Partitions can share a store.
+  std::vector<BlobStore*> partitions;
+  // Bulk store for file data. Null for GetBlobStore(). Data written by
+  // volumes older than the split stays on |meta|.
+  BlobStore* data = nullptr;
+  // Cheap store that the tier migrator (fs_tiers.h) moves the data of cold
+  // files to. Null for none.
+  BlobStore* cold = nullptr;
+};
+
+void fset_volume_stores(const VolumeStores& stores);
+
+}  // namespace g
@@ -0,0 +1,57 @@
+// io_counters.h
+//
+// Process-wide blob traffic counters, kept at two levels of the store stack:
+//
+//   logical  what the filesystem asks for, counted by the blob caches.
+//   store    what reaches the backing store, counted by the I/O schedulers.
+//
+// The ratio between the two, and between either and the bytes the
+// application read or wrote, is the amplification the filesystem adds.
+// fs_stats attributes both to the g:: call that was running.
+
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+#include <cstddef>
+
+struct IoCounters {
+  uint64_t gets;
+  uint64_t get_bytes;
+  uint64_t puts;
+  uint64_t put_bytes;
+};
+
+namespace io_counters {
+
+struct Level {
+  std::atomic<uint64_t> gets{0};
+  std::atomic<uint64_t> get_bytes{0};
+  std::atomic<uint64_t> puts{0};
+  std::atomic<uint64_t> put_bytes{0};
+
+  void count_get(size_t bytes) {
+    gets.fetch_add(1, std::memory_order_relaxed);
+    get_bytes.fetch_add(bytes, std::memory_order_relaxed);
+  }
+
+  void count_put(size_t bytes) {
+    puts.fetch_add(1, std::memory_order_relaxed);
+    put_bytes.fetch_add(bytes, std::memory_order_relaxed);
+  }
+
+  IoCounters read() const {
+    return IoCounters {
+      gets.load(std::memory_order_relaxed),
+      get_bytes.load(std::memory_order_relaxed),
+      puts.load(std::memory_order_relaxed),
+      put_bytes.load(std::memory_order_relaxed),
+    };
+  }
+};
+
+inline Level logical;
+inline Level store;
+
+}  // namespace io_counters
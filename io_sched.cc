@@ -0,0 +1,399 @@
+// io_sched.cc
+//
+// See io_sched.h. One mutex guards the per-class queues; store calls and
+// completions always run with it released.
+
+#include "io_sched.h"
+
+#include <algorithm>
+#include <future>
+
+#include "io_counters.h"
+#include "numa.h"
+
+using namespace std::chrono_literals;
+
+namespace {
+
+// Foreground gets short deadlines and the bulk of each round. Background
+// classes get long deadlines but a guaranteed slice, so they progress even
+// when the foreground never goes idle.
+constexpr IoClassConfig kDefaultConfig[kIoClasses] = {
+  { 2000us, 8 },     // FgRead
+  { 5000us, 8 },     // FgWrite
+  { 20000us, 2 },    // Readahead
+  { 100000us, 2 },   // Flush
+  { 1000000us, 1 },  // Maintenance
+};
+
+// Prefetched blobs SchedStore keeps around waiting to be claimed.
+constexpr size_t kMaxReady = 32;
+
+size_t ix(IoClass cls) { return static_cast<size_t>(cls); }
+
+}  // namespace
+
+struct IoScheduler::Op {
+  enum Kind { Get, Put };
+  Kind kind;
+  IoClass cls;
+  uint64_t id;
+  Handle blob;
+  const Data* data;
+  IoClock::time_point submitted;
+  Key key;
+  std::vector<Completion> done;
+};
+
+uint64_t IoClassStats::percentile(double pct) const {
+  uint64_t total = 0;
+  for (auto n : latency) {
+    total += n;
+  }
+  uint64_t seen = 0;
+  for (size_t b = 0; b != latency.size(); ++b) {
+    seen += latency[b];
+    if (seen && seen >= pct * total) {
+      return 1ull << (b + 1);
+    }
+  }
+  return 0;
+}
+
+IoScheduler::IoScheduler(BlobStore* inner, size_t workers, int node)
+    : inner_(inner) {
+  for (size_t c = 0; c != kIoClasses; ++c) {
+    config_[c] = kDefaultConfig[c];
+    credits_[c] = config_[c].quota;
+  }
+  for (size_t w = 0; w != std::max<size_t>(workers, 1); ++w) {
+    workers_.emplace_back(&IoScheduler::Worker, this, node);
+  }
+}
+
+IoScheduler::~IoScheduler() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  wake_.notify_all();
+  for (auto& t : workers_) {
+    t.join();
+  }
+}
+
+void IoScheduler::set_class_config(IoClass cls, const IoClassConfig& config) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  config_[ix(cls)] = config;
+  credits_[ix(cls)] = config.quota;
+}
+
+std::array<IoClassStats, kIoClasses> IoScheduler::stats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_;
+}
+
+void IoScheduler::SubmitGet(uint64_t id, IoClass cls, Completion done) {
+  auto now = IoClock::now();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = gets_.find(id);
+    if (it != gets_.end()) {
+      // Ride along with the queued fetch. It takes the more urgent class of
+      // the two, so e.g. a read never waits on readahead that gets dropped
+      // for being late, and the earlier deadline.
+      Op* op = it->second;
+      op->done.push_back(std::move(done));
+      ++stats_[ix(cls)].merged;
+      auto to = std::min(ix(cls), ix(op->cls));
+      auto deadline = std::min(now + config_[ix(cls)].slo, op->key.first);
+      if (to != ix(op->cls) || deadline != op->key.first) {
+        auto node = queues_[ix(op->cls)].extract(op->key);
+        op->cls = static_cast<IoClass>(to);
+        op->key = Key{deadline, seq_++};
+        node.key() = op->key;
+        queues_[to].insert(std::move(node));
+      }
+      return;
+    }
+  }
+
+  auto op = std::make_unique<Op>();
+  op->kind = Op::Get;
+  op->cls = cls;
+  op->id = id;
+  op->data = nullptr;
+  op->submitted = now;
+  op->done.push_back(std::move(done));
+  Enqueue(std::move(op));
+}
+
+void IoScheduler::SubmitPut(Handle blob, const Data& data, IoClass cls,
+                            Completion done) {
+  auto op = std::make_unique<Op>();
+  op->kind = Op::Put;
+  op->cls = cls;
+  op->id = 0;
+  op->blob = std::move(blob);
+  op->data = &data;
+  op->submitted = IoClock::now();
+  op->done.push_back(std::move(done));
+  Enqueue(std::move(op));
+}
+
+void IoScheduler::CancelReadahead(uint64_t id) {
+  std::unique_ptr<Op> op;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = gets_.find(id);
+    if (it == gets_.end() || it->second->cls != IoClass::Readahead ||
+        it->second->done.size() != 1) {
+      return;
+    }
+    auto key = it->second->key;
+    gets_.erase(it);
+    op = std::move(queues_[ix(IoClass::Readahead)][key]);
+    queues_[ix(IoClass::Readahead)].erase(key);
+    ++stats_[ix(IoClass::Readahead)].cancelled;
+  }
+  for (auto& done : op->done) {
+    done(nullptr, ErrCancelled);
+  }
+}
+
+void IoScheduler::Enqueue(std::unique_ptr<Op> op) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    op->key = Key{op->submitted + config_[ix(op->cls)].slo, seq_++};
+    if (op->kind == Op::Get) {
+      gets_[op->id] = op.get();
+    }
+    auto& queue = queues_[ix(op->cls)];
+    queue.emplace(op->key, std::move(op));
+  }
+  wake_.notify_one();
+}
+
+// Earliest deadline among the classes with credits left. When every class
+// that has work is out of credits a new round starts. Readahead that is
+// already late is not worth issuing and goes to |dropped|; a foreground Get
+// merged into it moved it to its own class, so nobody blocks on it.
+std::unique_ptr<IoScheduler::Op> IoScheduler::Pick(
+    IoClock::time_point now, std::vector<std::unique_ptr<Op>>* dropped) {
+  auto& ra = queues_[ix(IoClass::Readahead)];
+  while (!ra.empty() && ra.begin()->first.first < now) {
+    auto op = std::move(ra.begin()->second);
+    ra.erase(ra.begin());
+    gets_.erase(op->id);
+    ++stats_[ix(IoClass::Readahead)].cancelled;
+    dropped->push_back(std::move(op));
+  }
+
+  for (int round = 0; round != 2; ++round) {
+    Queue* best = nullptr;
+    size_t best_cls = 0;
+    for (size_t c = 0; c != kIoClasses; ++c) {
+      if (queues_[c].empty() || credits_[c] == 0) {
+        continue;
+      }
+      if (!best || queues_[c].begin()->first < best->begin()->first) {
+        best = &queues_[c];
+        best_cls = c;
+      }
+    }
+    if (best) {
+      --credits_[best_cls];
+      auto op = std::move(best->begin()->second);
+      best->erase(best->begin());
+      if (op->kind == Op::Get) {
+        gets_.erase(op->id);
+      }
+      return op;
+    }
+    for (size_t c = 0; c != kIoClasses; ++c) {
+      credits_[c] = config_[c].quota;
+    }
+  }
+  return nullptr;
+}
+
+void IoScheduler::Run(std::unique_ptr<Op> op) {
+  Handle blob;
+  int rc = 0;
+  if (op->kind == Op::Get) {
+    auto raw = inner_->GetBlob(op->id);
+    if (raw) {
+      io_counters::store.count_get(raw->Get().size());
+      blob = Handle(raw, [](Blob* b) { b->Release(); });
+    } else {
+      rc = ErrInternal;
+    }
+  } else {
+    io_counters::store.count_put(op->data->size());
+    rc = op->blob->Put(*op->data);
+  }
+
+  auto now = IoClock::now();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& st = stats_[ix(op->cls)];
+    ++st.issued;
+    if (now > op->key.first) {
+      ++st.late;
+    }
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+        now - op->submitted).count();
+    size_t bucket = 0;
+    while ((us >>= 1) && bucket < st.latency.size() - 1) {
+      ++bucket;
+    }
+    ++st.latency[bucket];
+  }
+
+  for (auto& done : op->done) {
+    done(blob, rc);
+  }
+}
+
+void IoScheduler::Worker(int node) {
+  if (node >= 0) {
+    PinThreadToNode(node);
+  }
+  std::vector<std::unique_ptr<Op>> dropped;
+  while (true) {
+    std::unique_ptr<Op> op;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      while (true) {
+        op = Pick(IoClock::now(), &dropped);
+        if (op || !dropped.empty()) {
+          break;
+        }
+        if (stop_) {
+          return;
+        }
+        wake_.wait(lock);
+      }
+    }
+    for (auto& d : dropped) {
+      for (auto& done : d->done) {
+        done(nullptr, ErrCancelled);
+      }
+    }
+    dropped.clear();
+    if (op) {
+      Run(std::move(op));
+    }
+  }
+}
+
+class SchedStore::SchedBlob final : public Blob {
+ public:
+  SchedBlob(SchedStore* store, uint64_t id, IoScheduler::Handle blob)
+      : store_(store), id_(id), blob_(std::move(blob)) {}
+
+  const Data& Get() const override { return blob_->Get(); }
+
+  int Put(const Data& data) override {
+    // A prefetched copy of this id would be stale after the write, and so
+    // would one prefetched while it runs.
+    store_->Forget(id_);
+    std::promise<int> result;
+    store_->sched_->SubmitPut(blob_, data, IoClass::FgWrite,
+        [&result](IoScheduler::Handle, int rc) { result.set_value(rc); });
+    auto rc = result.get_future().get();
+    store_->Forget(id_);
+    return rc;
+  }
+
+  int Release() override {
+    delete this;
+    return 0;
+  }
+
+ private:
+  SchedStore* const store_;
+  const uint64_t id_;
+  IoScheduler::Handle blob_;
+};
+
+SchedStore::SchedStore(IoScheduler* sched) : sched_(sched) {}
+
+SchedStore::~SchedStore() {}
+
+Blob* SchedStore::GetBlob(uint64_t id) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = std::find_if(ready_.begin(), ready_.end(),
+        [id](const auto& r) { return r.first == id; });
+    if (it != ready_.end()) {
+      auto blob = std::move(it->second);
+      ready_.erase(it);
+      return new SchedBlob(this, id, std::move(blob));
+    }
+  }
+
+  std::promise<IoScheduler::Handle> result;
+  sched_->SubmitGet(id, IoClass::FgRead,
+      [&result](IoScheduler::Handle blob, int) { result.set_value(blob); });
+  auto blob = result.get_future().get();
+  if (!blob) {
+    return nullptr;
+  }
+  return new SchedBlob(this, id, std::move(blob));
+}
+
+uint64_t SchedStore::GetFreeSpace() {
+  return sched_->inner()->GetFreeSpace();
+}
+
+void SchedStore::Prefetch(uint64_t id, IoClass cls) {
+  uint64_t generation;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& r : ready_) {
+      if (r.first == id) {
+        return;
+      }
+    }
+    auto& prefetching = prefetching_[id];
+    ++prefetching.count;
+    generation = prefetching.generation;
+  }
+  sched_->SubmitGet(id, cls,
+      [this, id, generation](IoScheduler::Handle blob, int rc) {
+        Adopt(id, generation, rc == 0 ? std::move(blob) : nullptr);
+      });
+}
+
+void SchedStore::Adopt(uint64_t id, uint64_t generation,
+                       IoScheduler::Handle blob) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = prefetching_.find(id);
+  bool current = it->second.generation == generation;
+  if (--it->second.count == 0) {
+    prefetching_.erase(it);
+  }
+  if (!blob || !current) {
+    return;
+  }
+  for (auto& r : ready_) {
+    if (r.first == id) {
+      return;
+    }
+  }
+  if (ready_.size() == kMaxReady) {
+    ready_.erase(ready_.begin());
+  }
+  ready_.emplace_back(id, std::move(blob));
+}
+
+void SchedStore::Forget(uint64_t id) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = prefetching_.find(id);
+  if (it != prefetching_.end()) {
+    ++it->second.generation;
+  }
+  ready_.erase(std::remove_if(ready_.begin(), ready_.end(),
+      [id](const auto& r) { return r.first == id; }), ready_.end());
+}
@@ -0,0 +1,152 @@
+// io_sched.h
+//
+// Deadline-aware scheduler in front of a BlobStore.
+//
+// Instead of issuing every store request inline and in arrival order, the
+// filesystem submits them here tagged with a class and a deadline. Workers
+// run earliest-deadline-first among the classes that still have quota left
+// in the current round, so foreground reads and writes are served first while
+// readahead, flush and maintenance are still guaranteed a share of the
+// dispatches. Duplicate Gets for the same id are merged into a single fetch
+// and readahead that is already past its deadline is dropped, not issued.
+//
+// The store below must be safe to call from the worker threads.
+
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "blob.h"
+
+enum class IoClass : uint32_t {
+  FgRead,
+  FgWrite,
+  Readahead,
+  Flush,
+  Maintenance,
+};
+
+constexpr size_t kIoClasses = 5;
+constexpr int ErrCancelled = -4;
+
+using IoClock = std::chrono::steady_clock;
+
+struct IoClassConfig {
+  // Relative deadline given to requests of this class.
+  std::chrono::microseconds slo;
+  // Dispatches the class may take per round while others are waiting.
+  uint32_t quota;
+};
+
+struct IoClassStats {
+  uint64_t issued;
+  uint64_t merged;
+  uint64_t cancelled;
+  uint64_t late;      // Completed after their deadline.
+  // Submit to completion latency, log2 microsecond buckets.
+  std::array<uint64_t, 32> latency;
+
+  // Upper bound in microseconds of the |pct| percentile.
+  uint64_t percentile(double pct) const;
+};
+
+class IoScheduler {
+ public:
+  // Shared blob handle, Release()d when the last owner drops it. Merged Gets
+  // all receive the same handle.
+  using Handle = std::shared_ptr<Blob>;
+  // Called on a worker thread. |blob| is null unless a Get succeeded.
+  using Completion = std::function<void(Handle blob, int rc)>;
+
+  // Workers are pinned to the cpus of |node| unless it is negative.
+  explicit IoScheduler(BlobStore* inner, size_t workers = 1, int node = -1);
+  ~IoScheduler();
+
+  IoScheduler(const IoScheduler&) = delete;
+  IoScheduler& operator=(const IoScheduler&) = delete;
+
+  // Fetches blob |id|. A Get for an id that is already queued is merged with
+  // it, and the queued one takes the more urgent class and deadline of the
+  // two. Every merged Get completes, with ErrCancelled if it was dropped.
+  void SubmitGet(uint64_t id, IoClass cls, Completion done);
+  // Stores |data| to |blob|. |data| must stay alive until |done| runs.
+  void SubmitPut(Handle blob, const Data& data, IoClass cls, Completion done);
+  // Drops a queued readahead of |id| if nobody else is waiting on it.
+  void CancelReadahead(uint64_t id);
+
+  void set_class_config(IoClass cls, const IoClassConfig& config);
+  std::array<IoClassStats, kIoClasses> stats() const;
+  BlobStore* inner() const { return inner_; }
+
+ private:
+  struct Op;
+  using Key = std::pair<IoClock::time_point, uint64_t>;
+  using Queue = std::map<Key, std::unique_ptr<Op>>;
+
+  void Enqueue(std::unique_ptr<Op> op);
+  std::unique_ptr<Op> Pick(IoClock::time_point now,
+                           std::vector<std::unique_ptr<Op>>* dropped);
+  void Run(std::unique_ptr<Op> op);
+  void Worker(int node);
+
+  BlobStore* const inner_;
+  mutable std::mutex mutex_;
+  std::condition_variable wake_;
+  bool stop_ = false;
+  uint64_t seq_ = 0;
+
+  std::array<IoClassConfig, kIoClasses> config_;
+  std::array<uint32_t, kIoClasses> credits_;
+  std::array<Queue, kIoClasses> queues_;
+  std::array<IoClassStats, kIoClasses> stats_ = {};
+  // Queued (not yet dispatched) Gets by blob id.
+  std::unordered_map<uint64_t, Op*> gets_;
+  std::vector<std::thread> workers_;
+};
+
+// BlobStore facade over an IoScheduler. GetBlob() and Blob::Put() are
+// foreground requests that block until the scheduler completes them;
+// Prefetch() queues readahead whose result is handed to the next GetBlob()
+// of the same id.
+class SchedStore final : public BlobStore {
+ public:
+  explicit SchedStore(IoScheduler* sched);
+  ~SchedStore();
+
+  Blob* GetBlob(uint64_t id) override;
+  uint64_t GetFreeSpace() override;
+
+  void Prefetch(uint64_t id, IoClass cls = IoClass::Readahead);
+  // Drops any prefetched copy of |id|, including those of prefetches still
+  // running; it is about to be or was written.
+  void Forget(uint64_t id);
+
+ private:
+  class SchedBlob;
+
+  // Prefetches of an id in flight, and its generation, which Forget()
+  // bumps.
+  struct Prefetching {
+    uint32_t count = 0;
+    uint64_t generation = 0;
+  };
+
+  // Keeps |blob|, null if the Get failed, unless |id| was forgotten since
+  // its prefetch at |generation| started.
+  void Adopt(uint64_t id, uint64_t generation, IoScheduler::Handle blob);
+
+  IoScheduler* const sched_;
+  std::mutex mutex_;
+  // Prefetched blobs waiting to be claimed, oldest first.
+  std::vector<std::pair<uint64_t, IoScheduler::Handle>> ready_;
+  std::unordered_map<uint64_t, Prefetching> prefetching_;
+};
@@ -48,6 +48,39 @@ int main() {
   TEST(rc == sizeof(data_in), rc);
   TEST(strcmp(data_out, data_in) == 0, 0);
 
+  rc = g::fclose(file_2);
+  TEST(rc == 0, rc);
+
+  // Two handles on one file see each other's writes.
+  constexpr auto shared = "shared.txt";
+  auto file_a = g::fopen(shared, "w");
+  auto file_b = g::fopen(shared, "rw");
+  TEST(file_a != nullptr && file_b != nullptr, 0);
+
+  rc = g::fread(file_b, data_out, sizeof(data_out));
+  TEST(rc == 0, rc);
+  rc = g::fwrite(file_a, "hello", 5);
+  TEST(rc == 5, rc);
+  memset(data_out, 0, sizeof(data_out));
+  rc = g::fread(file_b, data_out, sizeof(data_out));
+  TEST(rc == 5, rc);
+  TEST(strcmp(data_out, "hello") == 0, 0);
+
+  rc = g::fseek(file_b, 0, 0);
+  TEST(rc == 0, rc);
+  rc = g::fwrite(file_b, "XY", 2);
+  TEST(rc == 2, rc);
+  g::fclose(file_a);
+  g::fclose(file_b);
+
+  auto file_c = g::fopen(shared, "r");
+  TEST(file_c != nullptr, 0);
+  memset(data_out, 0, sizeof(data_out));
+  rc = g::fread(file_c, data_out, sizeof(data_out));
+  TEST(rc == 5, rc);
+  TEST(strcmp(data_out, "XYllo") == 0, 0);
+  g::fclose(file_c);
+
   g::ffinalize();
   printf("succesful run\n");
   return 0;
@@ -0,0 +1,143 @@
+// name_index.cc
+//
+// See name_index.h.
+
+#include "name_index.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "filesys.h"
+#include "varint.h"
+
+namespace g {
+
+NameIndex::NameIndex(std::vector<DirEntry> entries) {
+  std::sort(entries.begin(), entries.end(),
+            [](const DirEntry& a, const DirEntry& b) {
+              return a.name < b.name;
+            });
+  count_ = entries.size();
+  if (count_) {
+    auto& first = entries.front().name;
+    auto& last = entries.back().name;
+    size_t n = 0;
+    while (n != std::min(first.size(), last.size()) && first[n] == last[n]) {
+      ++n;
+    }
+    prefix_ = first.substr(0, n);
+  }
+  restarts_.reserve((count_ + kGroup - 1) / kGroup);
+  keys_.reserve(restarts_.capacity());
+  uint8_t varints[30];
+  for (size_t ix = 0; ix != count_; ++ix) {
+    auto& name = entries[ix].name;
+    size_t shared = 0;
+    if (ix % kGroup == 0) {
+      restarts_.push_back(data_.size());
+      keys_.push_back(Key(name));
+    } else {
+      auto& prev = entries[ix - 1].name;
+      auto n = std::min(prev.size(), name.size());
+      while (shared != n && prev[shared] == name[shared]) {
+        ++shared;
+      }
+    }
+    auto p = put_varint(varints, shared);
+    p = put_varint(p, name.size() - shared);
+    data_.insert(data_.end(), varints, p);
+    data_.insert(data_.end(), name.begin() + shared, name.end());
+    p = put_varint(varints, entries[ix].control_blob);
+    data_.insert(data_.end(), varints, p);
+  }
+  data_.shrink_to_fit();
+}
+
+uint64_t NameIndex::Key(const std::string& name) const {
+  uint64_t key = 0;
+  for (size_t ix = prefix_.size(); ix != prefix_.size() + 8; ++ix) {
+    key = key << 8 | (ix < name.size() ? uint8_t(name[ix]) : 0);
+  }
+  return key;
+}
+
+int NameIndex::CompareRestart(const std::string& name,
+                              uint64_t offset) const {
+  auto end = data_.data() + data_.size();
+  uint64_t shared, suffix;
+  auto p = get_varint(data_.data() + offset, end, &shared);
+  p = p ? get_varint(p, end, &suffix) : nullptr;
+  if (!p || suffix > size_t(end - p)) {
+    return -1;
+  }
+  return name.compare(0, std::string::npos,
+                      reinterpret_cast<const char*>(p), suffix);
+}
+
+uint64_t NameIndex::Find(const std::string& name) const {
+  if (name.size() > MAX_PATH ||
+      name.compare(0, prefix_.size(), prefix_) != 0) {
+    return 0;
+  }
+  // The last group that starts at or before |name|. Groups with a smaller
+  // key do, groups with a bigger one don't.
+  auto key = Key(name);
+  size_t lo = std::lower_bound(keys_.begin(), keys_.end(), key) -
+              keys_.begin();
+  size_t hi = std::upper_bound(keys_.begin() + lo, keys_.end(), key) -
+              keys_.begin();
+  while (lo != hi) {
+    auto mid = lo + (hi - lo) / 2;
+    if (CompareRestart(name, restarts_[mid]) >= 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  if (lo == 0) {
+    return 0;
+  }
+
+  auto group = lo - 1;
+  auto end = data_.data() + data_.size();
+  auto p = data_.data() + restarts_[group];
+  // Names are only decoded as far as comparing with |name| looks: a longer
+  // one, e.g. on a volume from before fopen() capped them, is cut one byte
+  // past |name| and still compares the same.
+  char current[MAX_PATH + 1];
+  uint64_t length = 0;
+  size_t decoded = 0;
+  auto last = std::min(count_, (group + 1) * kGroup);
+  for (auto ix = group * kGroup; ix != last; ++ix) {
+    uint64_t shared, suffix, id;
+    if (!(p = get_varint(p, end, &shared)) ||
+        !(p = get_varint(p, end, &suffix)) ||
+        shared > length || suffix > size_t(end - p)) {
+      return 0;
+    }
+    auto keep = std::min<size_t>(shared, decoded);
+    auto add = std::min<size_t>(suffix, sizeof(current) - keep);
+    memcpy(current + keep, p, add);
+    decoded = keep + add;
+    length = shared + suffix;
+    p += suffix;
+    if (!(p = get_varint(p, end, &id))) {
+      return 0;
+    }
+    auto cmp = name.compare(0, std::string::npos, current, decoded);
+    if (cmp == 0) {
+      return id;
+    }
+    if (cmp < 0) {
+      break;
+    }
+  }
+  return 0;
+}
+
+size_t NameIndex::bytes() const {
+  return data_.capacity() + restarts_.capacity() * sizeof(uint64_t) +
+         keys_.capacity() * sizeof(uint64_t) + prefix_.capacity();
+}
+
+}  // namespace g
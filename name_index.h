@@ -0,0 +1,61 @@
+// name_index.h
+//
+// Read-only in-memory map from every name of a volume to its control block
+// id, built once from the directory blocks (see fs_index.h).
+//
+// The names are sorted and front-coded in one byte array, the way packed
+// directory blocks are (fs_layout.h): each stores only the suffix it
+// doesn't share with the previous name, then its id as a varint. Every
+// kGroup-th name is stored whole and its offset kept, so a lookup binary
+// searches those and decodes at most one group, without allocating. Names
+// with long common prefixes cost about 10 bytes each plus 16 per group.
+//
+// Binary searching the stored names would take a cache miss per step. The
+// search runs instead over a dense array holding 8 bytes of each group's
+// first name, taken past the prefix every name shares, and only compares
+// whole names among groups whose 8 bytes tie.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "dir_block.h"
+
+namespace g {
+
+class NameIndex {
+ public:
+  // Indexes |entries|, in any order. Names must be unique.
+  explicit NameIndex(std::vector<DirEntry> entries);
+
+  // Control block id of |name|, or 0 if it isn't indexed. Names over
+  // MAX_PATH, which fopen() doesn't create, never are.
+  uint64_t Find(const std::string& name) const;
+
+  size_t size() const { return count_; }
+  // Heap bytes used.
+  size_t bytes() const;
+
+ private:
+  static constexpr size_t kGroup = 16;
+
+  // The 8 bytes of |name| past |prefix_|, big endian and zero padded, so
+  // keys sort like names.
+  uint64_t Key(const std::string& name) const;
+  // Compares |name| with the whole name stored at |offset|.
+  int CompareRestart(const std::string& name, uint64_t offset) const;
+
+  std::vector<uint8_t> data_;
+  // Offset in |data_| of every kGroup-th name, and its key.
+  std::vector<uint64_t> restarts_;
+  std::vector<uint64_t> keys_;
+  // Shared by every name.
+  std::string prefix_;
+  size_t count_ = 0;
+};
+
+}  // namespace g
@@ -0,0 +1,125 @@
+// numa.cc
+
+#include "numa.h"
+
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <thread>
+
+namespace {
+
+constexpr char kNodeDir[] = "/sys/devices/system/node";
+
+}  // namespace
+
+const NumaTopology& NumaTopology::Get() {
+  static const NumaTopology topology;
+  return topology;
+}
+
+NumaTopology::NumaTopology() {
+  if (auto dir = opendir(kNodeDir)) {
+    while (auto ent = readdir(dir)) {
+      char* end = nullptr;
+      if (strncmp(ent->d_name, "node", 4) != 0) {
+        continue;
+      }
+      auto node = strtoul(ent->d_name + 4, &end, 10);
+      if (end == ent->d_name + 4 || *end) {
+        continue;
+      }
+      std::ifstream in(std::string(kNodeDir) + "/" + ent->d_name + "/cpulist");
+      std::string list;
+      std::getline(in, list);
+      auto cpus = ParseCpuList(list);
+      // Memory-only nodes have no cpus to route work to.
+      if (cpus.empty()) {
+        continue;
+      }
+      if (node_cpus_.size() <= node) {
+        node_cpus_.resize(node + 1);
+      }
+      node_cpus_[node] = std::move(cpus);
+    }
+    closedir(dir);
+  }
+  // Node ids can have holes; keep only the populated ones.
+  node_cpus_.erase(std::remove_if(node_cpus_.begin(), node_cpus_.end(),
+      [](const std::vector<int>& c) { return c.empty(); }), node_cpus_.end());
+
+  if (node_cpus_.empty()) {
+    node_cpus_.emplace_back();
+    auto n = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned cpu = 0; cpu != n; ++cpu) {
+      node_cpus_[0].push_back(cpu);
+    }
+  }
+
+  for (size_t node = 0; node != node_cpus_.size(); ++node) {
+    for (auto cpu : node_cpus_[node]) {
+      if (cpu_node_.size() <= static_cast<size_t>(cpu)) {
+        cpu_node_.resize(cpu + 1, 0);
+      }
+      cpu_node_[cpu] = node;
+    }
+  }
+}
+
+size_t NumaTopology::current_node() const {
+  if (nodes() == 1) {
+    return 0;
+  }
+  auto cpu = sched_getcpu();
+  if (cpu < 0 || static_cast<size_t>(cpu) >= cpu_node_.size()) {
+    return 0;
+  }
+  return cpu_node_[cpu];
+}
+
+std::vector<int> NumaTopology::ParseCpuList(const std::string& list) {
+  std::vector<int> cpus;
+  const char* p = list.c_str();
+  while (*p) {
+    char* end = nullptr;
+    long first = strtol(p, &end, 10);
+    if (end == p) {
+      break;
+    }
+    long last = first;
+    p = end;
+    if (*p == '-') {
+      last = strtol(p + 1, &end, 10);
+      p = end;
+    }
+    for (long cpu = first; cpu <= last; ++cpu) {
+      cpus.push_back(static_cast<int>(cpu));
+    }
+    if (*p == ',') {
+      ++p;
+    } else {
+      break;
+    }
+  }
+  return cpus;
+}
+
+bool PinThreadToNode(size_t node) {
+  const auto& topology = NumaTopology::Get();
+  if (node >= topology.nodes()) {
+    return false;
+  }
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (auto cpu : topology.cpus(node)) {
+    if (cpu < CPU_SETSIZE) {
+      CPU_SET(cpu, &set);
+    }
+  }
+  return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
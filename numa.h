@@ -0,0 +1,33 @@
+// numa.h
+//
+// NUMA topology as seen in /sys/devices/system/node, and thread pinning.
+// Machines without that directory (or with a single node) look like one
+// node that owns every cpu, so callers need no special case for them.
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+class NumaTopology {
+ public:
+  // Read once, on first use.
+  static const NumaTopology& Get();
+
+  size_t nodes() const { return node_cpus_.size(); }
+  const std::vector<int>& cpus(size_t node) const { return node_cpus_[node]; }
+  // Node of the cpu the calling thread is running on right now.
+  size_t current_node() const;
+
+  // Parses a sysfs cpu list such as "0-3,8-11".
+  static std::vector<int> ParseCpuList(const std::string& list);
+
+ private:
+  NumaTopology();
+
+  std::vector<std::vector<int>> node_cpus_;
+  std::vector<size_t> cpu_node_;
+};
+
+// Restricts the calling thread to the cpus of |node|.
+bool PinThreadToNode(size_t node);
@@ -0,0 +1,110 @@
+// numa_store.cc
+
+#include "numa_store.h"
+
+#include <algorithm>
+
+#include "numa.h"
+
+NumaStore::NumaStore(BlobStore* inner, size_t cache_blobs,
+                     size_t workers_per_node)
+    : inner_(inner) {
+  const auto& topology = NumaTopology::Get();
+  auto nodes = topology.nodes();
+  bool multi = nodes > 1;
+
+  shards_.resize(nodes);
+  for (size_t node = 0; node != nodes; ++node) {
+    auto& shard = shards_[node];
+    shard.sched = std::make_unique<IoScheduler>(
+        inner, workers_per_node, multi ? static_cast<int>(node) : -1);
+    shard.io = std::make_unique<SchedStore>(shard.sched.get());
+    BlobCache::PutHook on_put;
+    if (multi) {
+      on_put = [this, node](uint64_t id) { Invalidate(node, id); };
+    }
+    shard.cache = std::make_unique<BlobCache>(
+        shard.io.get(), std::max<size_t>(cache_blobs / nodes, 1), multi,
+        std::move(on_put));
+  }
+}
+
+NumaStore::~NumaStore() {
+  // Caches release their blobs while the schedulers still run; schedulers
+  // drain before their facades go away.
+  for (auto& shard : shards_) {
+    shard.cache.reset();
+  }
+  for (auto& shard : shards_) {
+    shard.sched.reset();
+    shard.io.reset();
+  }
+}
+
+NumaStore::Shard& NumaStore::local() {
+  if (shards_.size() == 1) {
+    return shards_[0];
+  }
+  return shards_[NumaTopology::Get().current_node()];
+}
+
+Blob* NumaStore::GetBlob(uint64_t id) {
+  return local().cache->GetBlob(id);
+}
+
+uint64_t NumaStore::GetFreeSpace() {
+  return inner_->GetFreeSpace();
+}
+
+void NumaStore::Prefetch(uint64_t id, IoClass cls) {
+  local().io->Prefetch(id, cls);
+}
+
+bool NumaStore::Cached(uint64_t id) {
+  return local().cache->Contains(id);
+}
+
+void NumaStore::Invalidate(size_t writer, uint64_t id) {
+  for (size_t node = 0; node != shards_.size(); ++node) {
+    if (node != writer) {
+      shards_[node].io->Forget(id);
+      shards_[node].cache->Invalidate(id);
+    }
+  }
+}
+
+BlobCacheStats NumaStore::cache_stats() const {
+  BlobCacheStats total = {};
+  for (auto& shard : shards_) {
+    auto st = shard.cache->stats();
+    total.hits += st.hits;
+    total.misses += st.misses;
+    total.coalesced += st.coalesced;
+    total.evictions += st.evictions;
+    total.rejected += st.rejected;
+  }
+  return total;
+}
+
+void NumaStore::reset_cache_stats() {
+  for (auto& shard : shards_) {
+    shard.cache->reset_stats();
+  }
+}
+
+std::array<IoClassStats, kIoClasses> NumaStore::io_stats() const {
+  std::array<IoClassStats, kIoClasses> total = {};
+  for (auto& shard : shards_) {
+    auto st = shard.sched->stats();
+    for (size_t c = 0; c != kIoClasses; ++c) {
+      total[c].issued += st[c].issued;
+      total[c].merged += st[c].merged;
+      total[c].cancelled += st[c].cancelled;
+      total[c].late += st[c].late;
+      for (size_t b = 0; b != st[c].latency.size(); ++b) {
+        total[c].latency[b] += st[c].latency[b];
+      }
+    }
+  }
+  return total;
+}
@@ -0,0 +1,58 @@
+// numa_store.h
+//
+// The filesystem's store stack, one copy per NUMA node.
+//
+// Each node gets its own blob cache and I/O scheduler, with the scheduler's
+// workers pinned to that node's cpus. Requests are routed to the shard of
+// the node the calling thread is running on, so cache lookups and the data
+// they return stay on the local socket. A Put through one shard invalidates
+// the blob in the others.
+//
+// On a single-node machine this is exactly one cache over one unpinned
+// scheduler.
+
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "blob.h"
+#include "blob_cache.h"
+#include "io_sched.h"
+
+class NumaStore final : public BlobStore {
+ public:
+  // |cache_blobs| is split evenly between the nodes.
+  NumaStore(BlobStore* inner, size_t cache_blobs, size_t workers_per_node = 1);
+  ~NumaStore();
+
+  NumaStore(const NumaStore&) = delete;
+  NumaStore& operator=(const NumaStore&) = delete;
+
+  Blob* GetBlob(uint64_t id) override;
+  uint64_t GetFreeSpace() override;
+
+  void Prefetch(uint64_t id, IoClass cls = IoClass::Readahead);
+  // Whether the calling thread's cache has blob |id|, in which case a
+  // Prefetch() of it would be wasted.
+  bool Cached(uint64_t id);
+
+  size_t nodes() const { return shards_.size(); }
+  // Summed over all nodes.
+  BlobCacheStats cache_stats() const;
+  void reset_cache_stats();
+  std::array<IoClassStats, kIoClasses> io_stats() const;
+
+ private:
+  struct Shard {
+    std::unique_ptr<IoScheduler> sched;
+    std::unique_ptr<SchedStore> io;
+    std::unique_ptr<BlobCache> cache;
+  };
+
+  Shard& local();
+  void Invalidate(size_t writer, uint64_t id);
+
+  BlobStore* const inner_;
+  std::vector<Shard> shards_;
+};
@@ -0,0 +1,161 @@
+// op_stats.cc
+
+#include "op_stats.h"
+
+#include <atomic>
+
+namespace g {
+
+namespace {
+
+struct OpCounters {
+  std::atomic<uint64_t> calls;
+  std::atomic<uint64_t> allocs;
+  std::atomic<uint64_t> alloc_bytes;
+  std::atomic<uint64_t> copy_bytes;
+  std::atomic<uint64_t> gets;
+  std::atomic<uint64_t> get_bytes;
+  std::atomic<uint64_t> puts;
+  std::atomic<uint64_t> put_bytes;
+  std::atomic<uint64_t> store_gets;
+  std::atomic<uint64_t> store_get_bytes;
+  std::atomic<uint64_t> store_puts;
+  std::atomic<uint64_t> store_put_bytes;
+  std::atomic<uint64_t> sampled;
+  std::atomic<uint64_t> nanos;
+  std::atomic<uint64_t> instructions;
+  std::atomic<uint64_t> cache_misses;
+  std::atomic<uint64_t> branch_misses;
+};
+
+OpCounters g_ops[kOps];
+std::atomic<uint32_t> g_sample_every{0};
+
+constexpr const char* kOpNames[kOps] = {
+  "fopen", "fread", "fwrite", "dir_find", "get_data_blob",
+};
+
+void add(std::atomic<uint64_t>& counter, uint64_t n) {
+  counter.fetch_add(n, std::memory_order_relaxed);
+}
+
+}  // namespace
+
+const char* op_name(Op op) {
+  return kOpNames[static_cast<size_t>(op)];
+}
+
+void StatScope::Start() {
+  active_ = true;
+#ifdef BLOB_ACCOUNTING
+  alloc_start_ = ReadAllocStats();
+#endif
+  logical_start_ = io_counters::logical.read();
+  store_start_ = io_counters::store.read();
+  auto n = g_ops[static_cast<size_t>(op_)].calls.fetch_add(
+      1, std::memory_order_relaxed);
+  auto every = g_sample_every.load(std::memory_order_relaxed);
+  if (every == 0 || (n % every) != 0) {
+    return;
+  }
+  sampled_ = true;
+  perf_ = PerfGroup::ForThread();
+  if (perf_ && !perf_->Read(&start_)) {
+    perf_ = nullptr;
+  }
+  t0_ = std::chrono::steady_clock::now();
+}
+
+void StatScope::Finish() {
+  auto& c = g_ops[static_cast<size_t>(op_)];
+#ifdef BLOB_ACCOUNTING
+  auto alloc_end = ReadAllocStats();
+  add(c.allocs, alloc_end.allocs - alloc_start_.allocs);
+  add(c.alloc_bytes, alloc_end.alloc_bytes - alloc_start_.alloc_bytes);
+  add(c.copy_bytes, alloc_end.copy_bytes - alloc_start_.copy_bytes);
+#endif
+  auto logical = io_counters::logical.read();
+  add(c.gets, logical.gets - logical_start_.gets);
+  add(c.get_bytes, logical.get_bytes - logical_start_.get_bytes);
+  add(c.puts, logical.puts - logical_start_.puts);
+  add(c.put_bytes, logical.put_bytes - logical_start_.put_bytes);
+  auto store = io_counters::store.read();
+  add(c.store_gets, store.gets - store_start_.gets);
+  add(c.store_get_bytes, store.get_bytes - store_start_.get_bytes);
+  add(c.store_puts, store.puts - store_start_.puts);
+  add(c.store_put_bytes, store.put_bytes - store_start_.put_bytes);
+  if (!sampled_) {
+    return;
+  }
+  auto t1 = std::chrono::steady_clock::now();
+  PerfSample end;
+  bool have_perf = perf_ && perf_->Read(&end);
+
+  add(c.sampled, 1);
+  add(c.nanos,
+      std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0_).count());
+  if (have_perf) {
+    add(c.instructions, end.instructions - start_.instructions);
+    add(c.cache_misses, end.cache_misses - start_.cache_misses);
+    add(c.branch_misses, end.branch_misses - start_.branch_misses);
+  }
+}
+
+void fop_stats(bool enabled) {
+  op_stats_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+bool fperf_counters(uint32_t sample_every) {
+  g_sample_every.store(sample_every, std::memory_order_relaxed);
+  if (sample_every) {
+    fop_stats(true);
+  }
+  return sample_every && PerfGroup::ForThread();
+}
+
+void read_op_stats(OpStats* ops) {
+  for (size_t i = 0; i != kOps; ++i) {
+    auto& c = g_ops[i];
+    ops[i].calls = c.calls.load(std::memory_order_relaxed);
+    ops[i].allocs = c.allocs.load(std::memory_order_relaxed);
+    ops[i].alloc_bytes = c.alloc_bytes.load(std::memory_order_relaxed);
+    ops[i].copy_bytes = c.copy_bytes.load(std::memory_order_relaxed);
+    ops[i].gets = c.gets.load(std::memory_order_relaxed);
+    ops[i].get_bytes = c.get_bytes.load(std::memory_order_relaxed);
+    ops[i].puts = c.puts.load(std::memory_order_relaxed);
+    ops[i].put_bytes = c.put_bytes.load(std::memory_order_relaxed);
+    ops[i].store_gets = c.store_gets.load(std::memory_order_relaxed);
+    ops[i].store_get_bytes = c.store_get_bytes.load(std::memory_order_relaxed);
+    ops[i].store_puts = c.store_puts.load(std::memory_order_relaxed);
+    ops[i].store_put_bytes = c.store_put_bytes.load(std::memory_order_relaxed);
+    ops[i].sampled = c.sampled.load(std::memory_order_relaxed);
+    ops[i].nanos = c.nanos.load(std::memory_order_relaxed);
+    ops[i].instructions = c.instructions.load(std::memory_order_relaxed);
+    ops[i].cache_misses = c.cache_misses.load(std::memory_order_relaxed);
+    ops[i].branch_misses = c.branch_misses.load(std::memory_order_relaxed);
+  }
+}
+
+void reset_op_stats() {
+  for (auto& c : g_ops) {
+    c.calls = 0;
+    c.allocs = 0;
+    c.alloc_bytes = 0;
+    c.copy_bytes = 0;
+    c.gets = 0;
+    c.get_bytes = 0;
+    c.puts = 0;
+    c.put_bytes = 0;
+    c.store_gets = 0;
+    c.store_get_bytes = 0;
+    c.store_puts = 0;
+    c.store_put_bytes = 0;
+    c.sampled = 0;
+    c.nanos = 0;
+    c.instructions = 0;
+    c.cache_misses = 0;
+    c.branch_misses = 0;
+  }
+}
+
+}  // namespace g
@@ -0,0 +1,61 @@
+// op_stats.h
+//
+// Per-operation counters behind fs_stats.h. A StatScope at the top of
+// anything listed in g::Op counts the call and, for sampled calls, the wall
+// time and hardware counters spent until the scope ends. Nested scopes are
+// inclusive: a fopen() sample includes the DirFind samples under it.
+//
+// The counters are off until fop_stats() or fperf_counters() turns them on,
+// and until then a StatScope costs one relaxed load.
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+
+#include "alloc_stats.h"
+#include "fs_stats.h"
+#include "io_counters.h"
+#include "perf_counters.h"
+
+namespace g {
+
+inline std::atomic<bool> op_stats_enabled{false};
+
+class StatScope {
+ public:
+  explicit StatScope(Op op) : op_(op) {
+    if (op_stats_enabled.load(std::memory_order_relaxed)) {
+      Start();
+    }
+  }
+  ~StatScope() {
+    if (active_) {
+      Finish();
+    }
+  }
+
+  StatScope(const StatScope&) = delete;
+  StatScope& operator=(const StatScope&) = delete;
+
+ private:
+  void Start();
+  void Finish();
+
+  const Op op_;
+  bool active_ = false;
+  bool sampled_ = false;
+  PerfGroup* perf_ = nullptr;
+  PerfSample start_;
+#ifdef BLOB_ACCOUNTING
+  AllocStats alloc_start_;
+#endif
+  IoCounters logical_start_;
+  IoCounters store_start_;
+  std::chrono::steady_clock::time_point t0_;
+};
+
+void read_op_stats(OpStats* ops);
+void reset_op_stats();
+
+}  // namespace g
@@ -0,0 +1,100 @@
+// perf_counters.cc
+
+#include "perf_counters.h"
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <initializer_list>
+#include <memory>
+
+namespace {
+
+int perf_event_open(perf_event_attr* attr, int group_fd) {
+  // This thread, any cpu.
+  return static_cast<int>(syscall(SYS_perf_event_open, attr, 0, -1, group_fd, 0));
+}
+
+int open_counter(uint64_t config, int group_fd, bool user_only) {
+  perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = config;
+  attr.read_format = PERF_FORMAT_GROUP;
+  attr.disabled = (group_fd == -1);
+  attr.exclude_kernel = user_only;
+  attr.exclude_hv = 1;
+  return perf_event_open(&attr, group_fd);
+}
+
+}  // namespace
+
+PerfGroup* PerfGroup::ForThread() {
+  thread_local bool tried = false;
+  thread_local std::unique_ptr<PerfGroup> group;
+  if (!tried) {
+    tried = true;
+    group.reset(new PerfGroup());
+    if (!group->Open()) {
+      group.reset();
+    }
+  }
+  return group.get();
+}
+
+PerfGroup::PerfGroup() {}
+
+PerfGroup::~PerfGroup() {
+  for (auto fd : members_) {
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+  if (leader_ >= 0) {
+    close(leader_);
+  }
+}
+
+bool PerfGroup::Open() {
+  // Counting the kernel side too is more honest for fread and fwrite, but
+  // perf_event_paranoid >= 2 only allows user space.
+  for (bool user_only : {false, true}) {
+    leader_ = open_counter(PERF_COUNT_HW_INSTRUCTIONS, -1, user_only);
+    if (leader_ < 0) {
+      continue;
+    }
+    members_[0] = open_counter(PERF_COUNT_HW_CACHE_MISSES, leader_, user_only);
+    members_[1] = open_counter(PERF_COUNT_HW_BRANCH_MISSES, leader_, user_only);
+    if (members_[0] >= 0 && members_[1] >= 0) {
+      ioctl(leader_, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+      ioctl(leader_, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+      return true;
+    }
+    for (auto& fd : members_) {
+      if (fd >= 0) {
+        close(fd);
+      }
+      fd = -1;
+    }
+    close(leader_);
+    leader_ = -1;
+  }
+  return false;
+}
+
+bool PerfGroup::Read(PerfSample* sample) const {
+  // PERF_FORMAT_GROUP: the number of counters, then their values in the
+  // order they joined the group.
+  uint64_t values[1 + 3];
+  if (read(leader_, values, sizeof(values)) != sizeof(values)) {
+    return false;
+  }
+  sample->instructions = values[1];
+  sample->cache_misses = values[2];
+  sample->branch_misses = values[3];
+  return true;
+}
@@ -0,0 +1,35 @@
+// perf_counters.h
+//
+// Hardware counters of the calling thread, opened with perf_event_open() as
+// one group so that all of them cover exactly the same instructions.
+
+#pragma once
+
+#include <stdint.h>
+
+struct PerfSample {
+  uint64_t instructions;
+  uint64_t cache_misses;
+  uint64_t branch_misses;
+};
+
+class PerfGroup {
+ public:
+  // The calling thread's group, opened on first use. Null if the kernel
+  // won't give us the counters.
+  static PerfGroup* ForThread();
+
+  ~PerfGroup();
+
+  PerfGroup(const PerfGroup&) = delete;
+  PerfGroup& operator=(const PerfGroup&) = delete;
+
+  bool Read(PerfSample* sample) const;
+
+ private:
+  PerfGroup();
+  bool Open();
+
+  int leader_ = -1;
+  int members_[2] = {-1, -1};
+};
@@ -1,3 +1,5 @@
+#pragma once
+
 #include <stdint.h>
 #include <cassert>
 
@@ -49,12 +51,24 @@ class RefPtr {
     }
     T* old = ptr_;
     ptr_ = r.ptr_;
-    if (old && old->Release()) {
+    if (old && (old->Release() == 0)) {
       delete old;
     }
     return *this;
   }
 
+  RefPtr& operator=(RefPtr&& r) {
+    if (this != &r) {
+      T* old = ptr_;
+      ptr_ = r.ptr_;
+      r.ptr_ = nullptr;
+      if (old && (old->Release() == 0)) {
+        delete old;
+      }
+    }
+    return *this;
+  }
+
   // Copy construction.
   RefPtr(const RefPtr& r) : RefPtr(r.ptr_) {}
   // Move construction.
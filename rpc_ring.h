@@ -0,0 +1,142 @@
+// rpc_ring.h
+//
+// Shared memory transport between RpcStore (rpc_store.h) and the store
+// daemon (rpc_server.h), for when both are on one host and socket round
+// trips would dominate the cost of small blobs.
+//
+// The client creates an RpcRegion in a memfd and offers it to the daemon on
+// the socket, in an RpcOp::Hello message carrying the fd; a daemon that
+// accepts replies 0, and from then on the connection's requests go through
+// the region and the socket only tells either side when the other is gone.
+// One that doesn't, e.g. an older one, replies with an error and the client
+// keeps using the socket.
+//
+// The region holds two single-producer, single-consumer rings of RpcEntry:
+// requests from the client, replies from the daemon, each with its tag as
+// on the socket. Payloads aren't in the entries: the client gives each
+// request in flight one slot of the region's arena, and both directions
+// pass its offset, so blob bytes are written once into shared memory and
+// read once out of it, instead of going through the kernel both ways. At
+// most kRingEntries requests are in flight, so neither ring can overflow.
+//
+// A consumer spins on the ring for a while before it sleeps on a futex on
+// the ring's tail, and the producer makes the futex call only if it sleeps,
+// so a busy connection makes no syscalls at all. With a single CPU the peer
+// can't make progress during a spin, so nothing spins. Sleeps time out every
+// kRingTimeoutMs for the consumer to check that its peer is still there.
+//
+// The daemon maps regions from clients it doesn't trust with its own
+// memory, so it bounds every index and offset it reads from one. It only
+// maps a memfd sealed against shrinking and growing, as the client makes
+// it, since one the client truncated later would fault the daemon.
+
+#pragma once
+
+#include <linux/futex.h>
+#include <stdint.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstddef>
+#include <thread>
+
+#include "rpc_wire.h"
+
+constexpr uint32_t kRingEntries = 32;
+constexpr size_t kRingSlot = MaxBlobSize;
+constexpr int kRingSpins = 1000;
+constexpr int kRingTimeoutMs = 50;
+
+static_assert((kRingEntries & (kRingEntries - 1)) == 0,
+              "ring indexes wrap around");
+static_assert(std::atomic<uint32_t>::is_always_lock_free,
+              "ring indexes are shared between processes");
+
+struct RpcEntry {
+  RpcHeader header;
+  // Of the request's arena slot, which carries |header.len| payload bytes.
+  uint64_t offset;
+};
+
+struct RpcRing {
+  // Next entry to consume. Written by the consumer only.
+  alignas(64) std::atomic<uint32_t> head;
+  // Next entry to produce, and the futex the consumer sleeps on. Written
+  // by the producer only.
+  alignas(64) std::atomic<uint32_t> tail;
+  // Whether the consumer sleeps, or is about to.
+  std::atomic<uint32_t> sleeping;
+  RpcEntry entries[kRingEntries];
+};
+
+struct RpcRegion {
+  RpcRing requests;
+  RpcRing replies;
+  // Set by the client when it goes away.
+  std::atomic<uint32_t> closed;
+  alignas(4096) uint8_t arena[kRingEntries][kRingSlot];
+};
+
+namespace rpc_ring {
+
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#endif
+}
+
+// How many times to poll before sleeping.
+inline int spins() {
+  static const int spins =
+      std::thread::hardware_concurrency() > 1 ? kRingSpins : 0;
+  return spins;
+}
+
+inline void futex_wake(std::atomic<uint32_t>* word) {
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAKE, 1,
+          nullptr, nullptr, 0);
+}
+
+// Producer side: makes the entries before |tail| visible, and wakes the
+// consumer if it sleeps.
+inline bool publish(RpcRing* ring, uint32_t tail) {
+  ring->tail.store(tail, std::memory_order_seq_cst);
+  if (ring->sleeping.load(std::memory_order_seq_cst)) {
+    futex_wake(&ring->tail);
+    return true;
+  }
+  return false;
+}
+
+// Wakes up the consumer, e.g. to see it should stop. One that wasn't asleep
+// yet sees it after its timeout.
+inline void interrupt(RpcRing* ring) {
+  futex_wake(&ring->tail);
+}
+
+// Consumer side: waits for entries past |head|, for kRingTimeoutMs at most
+// once it sleeps. Returns the tail, which is |head| if there are none yet.
+inline uint32_t wait(RpcRing* ring, uint32_t head) {
+  for (int i = 0; i != spins(); ++i) {
+    auto tail = ring->tail.load(std::memory_order_acquire);
+    if (tail != head) {
+      return tail;
+    }
+    cpu_relax();
+  }
+  // Paired with publish(): either it sees |sleeping| or this sees its tail.
+  ring->sleeping.store(1, std::memory_order_seq_cst);
+  auto tail = ring->tail.load(std::memory_order_seq_cst);
+  if (tail == head) {
+    timespec timeout = {0, kRingTimeoutMs * 1000000L};
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&ring->tail), FUTEX_WAIT,
+            head, &timeout, nullptr, 0);
+    tail = ring->tail.load(std::memory_order_acquire);
+  }
+  ring->sleeping.store(0, std::memory_order_relaxed);
+  return tail;
+}
+
+}  // namespace rpc_ring
@@ -0,0 +1,324 @@
+// rpc_server.cc
+//
+// See rpc_server.h.
+
+#include "rpc_server.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "rpc_ring.h"
+
+namespace {
+
+// Room for a batch of requests, and at least one of the largest.
+constexpr size_t kReadBuffer = 1 << 20;
+
+constexpr uint64_t result(int rc) {
+  return static_cast<uint64_t>(int64_t(rc));
+}
+
+// Reads what has arrived on |fd|, like read(). Keeps the last fd passed
+// with it in |*passed|.
+ssize_t receive(int fd, void* buffer, size_t size, int* passed) {
+  iovec iov = {buffer, size};
+  alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+  msghdr msg = {};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  auto n = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+  if (n < 0) {
+    return n;
+  }
+  for (auto cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+       cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+        cmsg->cmsg_len == CMSG_LEN(sizeof(int))) {
+      if (*passed >= 0) {
+        close(*passed);
+      }
+      memcpy(passed, CMSG_DATA(cmsg), sizeof(int));
+    }
+  }
+  return n;
+}
+
+bool peer_gone(int fd) {
+  char byte;
+  auto n = recv(fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+  return n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR);
+}
+
+}  // namespace
+
+RpcServer::RpcServer(BlobStore* store, const std::string& path)
+    : store_(store), path_(path) {
+  sockaddr_un addr = {};
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path)) {
+    return;
+  }
+  memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+  listen_fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (listen_fd_ < 0) {
+    return;
+  }
+  unlink(path.c_str());
+  if (bind(listen_fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) ||
+      listen(listen_fd_, 64)) {
+    close(listen_fd_);
+    listen_fd_ = -1;
+  }
+}
+
+RpcServer::~RpcServer() {
+  Stop();
+  if (listen_fd_ >= 0) {
+    close(listen_fd_);
+    unlink(path_.c_str());
+  }
+}
+
+void RpcServer::Run() {
+  while (ok() && !stop_) {
+    int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      break;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stop_) {
+      close(fd);
+      break;
+    }
+    for (auto id : finished_) {
+      auto it = std::find_if(
+          threads_.begin(), threads_.end(),
+          [id](const std::thread& t) { return t.get_id() == id; });
+      it->join();
+      threads_.erase(it);
+    }
+    finished_.clear();
+    fds_.push_back(fd);
+    threads_.emplace_back(&RpcServer::Serve, this, fd);
+  }
+}
+
+void RpcServer::Stop() {
+  std::vector<std::thread> threads;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+    // Wakes up accept() and every connection's read().
+    if (listen_fd_ >= 0) {
+      shutdown(listen_fd_, SHUT_RDWR);
+    }
+    for (auto fd : fds_) {
+      shutdown(fd, SHUT_RDWR);
+    }
+    threads.swap(threads_);
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  finished_.clear();
+}
+
+std::mutex& RpcServer::BlobLock(uint64_t id) {
+  return blob_locks_[id % kBlobLocks];
+}
+
+template <typename Fn>
+RpcHeader RpcServer::Execute(const RpcHeader& req, const uint8_t* payload,
+                             Fn get) {
+  RpcHeader reply = {req.op, 0, req.tag, 0};
+  switch (req.op) {
+    case RpcOp::Get: {
+      auto blob = store_->GetBlob(req.value);
+      if (!blob) {
+        reply.value = result(ErrInternal);
+        break;
+      }
+      {
+        std::lock_guard<std::mutex> lock(BlobLock(req.value));
+        auto& data = blob->Get();
+        reply.len = static_cast<uint32_t>(data.size());
+        get(data);
+      }
+      blob->Release();
+      break;
+    }
+    case RpcOp::Put: {
+      int rc = ErrInternal;
+      if (auto target = store_->GetBlob(req.value)) {
+        Data data(payload, payload + req.len);
+        {
+          std::lock_guard<std::mutex> lock(BlobLock(req.value));
+          rc = target->Put(data);
+        }
+        target->Release();
+      }
+      reply.value = result(rc);
+      break;
+    }
+    case RpcOp::FreeSpace:
+      reply.value = store_->GetFreeSpace();
+      break;
+    default:
+      reply.value = result(ErrBadArgs);
+      break;
+  }
+  return reply;
+}
+
+RpcRegion* RpcServer::MapRegion(int memfd) {
+  // A client that could shrink the memfd would make the daemon fault on
+  // pages that are gone.
+  constexpr int kSeals = F_SEAL_SHRINK | F_SEAL_GROW;
+  int seals = memfd < 0 ? -1 : fcntl(memfd, F_GET_SEALS);
+  struct stat st;
+  if (seals < 0 || (seals & kSeals) != kSeals || fstat(memfd, &st) != 0 ||
+      st.st_size != static_cast<off_t>(sizeof(RpcRegion))) {
+    return nullptr;
+  }
+  auto map = mmap(nullptr, sizeof(RpcRegion), PROT_READ | PROT_WRITE,
+                  MAP_SHARED, memfd, 0);
+  return map == MAP_FAILED ? nullptr : static_cast<RpcRegion*>(map);
+}
+
+void RpcServer::Serve(int fd) {
+  std::vector<uint8_t> buffer(kReadBuffer);
+  size_t have = 0;
+  std::vector<RpcHeader> replies;
+  // The bytes each reply sends. Kept across batches, to reuse the buffers.
+  std::vector<Data> payloads;
+  std::vector<iovec> iov;
+  int passed = -1;
+  RpcRegion* region = nullptr;
+  for (;;) {
+    auto n = receive(fd, buffer.data() + have, buffer.size() - have,
+                     &passed);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      break;
+    }
+    have += n;
+
+    size_t pos = 0;
+    bool malformed = false;
+    while (have - pos >= sizeof(RpcHeader)) {
+      RpcHeader req;
+      memcpy(&req, &buffer[pos], sizeof(req));
+      if (req.len > kRpcMaxPayload) {
+        malformed = true;
+        break;
+      }
+      if (have - pos < sizeof(req) + req.len) {
+        break;
+      }
+      if (payloads.size() == replies.size()) {
+        payloads.emplace_back();
+      }
+      auto& payload = payloads[replies.size()];
+      payload.clear();
+      RpcHeader reply;
+      if (req.op == RpcOp::Hello) {
+        reply = {req.op, 0, req.tag, result(ErrBadArgs)};
+        if (!region &&
+            req.value == static_cast<uint64_t>(RpcTransport::SharedMemory)) {
+          region = MapRegion(passed);
+          if (region) {
+            reply.value = 0;
+          }
+        }
+      } else {
+        // Later requests of the batch may Put the blob before the replies
+        // are sent, so its bytes are taken as it runs.
+        reply = Execute(req, &buffer[pos + sizeof(req)],
+                        [&payload](const Data& data) {
+                          payload.assign(data.begin(), data.end());
+                        });
+      }
+      replies.push_back(reply);
+      pos += sizeof(req) + req.len;
+    }
+    memmove(buffer.data(), buffer.data() + pos, have - pos);
+    have -= pos;
+
+    iov.clear();
+    for (size_t i = 0; i != replies.size(); ++i) {
+      iov.push_back({&replies[i], sizeof(RpcHeader)});
+      if (replies[i].len) {
+        iov.push_back({payloads[i].data(), replies[i].len});
+      }
+    }
+    bool sent = rpc_write_all(fd, iov.data(), iov.size());
+    replies.clear();
+    if (!sent || malformed || region) {
+      break;
+    }
+  }
+  if (passed >= 0) {
+    close(passed);
+  }
+  if (region) {
+    ServeRing(fd, region);
+    munmap(region, sizeof(RpcRegion));
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  fds_.erase(std::find(fds_.begin(), fds_.end(), fd));
+  close(fd);
+  if (!stop_) {
+    finished_.push_back(std::this_thread::get_id());
+  }
+}
+
+void RpcServer::ServeRing(int fd, RpcRegion* region) {
+  auto& requests = region->requests;
+  auto& replies = region->replies;
+  uint32_t head = 0;
+  uint32_t tail = 0;
+  while (!stop_ && !region->closed.load(std::memory_order_acquire)) {
+    auto end = rpc_ring::wait(&requests, head);
+    if (end == head) {
+      if (peer_gone(fd)) {
+        break;
+      }
+      continue;
+    }
+    // The client can't have more in flight than it has slots.
+    if (end - head > kRingEntries) {
+      break;
+    }
+    for (; head != end; ++head) {
+      auto entry = requests.entries[head % kRingEntries];
+      if (entry.offset % kRingSlot ||
+          entry.offset / kRingSlot >= kRingEntries ||
+          entry.header.len > kRingSlot) {
+        return;
+      }
+      auto slot = region->arena[entry.offset / kRingSlot];
+      // Blobs are at most MaxBlobSize, a slot's size.
+      auto reply = Execute(entry.header, slot, [slot](const Data& data) {
+        memcpy(slot, data.data(), data.size());
+      });
+      replies.entries[tail % kRingEntries] = {reply, entry.offset};
+      requests.head.store(head + 1, std::memory_order_release);
+      rpc_ring::publish(&replies, ++tail);
+    }
+  }
+}
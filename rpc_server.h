@@ -0,0 +1,77 @@
+// rpc_server.h
+//
+// The store daemon's server: serves a BlobStore to RpcStore (rpc_store.h)
+// clients on a Unix domain socket, in the format of rpc_wire.h.
+//
+// Each connection has a thread, which reads whatever requests have
+// arrived, runs them against the store in order and sends all their
+// replies with one sendmsg(). A Get's bytes are copied out of the store's
+// Blob as it runs, into a buffer the connection reuses, so its reply holds
+// the blob as of that point in the stream, whatever runs after it.
+//
+// Connections share the store's Blobs: the toy store hands every GetBlob()
+// of an id the same one, and its Put() replaces the bytes a Get() returned.
+// So the copy of a Get and every Put hold a lock for their id, one of
+// kBlobLocks, and the store's Blobs needn't be safe to read during a Put.
+//
+// A client can switch its connection over to shared memory rings
+// (rpc_ring.h). Its thread then serves the rings instead, and wakes up
+// every kRingTimeoutMs while idle to see if the client or Stop() ended it.
+
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "blob.h"
+#include "rpc_wire.h"
+
+struct RpcRegion;
+
+class RpcServer {
+ public:
+  static constexpr size_t kBlobLocks = 256;
+
+  // Listens at |path|, replacing any socket left there. See ok().
+  RpcServer(BlobStore* store, const std::string& path);
+  // Stops, and removes the socket.
+  ~RpcServer();
+
+  RpcServer(const RpcServer&) = delete;
+  RpcServer& operator=(const RpcServer&) = delete;
+
+  bool ok() const { return listen_fd_ >= 0; }
+
+  // Accepts and serves connections until Stop().
+  void Run();
+  // Makes Run() return and closes every connection. Call from another
+  // thread than Run()'s, not from a signal handler.
+  void Stop();
+
+ private:
+  void Serve(int fd);
+  // Maps the region passed with a Hello. Null if it isn't one.
+  static RpcRegion* MapRegion(int memfd);
+  void ServeRing(int fd, RpcRegion* region);
+  // Runs one request. A Get passes its blob's bytes to |get|, which copies
+  // them out while the lock for the id is held.
+  template <typename Fn>
+  RpcHeader Execute(const RpcHeader& req, const uint8_t* payload, Fn get);
+  std::mutex& BlobLock(uint64_t id);
+
+  BlobStore* const store_;
+  const std::string path_;
+  int listen_fd_ = -1;
+  std::atomic<bool> stop_{false};
+
+  std::mutex mutex_;
+  std::vector<int> fds_;
+  std::vector<std::thread> threads_;
+  // Of connections that closed, for Run() to join.
+  std::vector<std::thread::id> finished_;
+
+  std::mutex blob_locks_[kBlobLocks];
+};
@@ -0,0 +1,481 @@
+// rpc_store.cc
+//
+// See rpc_store.h.
+
+#include "rpc_store.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <unordered_map>
+
+#include "rpc_ring.h"
+
+namespace {
+
+constexpr uint64_t kFailed = static_cast<uint64_t>(int64_t(ErrInternal));
+
+// Room for a batch of replies, and at least one of the largest.
+constexpr size_t kReadBuffer = 1 << 20;
+
+}  // namespace
+
+class RpcStore::Connection {
+ public:
+  Connection(const std::string& path, RpcTransport transport);
+  ~Connection();
+
+  bool ok() const { return fd_ >= 0; }
+  bool shared() const { return region_ != nullptr; }
+  uint64_t Call(RpcOp op, uint64_t id, const Data* payload, Data* reply);
+
+  std::atomic<uint64_t> writes{0};
+  std::atomic<uint64_t> reads{0};
+  std::atomic<uint64_t> wakeups{0};
+
+ private:
+  struct Waiter {
+    Data* reply;
+    uint64_t value = kFailed;
+    // Set under |mutex_|, and read without it by callers that spin.
+    std::atomic<bool> done{false};
+    std::condition_variable replied;
+  };
+
+  struct Request {
+    RpcHeader header;
+    const Data* payload;
+  };
+
+  // Offers the daemon a shared memory region. Sets |region_| if it takes it.
+  void OfferRegion();
+  uint64_t CallRing(RpcOp op, uint64_t id, const Data* payload, Data* reply);
+  void ReadLoop();
+  void RingLoop();
+  // Whether the daemon closed the socket.
+  bool PeerGone() const;
+  // Fails every call waiting. Called under |mutex_|.
+  void FailLocked();
+
+  int fd_ = -1;
+  RpcRegion* region_ = nullptr;
+  std::atomic<bool> closing_{false};
+  std::thread reader_;
+
+  std::mutex mutex_;
+  std::unordered_map<uint64_t, Waiter*> waiting_;
+  uint64_t next_tag_ = 0;
+  // Requests not written yet. Their payloads belong to callers, who wait
+  // for the reply and so keep them alive.
+  std::vector<Request> queued_;
+  bool writing_ = false;
+  bool broken_ = false;
+  // Arena slots of |region_| no request in flight has, and the tail of its
+  // request ring.
+  std::vector<uint32_t> free_slots_;
+  std::condition_variable slot_freed_;
+  uint32_t submitted_ = 0;
+};
+
+RpcStore::Connection::Connection(const std::string& path,
+                                 RpcTransport transport) {
+  sockaddr_un addr = {};
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path)) {
+    return;
+  }
+  memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+  fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd_ < 0) {
+    return;
+  }
+  if (connect(fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+    close(fd_);
+    fd_ = -1;
+    return;
+  }
+  if (transport == RpcTransport::SharedMemory) {
+    OfferRegion();
+  }
+  reader_ = std::thread(shared() ? &Connection::RingLoop
+                                 : &Connection::ReadLoop, this);
+}
+
+RpcStore::Connection::~Connection() {
+  if (fd_ < 0) {
+    return;
+  }
+  closing_ = true;
+  if (region_) {
+    region_->closed.store(1, std::memory_order_release);
+    rpc_ring::interrupt(&region_->requests);
+    rpc_ring::interrupt(&region_->replies);
+  }
+  // Ends the reader's read().
+  shutdown(fd_, SHUT_RDWR);
+  reader_.join();
+  if (region_) {
+    munmap(region_, sizeof(RpcRegion));
+  }
+  close(fd_);
+}
+
+void RpcStore::Connection::OfferRegion() {
+  int memfd = memfd_create("rpc_region", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (memfd < 0) {
+    return;
+  }
+  // Sealed at its size, so the daemon's mapping can't lose its pages.
+  void* map = MAP_FAILED;
+  if (ftruncate(memfd, sizeof(RpcRegion)) == 0 &&
+      fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW) == 0) {
+    map = mmap(nullptr, sizeof(RpcRegion), PROT_READ | PROT_WRITE,
+               MAP_SHARED, memfd, 0);
+  }
+  if (map == MAP_FAILED) {
+    close(memfd);
+    return;
+  }
+  // The memfd is zeroed, which is what the rings start as, and the arena's
+  // pages are only touched once used.
+  auto region = new (map) RpcRegion;
+
+  RpcHeader hello = {RpcOp::Hello, 0, next_tag_++,
+                     static_cast<uint64_t>(RpcTransport::SharedMemory)};
+  iovec iov = {&hello, sizeof(hello)};
+  alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+  msghdr msg = {};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  auto cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(cmsg), &memfd, sizeof(int));
+  bool sent = sendmsg(fd_, &msg, MSG_NOSIGNAL) == sizeof(hello);
+  close(memfd);
+
+  // Nothing else is in flight yet, so the next message is the reply.
+  RpcHeader reply = {};
+  size_t have = 0;
+  while (sent && have != sizeof(reply)) {
+    auto n = read(fd_, reinterpret_cast<char*>(&reply) + have,
+                  sizeof(reply) - have);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      break;
+    }
+    have += n;
+  }
+  if (have != sizeof(reply) || reply.value != 0) {
+    munmap(map, sizeof(RpcRegion));
+    return;
+  }
+  region_ = region;
+  for (uint32_t slot = kRingEntries; slot--;) {
+    free_slots_.push_back(slot);
+  }
+}
+
+uint64_t RpcStore::Connection::Call(RpcOp op, uint64_t id,
+                                    const Data* payload, Data* reply) {
+  if (region_) {
+    return CallRing(op, id, payload, reply);
+  }
+  Waiter waiter;
+  waiter.reply = reply;
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (broken_) {
+    return kFailed;
+  }
+  auto tag = next_tag_++;
+  waiting_[tag] = &waiter;
+  uint32_t len = payload ? static_cast<uint32_t>(payload->size()) : 0;
+  queued_.push_back({{op, len, tag, id}, payload});
+
+  // Whoever finds the socket idle writes what is queued, including the
+  // requests queued while it writes.
+  if (!writing_) {
+    writing_ = true;
+    std::vector<Request> batch;
+    std::vector<iovec> iov;
+    while (!queued_.empty() && !broken_) {
+      batch.swap(queued_);
+      lock.unlock();
+      iov.clear();
+      for (auto& req : batch) {
+        iov.push_back({&req.header, sizeof(req.header)});
+        if (req.header.len) {
+          iov.push_back({const_cast<uint8_t*>(req.payload->data()),
+                         req.header.len});
+        }
+      }
+      bool sent = rpc_write_all(fd_, iov.data(), iov.size());
+      writes.fetch_add(1, std::memory_order_relaxed);
+      batch.clear();
+      lock.lock();
+      if (!sent) {
+        FailLocked();
+      }
+    }
+    writing_ = false;
+  }
+  waiter.replied.wait(lock, [&waiter] { return waiter.done.load(); });
+  return waiter.value;
+}
+
+uint64_t RpcStore::Connection::CallRing(RpcOp op, uint64_t id,
+                                        const Data* payload, Data* reply) {
+  Waiter waiter;
+  waiter.reply = reply;
+  std::unique_lock<std::mutex> lock(mutex_);
+  slot_freed_.wait(lock, [this] { return broken_ || !free_slots_.empty(); });
+  if (broken_) {
+    return kFailed;
+  }
+  auto slot = free_slots_.back();
+  free_slots_.pop_back();
+  uint32_t len = payload ? static_cast<uint32_t>(payload->size()) : 0;
+  if (len) {
+    lock.unlock();
+    memcpy(region_->arena[slot], payload->data(), len);
+    lock.lock();
+    if (broken_) {
+      return kFailed;
+    }
+  }
+  auto tag = next_tag_++;
+  waiting_[tag] = &waiter;
+  auto& ring = region_->requests;
+  ring.entries[submitted_ % kRingEntries] = {{op, len, tag, id},
+                                             slot * kRingSlot};
+  if (rpc_ring::publish(&ring, ++submitted_)) {
+    wakeups.fetch_add(1, std::memory_order_relaxed);
+  }
+  lock.unlock();
+
+  // The reply usually comes back sooner than a sleep and a wakeup take.
+  for (int i = 0; i != rpc_ring::spins() && !waiter.done.load(); ++i) {
+    rpc_ring::cpu_relax();
+  }
+  // Also makes sure the reader is done with |waiter|.
+  lock.lock();
+  waiter.replied.wait(lock, [&waiter] { return waiter.done.load(); });
+  return waiter.value;
+}
+
+bool RpcStore::Connection::PeerGone() const {
+  char byte;
+  auto n = recv(fd_, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+  return n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR);
+}
+
+void RpcStore::Connection::FailLocked() {
+  broken_ = true;
+  queued_.clear();
+  for (auto& w : waiting_) {
+    w.second->done = true;
+    w.second->replied.notify_one();
+  }
+  waiting_.clear();
+  slot_freed_.notify_all();
+}
+
+void RpcStore::Connection::ReadLoop() {
+  std::vector<uint8_t> buffer(kReadBuffer);
+  size_t have = 0;
+  for (;;) {
+    auto n = read(fd_, buffer.data() + have, buffer.size() - have);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      break;
+    }
+    reads.fetch_add(1, std::memory_order_relaxed);
+    have += n;
+
+    size_t pos = 0;
+    while (have - pos >= sizeof(RpcHeader)) {
+      RpcHeader hdr;
+      memcpy(&hdr, &buffer[pos], sizeof(hdr));
+      if (hdr.len > kRpcMaxPayload) {
+        have = pos = 0;
+        shutdown(fd_, SHUT_RDWR);
+        break;
+      }
+      if (have - pos < sizeof(hdr) + hdr.len) {
+        break;
+      }
+      Waiter* waiter = nullptr;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = waiting_.find(hdr.tag);
+        if (it != waiting_.end()) {
+          waiter = it->second;
+          waiting_.erase(it);
+        }
+      }
+      if (waiter) {
+        // The caller waits on |done|, so nothing else touches its reply.
+        auto bytes = &buffer[pos + sizeof(hdr)];
+        if (waiter->reply) {
+          waiter->reply->assign(bytes, bytes + hdr.len);
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        waiter->value = hdr.value;
+        waiter->done = true;
+        waiter->replied.notify_one();
+      }
+      pos += sizeof(hdr) + hdr.len;
+    }
+    memmove(buffer.data(), buffer.data() + pos, have - pos);
+    have -= pos;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  FailLocked();
+}
+
+void RpcStore::Connection::RingLoop() {
+  auto& ring = region_->replies;
+  uint32_t head = 0;
+  while (!closing_) {
+    auto tail = rpc_ring::wait(&ring, head);
+    if (tail == head) {
+      if (PeerGone()) {
+        break;
+      }
+      continue;
+    }
+    for (; head != tail; ++head) {
+      auto entry = ring.entries[head % kRingEntries];
+      auto slot = static_cast<uint32_t>(entry.offset / kRingSlot);
+      Waiter* waiter = nullptr;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = waiting_.find(entry.header.tag);
+        if (it != waiting_.end()) {
+          waiter = it->second;
+          waiting_.erase(it);
+        }
+      }
+      if (waiter && waiter->reply) {
+        auto bytes = region_->arena[slot];
+        waiter->reply->assign(bytes, bytes + entry.header.len);
+      }
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (waiter) {
+        waiter->value = entry.header.value;
+        waiter->done = true;
+        waiter->replied.notify_one();
+      }
+      free_slots_.push_back(slot);
+      slot_freed_.notify_one();
+    }
+    ring.head.store(head, std::memory_order_release);
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  FailLocked();
+}
+
+class RpcStore::RpcBlob final : public Blob {
+ public:
+  RpcBlob(RpcStore* store, uint64_t id, Data data)
+      : store_(store), id_(id), data_(std::move(data)) {}
+
+  const Data& Get() const override { return data_; }
+
+  int Put(const Data& data) override {
+    // The daemon would take it for a malformed message.
+    if (data.size() > kRpcMaxPayload) {
+      return ErrBadArgs;
+    }
+    auto rc = static_cast<int>(store_->Call(RpcOp::Put, id_, &data, nullptr));
+    if (rc == 0) {
+      data_ = data;
+    }
+    return rc;
+  }
+
+  int Release() override {
+    delete this;
+    return 0;
+  }
+
+ private:
+  RpcStore* const store_;
+  const uint64_t id_;
+  Data data_;
+};
+
+RpcStore::RpcStore(const std::string& path, size_t connections,
+                   RpcTransport transport) {
+  for (size_t i = 0; i != std::max<size_t>(connections, 1); ++i) {
+    conns_.push_back(std::make_unique<Connection>(path, transport));
+  }
+}
+
+RpcStore::~RpcStore() {}
+
+bool RpcStore::ok() const {
+  for (auto& conn : conns_) {
+    if (!conn->ok()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+RpcTransport RpcStore::transport() const {
+  for (auto& conn : conns_) {
+    if (!conn->shared()) {
+      return RpcTransport::Socket;
+    }
+  }
+  return RpcTransport::SharedMemory;
+}
+
+uint64_t RpcStore::Call(RpcOp op, uint64_t id, const Data* payload,
+                        Data* reply) {
+  auto& conn = conns_[next_.fetch_add(1, std::memory_order_relaxed) %
+                      conns_.size()];
+  if (!conn->ok()) {
+    return kFailed;
+  }
+  return conn->Call(op, id, payload, reply);
+}
+
+Blob* RpcStore::GetBlob(uint64_t id) {
+  Data data;
+  if (Call(RpcOp::Get, id, nullptr, &data) != 0) {
+    return nullptr;
+  }
+  return new RpcBlob(this, id, std::move(data));
+}
+
+uint64_t RpcStore::GetFreeSpace() {
+  auto value = Call(RpcOp::FreeSpace, 0, nullptr, nullptr);
+  return value == kFailed ? 0 : value;
+}
+
+RpcStats RpcStore::stats() const {
+  RpcStats total = {next_.load(std::memory_order_relaxed), 0, 0, 0};
+  for (auto& conn : conns_) {
+    total.writes += conn->writes.load(std::memory_order_relaxed);
+    total.reads += conn->reads.load(std::memory_order_relaxed);
+    total.wakeups += conn->wakeups.load(std::memory_order_relaxed);
+  }
+  return total;
+}
@@ -0,0 +1,75 @@
+// rpc_store.h
+//
+// BlobStore client of the store daemon (rpc_server.h), for measuring what
+// an out-of-process store costs: serialization, syscalls and context
+// switches, without a network.
+//
+// Requests are spread round robin over several connections. On each, any
+// number of them are in flight at once (pipelining): a caller queues its
+// request and waits for the reply, which a reader thread per connection
+// hands to it by tag. Whoever finds the connection idle writes every
+// request queued by then in one sendmsg(), so concurrent callers, e.g. the
+// I/O scheduler's workers, share syscalls (batching).
+//
+// By default each connection then offers the daemon a shared memory region
+// (rpc_ring.h), and uses it instead of the socket if the daemon accepts, so
+// that calls cost no syscalls while both sides are busy. Requests on it are
+// pipelined as well, kRingEntries at most per connection.
+//
+// GetBlob() fetches the bytes, so a Blob is a local copy; Put() writes
+// through and waits for the daemon's ack. A connection that fails fails
+// its calls with ErrInternal, and GetBlob() returns null.
+
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "blob.h"
+#include "rpc_wire.h"
+
+struct RpcStats {
+  uint64_t calls;
+  // sendmsg() calls, each sending one or more requests.
+  uint64_t writes;
+  // read() calls, each receiving one or more replies.
+  uint64_t reads;
+  // Futex wakes of a sleeping daemon, on shared memory connections.
+  uint64_t wakeups;
+};
+
+class RpcStore final : public BlobStore {
+ public:
+  // Connects to the daemon listening at |path|, and offers it |transport|.
+  // See ok().
+  explicit RpcStore(const std::string& path, size_t connections = 4,
+                    RpcTransport transport = RpcTransport::SharedMemory);
+  ~RpcStore();
+
+  RpcStore(const RpcStore&) = delete;
+  RpcStore& operator=(const RpcStore&) = delete;
+
+  // Whether every connection was made.
+  bool ok() const;
+  // SharedMemory if the daemon took it on every connection.
+  RpcTransport transport() const;
+
+  Blob* GetBlob(uint64_t id) override;
+  uint64_t GetFreeSpace() override;
+
+  RpcStats stats() const;
+
+ private:
+  class Connection;
+  class RpcBlob;
+
+  // Sends a request and waits for its reply. Returns the reply's value.
+  uint64_t Call(RpcOp op, uint64_t id, const Data* payload, Data* reply);
+
+  std::vector<std::unique_ptr<Connection>> conns_;
+  std::atomic<uint64_t> next_{0};
+};
@@ -0,0 +1,87 @@
+// rpc_wire.h
+//
+// Wire format between RpcStore (rpc_store.h) and the store daemon
+// (rpc_server.h), over a Unix domain stream socket, and the write loop both
+// ends use.
+//
+// Every message is an RpcHeader followed by |len| payload bytes. A client
+// may send any number of requests before reading a reply, and replies can
+// come back in any order: each carries the |tag| of its request. Either
+// side writes whatever messages it has queued in one go.
+//
+//   op          request: id, payload       reply: value, payload
+//   Get         blob id, none              0 or error, the blob's bytes
+//   Put         blob id, the new bytes     0 or error, none
+//   FreeSpace   none, none                 free bytes, none
+//   Hello       transport, none            0 if accepted, none
+//
+// Hello offers the daemon another transport for the rest of the
+// connection; 0 is RpcTransport::SharedMemory (rpc_ring.h), whose region
+// comes with the message, as SCM_RIGHTS.
+//
+// Both ends are on one host, so fields are in its byte order.
+
+#pragma once
+
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <cstddef>
+
+#include "blob.h"
+
+enum class RpcOp : uint32_t {
+  Get = 1,
+  Put,
+  FreeSpace,
+  Hello,
+};
+
+enum class RpcTransport : uint64_t {
+  SharedMemory,
+  Socket,
+};
+
+struct RpcHeader {
+  RpcOp op;
+  uint32_t len;
+  uint64_t tag;
+  // The blob id of a request, the result of a reply.
+  uint64_t value;
+};
+
+static_assert(sizeof(RpcHeader) == 24, "RpcHeader is packed");
+
+// A message with a longer payload is malformed and ends the connection.
+constexpr size_t kRpcMaxPayload = MaxBlobSize;
+
+// Writes all of |iov|, which it consumes, in as few calls as the socket
+// takes. Returns false if the connection failed, without raising SIGPIPE.
+inline bool rpc_write_all(int fd, iovec* iov, size_t count) {
+  while (count) {
+    msghdr msg = {};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = std::min<size_t>(count, IOV_MAX);
+    auto n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    while (count && size_t(n) >= iov->iov_len) {
+      n -= iov->iov_len;
+      ++iov;
+      --count;
+    }
+    if (count) {
+      iov->iov_base = static_cast<char*>(iov->iov_base) + n;
+      iov->iov_len -= n;
+    }
+  }
+  return true;
+}
@@ -0,0 +1,42 @@
+// store_daemon.cc
+//
+// Serves the toy blob store (blob_impl.cc) to other processes on a Unix
+// domain socket, for bench -store and anything else using RpcStore
+// (rpc_store.h). Runs until SIGINT or SIGTERM.
+//
+// usage: store_daemon PATH
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <thread>
+
+#include "blob.h"
+#include "rpc_server.h"
+
+int main(int argc, char** argv) {
+  if (argc != 2) {
+    fprintf(stderr, "usage: store_daemon PATH\n");
+    return 2;
+  }
+  // Blocked in every thread, for sigwait() below to take.
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+  setenv("BLOB_QUIET", "1", 1);
+
+  RpcServer server(GetBlobStore(), argv[1]);
+  if (!server.ok()) {
+    fprintf(stderr, "can't listen at %s\n", argv[1]);
+    return 1;
+  }
+  std::thread runner(&RpcServer::Run, &server);
+  int sig = 0;
+  sigwait(&signals, &sig);
+  server.Stop();
+  runner.join();
+  return 0;
+}
@@ -0,0 +1,294 @@
+// stripe_store.cc
+//
+// See stripe_store.h.
+
+#include "stripe_store.h"
+
+#include <algorithm>
+
+namespace {
+
+// splitmix64's finalizer.
+uint64_t mix(uint64_t h) {
+  h ^= h >> 30;
+  h *= 0xbf58476d1ce4e5b9ull;
+  h ^= h >> 27;
+  h *= 0x94d049bb133111ebull;
+  h ^= h >> 31;
+  return h;
+}
+
+int PutTo(BlobStore* store, uint64_t id, const Data& data) {
+  auto blob = store->GetBlob(id);
+  if (!blob) {
+    return ErrInternal;
+  }
+  auto rc = blob->Put(data);
+  blob->Release();
+  return rc;
+}
+
+}  // namespace
+
+class StripeStore::StripeBlob final : public Blob {
+ public:
+  StripeBlob(StripeStore* store, uint64_t id) : store_(store), id_(id) {}
+
+  const Data& Get() const override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto epoch = store_->epoch_.load(std::memory_order_acquire);
+    if (!blob_ || epoch != epoch_) {
+      uint32_t holder;
+      BlobStore* backend;
+      {
+        std::lock_guard<std::mutex> lock(store_->mutex_);
+        holder = store_->Holder(id_);
+        backend = store_->backends_[holder];
+        epoch_ = store_->epoch_.load(std::memory_order_relaxed);
+      }
+      if (!blob_ || holder != on_) {
+        // What an earlier Get() returned stays valid until Release().
+        if (blob_) {
+          old_.push_back(blob_);
+        }
+        blob_ = backend->GetBlob(id_);
+        on_ = holder;
+      }
+    }
+    return blob_ ? blob_->Get() : empty();
+  }
+
+  int Put(const Data& data) override {
+    return store_->Put(id_, data);
+  }
+
+  int Release() override {
+    if (blob_) {
+      blob_->Release();
+    }
+    for (auto blob : old_) {
+      blob->Release();
+    }
+    delete this;
+    return 0;
+  }
+
+ private:
+  static const Data& empty() {
+    static const Data data;
+    return data;
+  }
+
+  StripeStore* const store_;
+  const uint64_t id_;
+  mutable std::mutex mutex_;
+  // The backend's blob, and which backend, as of |epoch_|.
+  mutable Blob* blob_ = nullptr;
+  mutable uint32_t on_ = 0;
+  mutable uint64_t epoch_ = 0;
+  // Blobs from backends it was read from before.
+  mutable std::vector<Blob*> old_;
+};
+
+StripeStore::StripeStore(std::vector<BlobStore*> backends)
+    : backends_(std::move(backends)) {
+  for (uint32_t b = 0; b != backends_.size(); ++b) {
+    AddPoints(b);
+  }
+}
+
+StripeStore::~StripeStore() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  if (rebalancer_.joinable()) {
+    rebalancer_.join();
+  }
+}
+
+void StripeStore::AddPoints(uint32_t backend) {
+  for (uint64_t v = 0; v != kVirtualNodes; ++v) {
+    ring_.emplace_back(mix(uint64_t(backend) << 32 | v), backend);
+  }
+  std::sort(ring_.begin(), ring_.end());
+}
+
+uint32_t StripeStore::Owner(uint64_t id) const {
+  auto it = std::lower_bound(ring_.begin(), ring_.end(),
+                             std::make_pair(mix(id), uint32_t(0)));
+  return it == ring_.end() ? ring_.front().second : it->second;
+}
+
+uint32_t StripeStore::Holder(uint64_t id) const {
+  auto it = pending_.find(id);
+  return it == pending_.end() ? Owner(id) : it->second;
+}
+
+Blob* StripeStore::GetBlob(uint64_t id) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ids_.insert(id);
+  }
+  return new StripeBlob(this, id);
+}
+
+uint64_t StripeStore::GetFreeSpace() {
+  std::vector<BlobStore*> backends;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    backends = backends_;
+  }
+  uint64_t total = 0;
+  for (auto backend : backends) {
+    total += backend->GetFreeSpace();
+  }
+  return total;
+}
+
+int StripeStore::Put(uint64_t id, const Data& data) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  moved_one_.wait(lock, [this, id] {
+    return !copying_ || copying_id_ != id;
+  });
+  auto owner = Owner(id);
+  auto to = backends_[owner];
+  auto it = pending_.find(id);
+  bool moving = it != pending_.end();
+  uint32_t from = moving ? it->second : owner;
+  // If the rebalancer picks the blob meanwhile, or AddBackend() moves it,
+  // its copy waits for this.
+  ++writing_[id];
+  lock.unlock();
+  auto rc = PutTo(to, id, data);
+  lock.lock();
+  if (--writing_[id] == 0) {
+    writing_.erase(id);
+  }
+  // A Put of a pending blob completes its move. Readers found it on its old
+  // backend until now.
+  it = pending_.find(id);
+  if (rc == 0 && moving && it != pending_.end() && it->second == from) {
+    if (Owner(id) == owner) {
+      pending_.erase(it);
+      ++moved_;
+    } else {
+      it->second = owner;
+    }
+    stale_.emplace_back(backends_[from], id);
+    epoch_.fetch_add(1, std::memory_order_release);
+  }
+  lock.unlock();
+  moved_one_.notify_all();
+  return rc;
+}
+
+void StripeStore::AddBackend(BlobStore* backend) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto old_ring = ring_;
+  uint32_t added = backends_.size();
+  backends_.push_back(backend);
+  AddPoints(added);
+  // Only blobs the new backend took over move. Pending ones go straight to
+  // their new owner, whichever it is.
+  std::swap(ring_, old_ring);
+  std::vector<std::pair<uint64_t, uint32_t>> owners;
+  for (auto id : ids_) {
+    if (!pending_.count(id)) {
+      owners.emplace_back(id, Owner(id));
+    }
+  }
+  std::swap(ring_, old_ring);
+  for (auto& owner : owners) {
+    if (Owner(owner.first) == added) {
+      pending_.emplace(owner.first, owner.second);
+    }
+  }
+  epoch_.fetch_add(1, std::memory_order_release);
+
+  if (!rebalancing_ && !pending_.empty()) {
+    if (rebalancer_.joinable()) {
+      rebalancer_.join();
+    }
+    rebalancing_ = true;
+    rebalancer_ = std::thread(&StripeStore::Rebalance, this);
+  }
+}
+
+void StripeStore::Rebalance() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  bool failed = false;
+  while (!stop_ && !failed && !pending_.empty()) {
+    while (!stop_ && !pending_.empty()) {
+      auto id = pending_.begin()->first;
+      copying_ = true;
+      copying_id_ = id;
+      // Puts already on their way land first, and one of them may have
+      // completed the move.
+      moved_one_.wait(lock, [this, id] { return !writing_.count(id); });
+      auto it = pending_.find(id);
+      if (it == pending_.end()) {
+        copying_ = false;
+        moved_one_.notify_all();
+        continue;
+      }
+      auto from = backends_[it->second];
+      auto to = Owner(id);
+      auto dst = backends_[to];
+      lock.unlock();
+
+      // Puts of this blob wait; reads go to |from| meanwhile.
+      auto blob = from->GetBlob(id);
+      Data data = blob ? blob->Get() : Data();
+      int rc = blob ? 0 : ErrInternal;
+      if (blob) {
+        blob->Release();
+      }
+      if (rc == 0 && !data.empty()) {
+        rc = PutTo(dst, id, data);
+      }
+
+      lock.lock();
+      copying_ = false;
+      moved_one_.notify_all();
+      if (rc != 0) {
+        // Left pending, and read where it is, until the next AddBackend().
+        failed = true;
+        break;
+      }
+      // Placement may have changed again during the copy.
+      if (Owner(id) == to) {
+        pending_.erase(id);
+        ++moved_;
+      } else {
+        pending_[id] = to;
+      }
+      if (!data.empty()) {
+        stale_.emplace_back(from, id);
+      }
+      epoch_.fetch_add(1, std::memory_order_release);
+    }
+    // Readers look a blob up again on every Get(), so by now none is still
+    // reading an old copy. Blobs queued meanwhile get another pass.
+    auto stale = std::move(stale_);
+    stale_.clear();
+    lock.unlock();
+    for (auto& copy : stale) {
+      PutTo(copy.first, copy.second, Data());
+    }
+    lock.lock();
+  }
+  rebalancing_ = false;
+  moved_one_.notify_all();
+}
+
+void StripeStore::WaitRebalanced() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  moved_one_.wait(lock, [this] { return !rebalancing_; });
+}
+
+StripeStats StripeStore::stats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return StripeStats {backends_.size(), ids_.size(), pending_.size(),
+                      moved_};
+}
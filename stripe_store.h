@@ -0,0 +1,111 @@
+// stripe_store.h
+//
+// A BlobStore striped over several backends, which can grow while in use.
+//
+// Each blob lives on one backend, picked by consistent hashing: every
+// backend owns kVirtualNodes points on a ring of 64-bit hashes, and a blob
+// belongs to the backend of the first point at or after the hash of its id.
+// A new backend takes over about 1/N of the ring, in small slices from each
+// of the others, so only the blobs in those slices move. Modulo placement
+// would move nearly all of them.
+//
+// AddBackend() switches placement at once and queues the blobs whose owner
+// changed, and a background rebalancer copies them across, one at a time
+// and without holding the store's lock while it does. Until a blob has
+// been copied it is read from its old backend. A Put of it waits for a copy
+// in progress, then goes to the new backend, outside the lock, and
+// completes the move once written. The rebalancer waits for Puts of a blob
+// already on their way before it copies it, and skips it if one of them
+// moved it. Old copies are blanked at the end of the rebalancer's pass, not as each blob
+// moves, so a reader that found a blob on its old backend just before it
+// moved still reads it whole.
+//
+// The Blobs handed out look up where their blob is only when placement
+// changed since they last did, so one held across AddBackend(), as caches
+// do, follows its blob to the new backend. It keeps the backend blobs it
+// read before until it is released, so what an earlier Get() returned
+// stays valid, and may be read from several threads.
+//
+// BlobStore has no way to list what a store holds, so this one keeps the
+// ids it has been asked for, about 8 bytes each, to know what to move.
+// Backends must be safe to call from any thread.
+
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "blob.h"
+
+struct StripeStats {
+  uint64_t backends;
+  uint64_t blobs;     // Ids asked for.
+  uint64_t pending;   // Waiting to move to their new backend.
+  uint64_t moved;
+};
+
+class StripeStore final : public BlobStore {
+ public:
+  static constexpr int kVirtualNodes = 64;
+
+  explicit StripeStore(std::vector<BlobStore*> backends);
+  // Stops the rebalancer. Blobs it hadn't moved yet stay on their old
+  // backends, where a new StripeStore won't look.
+  ~StripeStore();
+
+  StripeStore(const StripeStore&) = delete;
+  StripeStore& operator=(const StripeStore&) = delete;
+
+  Blob* GetBlob(uint64_t id) override;
+  // Of all backends.
+  uint64_t GetFreeSpace() override;
+
+  // Adds |backend| and starts moving its share of the blobs to it.
+  void AddBackend(BlobStore* backend);
+  // Waits until every blob is on its backend and the old copies are blank,
+  // or until the rebalancer gave up on a blob it couldn't copy.
+  void WaitRebalanced();
+
+  StripeStats stats() const;
+
+ private:
+  class StripeBlob;
+
+  // Index of the backend blob |id| belongs on. Called under |mutex_|.
+  uint32_t Owner(uint64_t id) const;
+  // Backend holding blob |id| now. Called under |mutex_|.
+  uint32_t Holder(uint64_t id) const;
+  void AddPoints(uint32_t backend);
+  int Put(uint64_t id, const Data& data);
+  void Rebalance();
+
+  mutable std::mutex mutex_;
+  std::condition_variable moved_one_;
+  std::vector<BlobStore*> backends_;
+  // Ring points and their backend, sorted.
+  std::vector<std::pair<uint64_t, uint32_t>> ring_;
+  std::unordered_set<uint64_t> ids_;
+  // Blobs not on their owner yet, and the backend they are on.
+  std::unordered_map<uint64_t, uint32_t> pending_;
+  // Old copies of moved blobs, to blank.
+  std::vector<std::pair<BlobStore*, uint64_t>> stale_;
+  // Blob the rebalancer is copying.
+  bool copying_ = false;
+  uint64_t copying_id_ = 0;
+  // Puts in progress outside |mutex_|, by id.
+  std::unordered_map<uint64_t, uint32_t> writing_;
+  uint64_t moved_ = 0;
+  // Bumped whenever a blob may have changed backend.
+  std::atomic<uint64_t> epoch_{0};
+  bool stop_ = false;
+  bool rebalancing_ = false;
+  std::thread rebalancer_;
+};
@@ -0,0 +1,27 @@
+// tier_store.cc
+//
+// See tier_store.h.
+
+#include "tier_store.h"
+
+#include "fs_layout.h"
+
+TierStore::TierStore(BlobStore* meta, BlobStore* data, BlobStore* cold)
+    : meta_(meta), data_(data), cold_(cold) {}
+
+Blob* TierStore::GetBlob(uint64_t id) {
+  if (id & g::COLD_TIER) {
+    return cold_->GetBlob(id & ~g::COLD_TIER);
+  }
+  if (id & g::DATA_SPACE) {
+    return data_->GetBlob(id);
+  }
+  return meta_->GetBlob(id);
+}
+
+uint64_t TierStore::GetFreeSpace() {
+  if (cold_ == data_) {
+    return data_->GetFreeSpace();
+  }
+  return data_->GetFreeSpace() + cold_->GetFreeSpace();
+}
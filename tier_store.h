@@ -0,0 +1,33 @@
+// tier_store.h
+//
+// Routes each data blob to the store its id names (fs_layout.h): ids with
+// the COLD_TIER bit go to the cold store with that bit cleared, other
+// DATA_SPACE ids to the data store, and ids with neither, the data older
+// volumes allocated alongside their metadata, to the metadata store.
+// Blobs are the store's own, so this adds nothing per request.
+//
+// The stores must be safe to call from the I/O scheduler's threads. Any of
+// them may be the same store: the ids each one sees are still unique.
+
+#pragma once
+
+#include <stdint.h>
+
+#include "blob.h"
+
+class TierStore final : public BlobStore {
+ public:
+  TierStore(BlobStore* meta, BlobStore* data, BlobStore* cold);
+
+  TierStore(const TierStore&) = delete;
+  TierStore& operator=(const TierStore&) = delete;
+
+  Blob* GetBlob(uint64_t id) override;
+  // Of the data and cold stores.
+  uint64_t GetFreeSpace() override;
+
+ private:
+  BlobStore* const meta_;
+  BlobStore* const data_;
+  BlobStore* const cold_;
+};
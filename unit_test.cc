@@ -0,0 +1,524 @@
+// unit_test.cc
+//
+// Checks of the pieces under filesys.h that main.cc can't reach through
+// it: the stores, the store daemon's server and the block encoders. Prints
+// which check failed, or "succesful run" once all of them passed.
+//
+// usage: unit_test
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "blob.h"
+#include "block_map.h"
+#include "dir_block.h"
+#include "file_store.h"
+#include "freq_sketch.h"
+#include "io_sched.h"
+#include "name_index.h"
+#include "rpc_server.h"
+#include "rpc_wire.h"
+#include "stripe_store.h"
+
+#define TEST(c, v) { if (!(c)) { printf("failed (%d) at line %d.\n", (v), __LINE__); return -1; }}
+
+namespace {
+
+// BlockMap ids read back across groups, after a group is repacked wider,
+// and with holes, of which trailing ones don't count towards size().
+int block_map_test() {
+  BlockMap map;
+  std::vector<uint64_t> ids(300);
+  for (uint64_t ix = 0; ix != ids.size(); ++ix) {
+    ids[ix] = 1000 + ix;
+  }
+  map.Set(0, ids.data(), ids.size());
+  TEST(map.size() == ids.size(), static_cast<int>(map.size()));
+  // One far id widens the second group only.
+  map.Set(130, 1ull << 40);
+  ids[130] = 1ull << 40;
+  map.Set(131, 0);
+  ids[131] = 0;
+  for (uint64_t ix = 0; ix != ids.size(); ++ix) {
+    TEST(map.Get(ix) == ids[ix], static_cast<int>(ix));
+  }
+  uint64_t tail[] = {5, 0, 0};
+  map.Set(400, tail, 3);
+  map.Set(1000, 0);
+  TEST(map.size() == 401, static_cast<int>(map.size()));
+  for (uint64_t ix = 300; ix != 1100; ++ix) {
+    TEST(map.Get(ix) == (ix == 400 ? 5 : 0), static_cast<int>(ix));
+  }
+  return 0;
+}
+
+// A packed directory block finds every name, in the first and later
+// groups, up to one MAX_PATH long, and none of the names between them.
+int dir_block_test() {
+  std::vector<g::DirEntry> entries;
+  for (uint64_t i = 0; i != 3 * g::DIR_RESTART + 5; ++i) {
+    char name[32];
+    snprintf(name, sizeof(name), "tenant/2024/shard-%03d", int(i));
+    entries.push_back({name, 100 + i});
+  }
+  std::string longest = "tenant/" + std::string(MAX_PATH - 7, 'z');
+  entries.push_back({longest, 1});
+
+  g::BlockHeader hdr = {g::BlocTypes::Dir, g::Flags::None, 5, 6};
+  auto data = g::dir_pack(hdr, entries);
+  TEST(data.size() == g::dir_packed_size(entries),
+       static_cast<int>(data.size()));
+  auto block = reinterpret_cast<const g::DirBlock*>(data.data());
+  TEST(block->flags == g::Flags::Packed && block->next == 6, 0);
+  for (size_t i = 0; i != entries.size(); ++i) {
+    TEST(g::dir_find(block, data.size(), entries[i].name) ==
+             entries[i].control_blob, static_cast<int>(i));
+    TEST(!g::dir_find(block, data.size(), entries[i].name + "-"),
+         static_cast<int>(i));
+  }
+  TEST(!g::dir_find(block, data.size(), "tenant/"), 0);
+  TEST(!g::dir_find(block, data.size(), longest + "z"), 0);
+  auto read = g::dir_entries(block, data.size());
+  TEST(read.size() == entries.size(), static_cast<int>(read.size()));
+  for (size_t i = 0; i != read.size(); ++i) {
+    TEST(read[i].name == entries[i].name &&
+             read[i].control_blob == entries[i].control_blob,
+         static_cast<int>(i));
+  }
+  return 0;
+}
+
+// NameIndex finds names whose first 8 bytes past the shared prefix tie
+// across many groups, and none of the names around them.
+int name_index_test() {
+  std::vector<g::DirEntry> entries;
+  uint64_t id = 1;
+  for (auto dir : {"alpha", "beta"}) {
+    for (int i = 0; i != 100; ++i) {
+      char name[64];
+      snprintf(name, sizeof(name), "vol/projects-%s/file-%03d", dir, i);
+      entries.push_back({name, id++});
+    }
+  }
+  entries.push_back({"vol/a", id++});
+  entries.push_back({"vol/" + std::string(MAX_PATH - 4, 'z'), id++});
+  g::NameIndex index(entries);
+  TEST(index.size() == entries.size(), static_cast<int>(index.size()));
+  for (auto& entry : entries) {
+    TEST(index.Find(entry.name) == entry.control_blob,
+         static_cast<int>(entry.control_blob));
+    TEST(!index.Find(entry.name + "0"), static_cast<int>(entry.control_blob));
+  }
+  for (auto name : {"", "vol", "vol/", "vol/a0", "vol/projects",
+                    "vol/projects-alpha/file-", "vol/projects-alpha/file-1",
+                    "vol/projects-beta/file-100", "vol/projects-gamma/x",
+                    "other/projects-alpha/file-001"}) {
+    TEST(!index.Find(name), 0);
+  }
+  TEST(!index.Find("vol/" + std::string(MAX_PATH - 3, 'z')), 0);
+  return 0;
+}
+
+// FrequencySketch counts saturate at 15, never under-count, and halve once
+// it has counted 10 accesses per id it was sized for.
+int freq_sketch_test() {
+  FrequencySketch sketch(1000);
+  for (int i = 0; i != 20; ++i) {
+    sketch.Increment(42);
+  }
+  for (int i = 0; i != 3; ++i) {
+    sketch.Increment(7);
+  }
+  TEST(sketch.Estimate(42) == 15, static_cast<int>(sketch.Estimate(42)));
+  TEST(sketch.Estimate(7) >= 3, static_cast<int>(sketch.Estimate(7)));
+  // The last of these makes it 10000.
+  for (uint64_t id = 1000000; id != 1000000 + 10000 - 23; ++id) {
+    sketch.Increment(id);
+  }
+  TEST(sketch.Estimate(42) == 7, static_cast<int>(sketch.Estimate(42)));
+  TEST(sketch.Estimate(7) >= 1 && sketch.Estimate(7) < 15,
+       static_cast<int>(sketch.Estimate(7)));
+  return 0;
+}
+
+// In memory store whose Blobs are copies, as with a real store, and whose
+// Gets can be held up after reading, to order them against other requests.
+class CopyStore final : public BlobStore {
+ public:
+  class CopyBlob final : public Blob {
+   public:
+    CopyBlob(CopyStore* store, uint64_t id, Data data)
+        : store_(store), id_(id), data_(std::move(data)) {}
+
+    const Data& Get() const override { return data_; }
+
+    int Put(const Data& data) override {
+      std::lock_guard<std::mutex> lock(store_->mutex_);
+      store_->blobs_[id_] = data;
+      data_ = data;
+      return 0;
+    }
+
+    int Release() override {
+      delete this;
+      return 0;
+    }
+
+   private:
+    CopyStore* const store_;
+    const uint64_t id_;
+    Data data_;
+  };
+
+  Blob* GetBlob(uint64_t id) override {
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto blob = new CopyBlob(this, id, blobs_[id]);
+    if (held_) {
+      ++held_reads_;
+      changed_.notify_all();
+      changed_.wait(lock, [this] { return !held_; });
+    }
+    return blob;
+  }
+
+  uint64_t GetFreeSpace() override { return 1ull << 30; }
+
+  // Blobs that aren't blank.
+  size_t size() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t n = 0;
+    for (auto& blob : blobs_) {
+      n += !blob.second.empty();
+    }
+    return n;
+  }
+
+  // Holds Gets, once read, until Release().
+  void Hold() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    held_ = true;
+  }
+
+  // Returns once |reads| Gets were held.
+  void WaitHeld(uint32_t reads) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    changed_.wait(lock, [this, reads] { return held_reads_ >= reads; });
+  }
+
+  void Release() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    held_ = false;
+    changed_.notify_all();
+  }
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable changed_;
+  std::unordered_map<uint64_t, Data> blobs_;
+  bool held_ = false;
+  uint32_t held_reads_ = 0;
+};
+
+Data bytes(const std::string& s) {
+  return Data(s.begin(), s.end());
+}
+
+// A prefetch that read a blob before a Put of it doesn't hand the old bytes
+// to the next GetBlob().
+int sched_store_test() {
+  CopyStore inner;
+  IoScheduler sched(&inner, 2);
+  SchedStore store(&sched);
+  auto blob = store.GetBlob(1);
+  TEST(blob && blob->Put(bytes("old")) == 0, 0);
+
+  inner.Hold();
+  store.Prefetch(1);
+  inner.WaitHeld(1);
+  TEST(blob->Put(bytes("new")) == 0, 0);
+  blob->Release();
+  inner.Release();
+  // Let the prefetch complete.
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+  blob = store.GetBlob(1);
+  TEST(blob && blob->Get() == bytes("new"),
+       blob ? static_cast<int>(blob->Get().size()) : -1);
+  blob->Release();
+  return 0;
+}
+
+// Growing a StripeStore by one backend moves about its share of the blobs,
+// readers see each blob whole throughout, also those Put while they move,
+// and no copy is left behind.
+int stripe_store_test() {
+  constexpr uint64_t kBlobs = 2000;
+  CopyStore backends[5];
+  StripeStore store({&backends[0], &backends[1], &backends[2],
+                     &backends[3]});
+  auto value = [](uint64_t id) {
+    return Data(16 + id % 100, static_cast<uint8_t>(id));
+  };
+  for (uint64_t id = 0; id != kBlobs; ++id) {
+    auto blob = store.GetBlob(id);
+    TEST(blob->Put(value(id)) == 0, static_cast<int>(id));
+    blob->Release();
+  }
+
+  std::atomic<bool> done{false};
+  std::atomic<int> wrong{0};
+  std::vector<std::thread> threads;
+  for (int t = 0; t != 3; ++t) {
+    threads.emplace_back([&, t] {
+      for (uint64_t i = t; !done; i += 7) {
+        auto id = i % kBlobs;
+        auto blob = store.GetBlob(id);
+        // One in three rewrites its blob, with the same bytes.
+        if (t == 0 && blob->Put(value(id)) != 0) {
+          ++wrong;
+        }
+        if (blob->Get() != value(id)) {
+          ++wrong;
+        }
+        blob->Release();
+      }
+    });
+  }
+  store.AddBackend(&backends[4]);
+  store.WaitRebalanced();
+  done = true;
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  TEST(wrong == 0, wrong.load());
+
+  auto stats = store.stats();
+  TEST(stats.pending == 0, static_cast<int>(stats.pending));
+  TEST(stats.moved > kBlobs / 8 && stats.moved < kBlobs / 3,
+       static_cast<int>(stats.moved));
+  TEST(backends[4].size() == stats.moved,
+       static_cast<int>(backends[4].size()));
+  size_t held = 0;
+  for (auto& backend : backends) {
+    held += backend.size();
+  }
+  TEST(held == kBlobs, static_cast<int>(held));
+  for (uint64_t id = 0; id != kBlobs; ++id) {
+    auto blob = store.GetBlob(id);
+    TEST(blob->Get() == value(id), static_cast<int>(id));
+    blob->Release();
+  }
+  return 0;
+}
+
+// Reopening a FileStore whose newest copy of a blob is torn finds the copy
+// before it.
+int file_store_test() {
+  auto path = "/tmp/unit_test-" + std::to_string(getpid()) + ".fs";
+  unlink(path.c_str());
+  auto put = [](BlobStore* store, uint64_t id, const std::string& s) {
+    auto blob = store->GetBlob(id);
+    auto rc = blob ? blob->Put(bytes(s)) : ErrInternal;
+    if (blob) {
+      blob->Release();
+    }
+    return rc;
+  };
+  auto get = [](BlobStore* store, uint64_t id) {
+    auto blob = store->GetBlob(id);
+    Data data = blob ? blob->Get() : Data();
+    if (blob) {
+      blob->Release();
+    }
+    return data;
+  };
+  {
+    FileStore store(path, 1ull << 30, FileIo::Buffered, FileSync::Group);
+    TEST(store.ok(), 0);
+    TEST(put(&store, 1, std::string(1000, 'a')) == 0, 0);
+    TEST(put(&store, 2, "other") == 0, 0);
+    TEST(put(&store, 1, std::string(500, 'b')) == 0, 0);
+  }
+  // The second copy of blob 1 is in slot 2.
+  auto fd = open(path.c_str(), O_RDWR);
+  TEST(fd >= 0, errno);
+  char x = 'x';
+  auto at = 2 * FileStore::kSlotSize + FileStore::kBlockSize + 100;
+  TEST(pwrite(fd, &x, 1, at) == 1, errno);
+  close(fd);
+  {
+    FileStore store(path, 1ull << 30);
+    TEST(store.ok(), 0);
+    TEST(get(&store, 1) == bytes(std::string(1000, 'a')), 1);
+    TEST(get(&store, 2) == bytes("other"), 2);
+    TEST(store.stats().torn == 1, static_cast<int>(store.stats().torn));
+  }
+  // Reopened with room for fewer slots than the file has, only the torn one
+  // is free.
+  {
+    FileStore store(path, MaxBlobSize);
+    TEST(store.ok(), 0);
+    TEST(put(&store, 3, "c") == 0, 0);
+    TEST(put(&store, 4, "d") == ErrOutofSpace, 0);
+  }
+  unlink(path.c_str());
+  return 0;
+}
+
+// A raw RpcStore connection, to send requests exactly as given.
+class RpcClient {
+ public:
+  explicit RpcClient(const std::string& path) {
+    fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    if (connect(fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr))) {
+      close(fd_);
+      fd_ = -1;
+    }
+  }
+  ~RpcClient() {
+    if (fd_ >= 0) {
+      close(fd_);
+    }
+  }
+
+  bool ok() const { return fd_ >= 0; }
+
+  // Queues a request, sent by Send().
+  void Add(RpcOp op, uint64_t id, const std::string& payload) {
+    RpcHeader req = {op, static_cast<uint32_t>(payload.size()), ++tag_, id};
+    auto bytes = reinterpret_cast<const char*>(&req);
+    out_.append(bytes, sizeof(req));
+    out_ += payload;
+  }
+
+  bool Send() {
+    auto sent = write(fd_, out_.data(), out_.size());
+    bool ok = sent == static_cast<ssize_t>(out_.size());
+    out_.clear();
+    return ok;
+  }
+
+  // Reads the next reply, and its payload into |*payload|.
+  bool Receive(RpcHeader* reply, std::string* payload) {
+    if (!ReadAll(reply, sizeof(*reply))) {
+      return false;
+    }
+    payload->resize(reply->len);
+    return ReadAll(&(*payload)[0], reply->len);
+  }
+
+ private:
+  bool ReadAll(void* buffer, size_t size) {
+    auto p = static_cast<char*>(buffer);
+    while (size) {
+      auto n = read(fd_, p, size);
+      if (n <= 0) {
+        return false;
+      }
+      p += n;
+      size -= n;
+    }
+    return true;
+  }
+
+  int fd_ = -1;
+  uint64_t tag_ = 0;
+  std::string out_;
+};
+
+// A Get pipelined with Puts of the same blob replies with the bytes it had
+// when the Get ran, also while another connection Puts it.
+int rpc_server_test() {
+  auto path = "/tmp/unit_test-" + std::to_string(getpid()) + ".sock";
+  RpcServer server(GetBlobStore(), path);
+  TEST(server.ok(), 0);
+  std::thread runner(&RpcServer::Run, &server);
+
+  RpcClient client(path);
+  TEST(client.ok(), 0);
+  client.Add(RpcOp::Put, 7, "AAAA");
+  client.Add(RpcOp::Get, 7, "");
+  client.Add(RpcOp::Put, 7, "B");
+  TEST(client.Send(), 0);
+  RpcHeader reply;
+  std::string payload;
+  TEST(client.Receive(&reply, &payload) && reply.value == 0, 0);
+  TEST(client.Receive(&reply, &payload), 0);
+  TEST(payload == "AAAA", static_cast<int>(payload.size()));
+  TEST(client.Receive(&reply, &payload) && reply.value == 0, 0);
+
+  const std::string big(1000, 'C');
+  std::atomic<bool> done{false};
+  std::thread writer([&] {
+    RpcClient other(path);
+    for (int i = 0; !done && other.ok(); ++i) {
+      other.Add(RpcOp::Put, 8, i % 2 ? big : "D");
+      RpcHeader put;
+      std::string none;
+      if (!other.Send() || !other.Receive(&put, &none)) {
+        break;
+      }
+    }
+  });
+  int torn = 0;
+  for (int i = 0; i != 2000; ++i) {
+    client.Add(RpcOp::Get, 8, "");
+    if (!client.Send() || !client.Receive(&reply, &payload)) {
+      torn = -1;
+      break;
+    }
+    if (!payload.empty() && payload != big && payload != "D") {
+      ++torn;
+    }
+  }
+  done = true;
+  writer.join();
+  TEST(torn == 0, torn);
+
+  server.Stop();
+  runner.join();
+  return 0;
+}
+
+}  // namespace
+
+int main() {
+  // Keep the toy blob store from dumping every Put.
+  setenv("BLOB_QUIET", "1", 1);
+
+  int (*tests[])() = {
+      block_map_test,
+      dir_block_test,
+      name_index_test,
+      freq_sketch_test,
+      rpc_server_test,
+      sched_store_test,
+      stripe_store_test,
+      file_store_test,
+  };
+  for (auto test : tests) {
+    if (test() != 0) {
+      return -1;
+    }
+  }
+  printf("succesful run\n");
+  return 0;
+}
@@ -0,0 +1,42 @@
+// varint.h
+//
+// LEB128 varints: 7 bits per byte, low bits first, high bit set on every
+// byte but the last. Used by the packed directory blocks (dir_block.h) and
+// the name index (name_index.h).
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+inline size_t varint_size(uint64_t v) {
+  size_t n = 1;
+  while (v >= 0x80) {
+    v >>= 7;
+    ++n;
+  }
+  return n;
+}
+
+inline uint8_t* put_varint(uint8_t* p, uint64_t v) {
+  while (v >= 0x80) {
+    *p++ = static_cast<uint8_t>(v | 0x80);
+    v >>= 7;
+  }
+  *p++ = static_cast<uint8_t>(v);
+  return p;
+}
+
+// Returns null past |end| or on a malformed varint.
+inline const uint8_t* get_varint(const uint8_t* p, const uint8_t* end,
+                                 uint64_t* v) {
+  *v = 0;
+  for (int shift = 0; p != end && shift < 64; shift += 7) {
+    uint64_t byte = *p++;
+    *v |= (byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      return p;
+    }
+  }
+  return nullptr;
+}